@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include "alloc.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// the block size of each size class
+static const size_t class_sizes[SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048
+};
+
+
+static size_t round_to(size_t bytes, size_t unit)
+{
+    return (bytes + unit - 1) / unit * unit;
+}
+
+
+static bool huge_aligned(void *p)
+{
+    return reinterpret_cast<uintptr_t>(p) % HUGE_PAGE == 0;
+}
+
+
+// map whole huge pages at a huge page boundary, mapping a page more and
+// trimming the ends
+static char *map_aligned(size_t size)
+{
+    char *p = static_cast<char*>(mmap(nullptr, size + HUGE_PAGE, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(p == MAP_FAILED) throw std::bad_alloc();
+
+    char *aligned = reinterpret_cast<char*>(round_to(reinterpret_cast<uintptr_t>(p), HUGE_PAGE));
+    if(aligned > p) munmap(p, aligned - p);
+    if(aligned < p + HUGE_PAGE) munmap(aligned + size, p + HUGE_PAGE - aligned);
+    return aligned;
+}
+
+
+//////////////////////////////////////////
+// Allocator Implementation
+//////////////////////////////////////////
+
+// constructor and destructor
+Allocator::Allocator()
+{
+    for(int i = 0; i < SIZE_CLASSES; i++) {
+        _free[i] = nullptr;
+        _count[i] = 0;
+    }
+    _small = 0;
+    _slabBytes = 0;
+    _medium = 0;
+    _large = 0;
+    _largeBytes = 0;
+    _largeTotal = 0;
+    _hugeBytes = 0;
+    _cacheBytes = 0;
+    _remaps = 0;
+    _remapsInPlace = 0;
+}
+
+
+Allocator::~Allocator()
+{
+    // slabs are held until the process exits
+}
+
+
+// the allocator of the calling thread
+Allocator &Allocator::local()
+{
+    // never destroyed, static objects may release blocks after thread
+    // locals are gone
+    static thread_local Allocator *allocator = new Allocator();
+    return *allocator;
+}
+
+
+// allocate a block
+void *Allocator::allocate(size_t bytes)
+{
+    if(bytes <= SMALL_MAX) {
+        int cls = size_class(bytes);
+        if(not _free[cls]) refill(cls);
+
+        FreeBlock *block = _free[cls];
+        _free[cls] = block->next;
+        _count[cls]++;
+        _small++;
+        return block;
+    } else if(bytes < LARGE_MIN) {
+        void *block = malloc(bytes);
+        if(not block) throw std::bad_alloc();
+        _medium++;
+        return block;
+    }
+
+    void *block = map(bytes);
+    _large++;
+    _largeTotal++;
+    _largeBytes += bytes;
+    return block;
+}
+
+
+// release a block, given the size it was allocated with
+void Allocator::release(void *p, size_t bytes)
+{
+    if(p == nullptr) {
+        return;
+    } else if(bytes <= SMALL_MAX) {
+        int cls = size_class(bytes);
+        FreeBlock *block = static_cast<FreeBlock*>(p);
+        block->next = _free[cls];
+        _free[cls] = block;
+        _small--;
+    } else if(bytes < LARGE_MIN) {
+        free(p);
+        _medium--;
+    } else {
+        unmap(p, bytes);
+        _large--;
+        _largeBytes -= bytes;
+    }
+}
+
+
+// resize a block, keeping its contents
+void *Allocator::reallocate(void *p, size_t bytes, size_t newBytes)
+{
+    if(bytes >= LARGE_MIN and newBytes >= LARGE_MIN) {
+        void *block = remap(p, bytes, newBytes);
+        _largeBytes += newBytes - bytes;
+        return block;
+    } else if(bytes <= SMALL_MAX and newBytes <= SMALL_MAX and
+              size_class(bytes) == size_class(newBytes)) {
+        return p;
+    }
+
+    void *block = allocate(newBytes);
+    memcpy(block, p, std::min(bytes, newBytes));
+    release(p, bytes);
+    return block;
+}
+
+
+// report the allocation counts and the memory held
+void Allocator::report(std::ostream &os) const
+{
+    os << "alloc: " << _small << " small blocks in use, " << _slabBytes / 1024
+       << " KB of slabs, " << _medium << " medium blocks" << std::endl
+       << "alloc: " << _large << " large mappings in use (" << _largeBytes / 1024
+       << " KB), " << _largeTotal << " ever, " << _hugeBytes / 1024
+       << " KB advised for huge pages, " << _cacheBytes / 1024 << " KB cached" << std::endl
+       << "alloc: " << _remaps << " mappings resized, " << _remapsInPlace << " in place" << std::endl
+       << "alloc: blocks by size class:";
+    for(int i = 0; i < SIZE_CLASSES; i++) {
+        if(_count[i]) os << " " << class_sizes[i] << ":" << _count[i];
+    }
+    os << std::endl;
+}
+
+
+// the size class of a small block
+int Allocator::size_class(size_t bytes)
+{
+    // one table entry per 16 bytes
+    static int table[SMALL_MAX / 16 + 1];
+    static bool built = false;
+    if(not built) {
+        int cls = 0;
+        for(size_t i = 0; i <= SMALL_MAX / 16; i++) {
+            while(class_sizes[cls] < i * 16) cls++;
+            table[i] = cls;
+        }
+        built = true;
+    }
+    return table[(bytes + 15) / 16];
+}
+
+
+// carve a new slab into blocks of a size class
+void Allocator::refill(int cls)
+{
+    size_t size = class_sizes[cls];
+    char *slab = static_cast<char*>(map(SLAB_SIZE));
+    _slabBytes += SLAB_SIZE;
+
+    // thread the blocks onto the free list in address order
+    for(size_t offset = SLAB_SIZE - SLAB_SIZE % size; offset >= size; offset -= size) {
+        FreeBlock *block = reinterpret_cast<FreeBlock*>(slab + offset - size);
+        block->next = _free[cls];
+        _free[cls] = block;
+    }
+}
+
+
+// map a large block, huge page aligned when it is big enough
+void *Allocator::map(size_t bytes)
+{
+    bool huge = bytes >= HUGE_PAGE;
+    size_t size = round_to(bytes, huge ? HUGE_PAGE : 4096);
+
+    // reuse a released mapping of the same size, its pages are still in
+    for(size_t i = 0; i < _cache.size(); i++) {
+        if(_cache[i].second == size) {
+            void *block = _cache[i].first;
+            _cache[i] = _cache.back();
+            _cache.pop_back();
+            _cacheBytes -= size;
+            return block;
+        }
+    }
+
+    if(not huge) {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) throw std::bad_alloc();
+        return p;
+    }
+
+    char *aligned = map_aligned(size);
+    madvise(aligned, size, MADV_HUGEPAGE);
+    _hugeBytes += size;
+    return aligned;
+}
+
+
+void Allocator::unmap(void *p, size_t bytes)
+{
+    bool huge = bytes >= HUGE_PAGE;
+    size_t size = round_to(bytes, huge ? HUGE_PAGE : 4096);
+    if(_cacheBytes + size <= LARGE_CACHE) {
+        _cache.push_back(std::make_pair(p, size));
+        _cacheBytes += size;
+        return;
+    }
+
+    munmap(p, size);
+    if(huge) _hugeBytes -= size;
+}
+
+
+// resize a mapping, the kernel extends it in place when the pages after
+// it are free and moves its pages otherwise; a mapping of huge pages is
+// only moved to a huge page boundary, so it keeps them as it grows
+void *Allocator::remap(void *p, size_t bytes, size_t newBytes)
+{
+    bool huge = bytes >= HUGE_PAGE;
+    bool hugeNew = newBytes >= HUGE_PAGE;
+    size_t size = round_to(bytes, huge ? HUGE_PAGE : 4096);
+    size_t newSize = round_to(newBytes, hugeNew ? HUGE_PAGE : 4096);
+    if(size == newSize) return p;
+
+    void *block = MAP_FAILED;
+    if(not hugeNew or huge_aligned(p)) {
+        block = mremap(p, size, newSize, 0);
+    }
+    if(block == MAP_FAILED and hugeNew) {
+        // the pages are moved over an aligned mapping, which they replace
+        char *target = map_aligned(newSize);
+        block = mremap(p, size, newSize, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+        if(block == MAP_FAILED) munmap(target, newSize);
+    } else if(block == MAP_FAILED) {
+        block = mremap(p, size, newSize, MREMAP_MAYMOVE);
+    }
+    if(block == MAP_FAILED) throw std::bad_alloc();
+    _remaps++;
+    if(block == p) _remapsInPlace++;
+
+    if(huge) _hugeBytes -= size;
+    if(hugeNew) {
+        madvise(block, newSize, MADV_HUGEPAGE);
+        _hugeBytes += newSize;
+    }
+    return block;
+}
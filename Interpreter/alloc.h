@@ -0,0 +1,95 @@
+// This file contains the runtime allocator behind the heap and the env.
+// Small blocks come from size-class slabs kept per thread, and large
+// blocks get mappings of their own, advised for transparent huge pages
+// so that big arrays are walked with fewer TLB misses.
+#ifndef ALLOC_H
+#define ALLOC_H
+#include <cstddef>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// the allocator sizes
+const size_t SLAB_SIZE = 256 << 10;     // the memory a size class is refilled with
+const size_t SMALL_MAX = 2048;          // the largest block from a slab
+const size_t LARGE_MIN = 256 << 10;     // the smallest block with its own mapping
+const size_t HUGE_PAGE = 2 << 20;
+const size_t LARGE_CACHE = 64 << 20;    // released mappings kept for reuse
+const int SIZE_CLASSES = 24;
+
+
+class Allocator
+{
+public:
+    // constructor and destructor
+    Allocator();
+    virtual ~Allocator();
+
+    // allocate and release a block, release must be given the same size
+    virtual void *allocate(size_t bytes);
+    virtual void release(void *p, size_t bytes);
+
+    // resize a block, keeping its contents; large blocks are remapped so
+    // their pages move rather than being copied
+    virtual void *reallocate(void *p, size_t bytes, size_t newBytes);
+
+    // report the allocation counts and the memory held
+    virtual void report(std::ostream &os) const;
+
+    // the allocator of the calling thread, blocks must be released by
+    // the thread which allocated them
+    static Allocator &local();
+
+private:
+    // the size class of a small block
+    static int size_class(size_t bytes);
+
+    // carve a new slab into blocks of a size class
+    void refill(int cls);
+
+    // map a large block, huge page aligned when it is big enough
+    void *map(size_t bytes);
+    void unmap(void *p, size_t bytes);
+    void *remap(void *p, size_t bytes, size_t newBytes);
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+    FreeBlock *_free[SIZE_CLASSES];
+
+    // released mappings, reused by blocks of the same mapped size
+    std::vector<std::pair<void*, size_t>> _cache;
+    size_t _cacheBytes;
+
+    // statistics
+    size_t _count[SIZE_CLASSES];    // blocks handed out by size class
+    size_t _small;                  // small blocks in use
+    size_t _slabBytes;              // memory held in slabs
+    size_t _medium;                 // blocks from malloc
+    size_t _large;                  // mapped blocks in use
+    size_t _largeBytes;
+    size_t _largeTotal;             // mapped blocks ever
+    size_t _hugeBytes;              // mapped bytes advised for huge pages
+    size_t _remaps;                 // mappings resized
+    size_t _remapsInPlace;          // those which did not move
+};
+
+
+// An STL allocator for runtime containers, such as the env's map nodes
+template<typename T>
+class RuntimeAllocator
+{
+public:
+    typedef T value_type;
+
+    RuntimeAllocator() {}
+    template<typename U> RuntimeAllocator(const RuntimeAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T*>(Allocator::local().allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { Allocator::local().release(p, n * sizeof(T)); }
+
+    template<typename U> bool operator==(const RuntimeAllocator<U> &) const { return true; }
+    template<typename U> bool operator!=(const RuntimeAllocator<U> &) const { return false; }
+};
+#endif
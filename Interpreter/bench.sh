@@ -0,0 +1,17 @@
+#!/bin/sh
+# Times each engine on examples/bubble_sort scaled up to N numbers.
+# usage: ./bench.sh [N]
+N=${1:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+sed "s/10/$N/g" examples/bubble_sort > "$DIR/bubble_sort"
+seq "$N" -1 1 > "$DIR/input"
+
+for engine in --interpret "" --closure --jit; do
+    start=$(date +%s.%N)
+    ./calc $engine "$DIR/bubble_sort" < "$DIR/input" > "$DIR/output$engine"
+    end=$(date +%s.%N)
+    echo "bubble_sort N=$N ${engine:-tiered}: $(awk "BEGIN { printf \"%.3f\", $end - $start }") s"
+    cmp -s "$DIR/output--interpret" "$DIR/output$engine" || echo "  output differs from the plain interpreter"
+done
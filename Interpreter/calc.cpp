@@ -1,30 +1,140 @@
 // This file contains the main function and interface for the calc interpreter.
 #include <iostream>
+#include <cstdlib>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include "lexer.h"
 #include "parser.h"
 #include "op.h"
-
-// Functions for the two modes of operation
-static void calc_file(const char *fname);
+#include "gc.h"
+#include "alloc.h"
+#include "closure.h"
+#include "jit.h"
+#include "emit.h"
+
+// Functions for the two modes of operation, a file returns its exit status
+static int calc_file(const char *fname);
 static void calc_repl();
 
+// print how calc is run
+static int usage(const char *name);
+
+// run a program with the selected engine
+static void run(ParseTree *program);
+
+// true if programs are compiled to closures before they run
+static bool use_closures = false;
+
+// true if loops are compiled to native code
+static bool use_jit = false;
+
+// true if hot methods and loops are promoted out of the tree-walker
+static bool use_tiers = true;
+
+// true if programs are translated to C++ instead of run
+static bool emit_cpp = false;
+
+// true if the collector reports its statistics on exit
+static bool gc_stats = false;
+
+// true if the allocator reports its statistics on exit
+static bool alloc_stats = false;
+
+// true if the tiers report how often they promoted and fell back on exit
+static bool tier_stats = false;
+
 
 int main(int argc, char **argv) {
+    const char *fname = nullptr;
+
+    // pick out the engine flags
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--closure") {
+            use_closures = true;
+        } else if(arg == "--jit") {
+            use_jit = true;
+        } else if(arg == "--interpret") {
+            use_tiers = false;
+        } else if(arg == "--emit-cpp") {
+            emit_cpp = true;
+        } else if(arg == "--gc-stats") {
+            gc_stats = true;
+        } else if(arg == "--alloc-stats") {
+            alloc_stats = true;
+        } else if(arg == "--tier-stats") {
+            tier_stats = true;
+        } else if(arg == "--max-depth") {
+            // the depth must be given, and be a positive number
+            if(i + 1 == argc or atoi(argv[i + 1]) <= 0) {
+                std::cerr << "--max-depth needs a positive number" << std::endl;
+                return usage(argv[0]);
+            }
+            frames.limit = atoi(argv[++i]);
+        } else if(not fname) {
+            fname = argv[i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    // translation needs a whole program
+    if(emit_cpp and not fname) {
+        std::cerr << "--emit-cpp needs a filename" << std::endl;
+        return -1;
+    }
+
     //run the appropriate mode
-    if(argc == 1) {
+    int status = 0;
+    if(not fname) {
         calc_repl();
-    } else if(argc == 2) {
-        calc_file(argv[1]);
     } else {
-        std::cerr << "Usage: " << argv[0] << " [filename]" << std::endl;
+        status = calc_file(fname);
+    }
+
+    if(gc_stats) {
+        heap.report(std::cerr);
+    }
+    if(alloc_stats) {
+        Allocator::local().report(std::cerr);
+    }
+    if(tier_stats) {
+        Tiered::report(std::cerr);
+    }
+    return status;
+}
+
+
+static int usage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [--closure | --jit | --interpret | --emit-cpp]"
+              << " [--max-depth N] [--gc-stats] [--alloc-stats] [--tier-stats] [filename]" << std::endl;
+    return -1;
+}
+
+
+static void run(ParseTree *program)
+{
+    if(use_jit) {
+        JitCompiler compiler;
+        compiler.compile(program)();
+    } else if(use_closures) {
+        ClosureCompiler compiler;
+        compiler.compile(program)();
+    } else if(use_tiers) {
+        // start in the tree-walker, the optimizer outlives the code it compiles
+        static ClosureCompiler tier;
+        tier.declare(program);
+        optimizer = &tier;
+        program->eval();
+    } else {
+        program->eval();
     }
 }
 
 
-static void calc_file(const char *fname) 
+static int calc_file(const char *fname) 
 {
     // attempt to open the file
     std::ifstream file;
@@ -32,7 +142,7 @@ static void calc_file(const char *fname)
 
     if(!file) {
         std::cerr << "Could not open " << fname << std::endl;
-        return;
+        return 1;
     }
 
     try {
@@ -41,15 +151,35 @@ static void calc_file(const char *fname)
         Parser parser{lex};
         ParseTree *program = parser.parse();
 
+        // translate the program instead of running it
+        if(emit_cpp) {
+            std::ostringstream out;
+            CppEmitter emitter{out};
+            emitter.emit(program);
+            std::cout << out.str();
+            file.close();
+            return 0;
+        }
+
+        // fuse common statement patterns into superinstructions
+        program = program->fuse();
+
         // run the program
-        program->eval();
+        run(program);
 
         file.close();
-    } catch(ParseError e) {
+    } catch(ParseError &e) {
         std::cerr << e.what() << std::endl;
         file.close();
-    } 
-
+        return 1;
+    } catch(std::runtime_error &e) {
+        // a program which fails stops with its error, whatever the engine
+        std::cout.flush();
+        std::cerr << e.what() << std::endl;
+        file.close();
+        return 1;
+    }
+    return 0;
 }
 
 
@@ -63,6 +193,9 @@ static void calc_repl()
     std::string line;
     bool print_tree;
 
+    // each line is typed on its own, so nothing is ever known to be hot
+    use_tiers = false;
+
     std::cout << "Print parse tree (y/n)? ";
     std::getline(std::cin, line);
 
@@ -83,16 +216,21 @@ static void calc_repl()
         Lexer lex{is};
         Parser parser{lex};
 
+        ParseTree *program = nullptr;
         try {
-            ParseTree *program = parser.parse();
+            program = parser.parse()->fuse();
             if(print_tree) {
                 program->print(0);
             }
-            program->eval();
-            delete program;
-        } catch(ParseError e) {
+            run(program);
+        } catch(ParseError &e) {
+            std::cerr << e.what() << std::endl;
+        } catch(std::runtime_error &e) {
+            // a line which fails is reported, and the next one is read
+            std::cout.flush();
             std::cerr << e.what() << std::endl;
         }
+        delete program;
     
         // attempt to parse and run the stream
     } while(std::cin and line != "quit");
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Runs each example which has an expected output, examples/NAME.out, on
+# every engine, and the C++ --emit-cpp writes for it when it can be
+# translated; input is read from examples/NAME.in when there is one.
+# usage: ./check.sh [NAME...]
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+if [ $# -eq 0 ]; then
+    set -- $(for out in examples/*.out; do basename "$out" .out; done)
+fi
+
+failed=0
+for name in "$@"; do
+    input=/dev/null
+    [ -f "examples/$name.in" ] && input="examples/$name.in"
+
+    for engine in --interpret "" --closure --jit; do
+        ./calc $engine "examples/$name" < "$input" > "$DIR/output" 2>&1
+        if ! cmp -s "$DIR/output" "examples/$name.out"; then
+            echo "$name ${engine:-tiered}: output differs from examples/$name.out"
+            failed=1
+        fi
+    done
+
+    if ./calc --emit-cpp "examples/$name" > "$DIR/$name.cpp" 2> /dev/null; then
+        if ! g++ -O2 -o "$DIR/$name" "$DIR/$name.cpp"; then
+            echo "$name --emit-cpp: the C++ does not build"
+            failed=1
+        else
+            "$DIR/$name" < "$input" > "$DIR/output" 2>&1
+            if ! cmp -s "$DIR/output" "examples/$name.out"; then
+                echo "$name --emit-cpp: output differs from examples/$name.out"
+                failed=1
+            fi
+        fi
+    fi
+done
+
+# loops in methods are promoted once hot, and stay promoted
+if ! ./calc --tier-stats examples/method_loops 2>&1 > /dev/null | grep -q " 0 fell back"; then
+    echo "method_loops tiered: a promoted loop fell back to the tree-walker"
+    failed=1
+fi
+
+# calls in tail position run within any depth limit, and the others stop
+# at it with an error
+expected=$(printf '500000500000\nCall depth limit of 100 exceeded')
+for engine in --interpret "" --closure --jit; do
+    if [ "$(./calc --max-depth 100 $engine examples/recursion 2>&1)" != "$expected" ]; then
+        echo "recursion ${engine:-tiered}: --max-depth 100 does not stop at the expected depth"
+        failed=1
+    fi
+done
+
+[ $failed -eq 0 ] && echo "all examples match"
+exit $failed
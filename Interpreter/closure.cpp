@@ -0,0 +1,910 @@
+#include <iostream>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
+#include "closure.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// where the storage of a name is, a slot in the global env or the frame
+struct Loc
+{
+    Result *global;     // the env slot, for globals
+    int local;          // the frame slot, for locals (-1 for globals)
+    std::string name;
+};
+
+
+// find the storage of a named node
+static Loc locate(ParseTree *named)
+{
+    int local = named->slot();
+    std::string name = named->token().lexeme;
+    return { local < 0 ? env.slot(name) : nullptr, local, name };
+}
+
+
+// check that a bound variable has been declared before it is used
+static inline Result &bound(const Loc &loc)
+{
+    Result *slot = loc.local < 0 ? loc.global : frames.fp + loc.local;
+    if(slot->type() == VOID) {
+        throw std::runtime_error(loc.name + " not defined.");
+    }
+    return *slot;
+}
+
+
+// the elements of an array, of the type its static element type says
+template<typename T>
+static inline T *elements(Result &arr)
+{
+    return static_cast<T*>(arr.ptr());
+}
+
+
+// element i of an array of E, reals are read as they are and the
+// integer types through read_element
+template<typename E>
+static inline auto element(Result &arr, int64_t i)
+{
+    if constexpr(std::is_same_v<E, double>) {
+        return elements<double>(arr)[i];
+    } else {
+        return read_element<E>(arr.ptr(), i);
+    }
+}
+
+
+// call a generic lambda with the C++ type an integer element type is
+// stored as
+template<typename F>
+static auto by_element(ElementType element, F f)
+{
+    switch(element) {
+        case ELEMENT_INT8:
+            return f.template operator()<int8_t>();
+        case ELEMENT_INT16:
+            return f.template operator()<int16_t>();
+        case ELEMENT_BIT:
+            return f.template operator()<Bit>();
+        default:
+            return f.template operator()<int64_t>();
+    }
+}
+
+
+// the row-major offset of an element of an array, given its leading indices
+static inline int64_t offset(Result &arr, const std::vector<IntExpr> &indices, ParseTree *named)
+{
+    int64_t flat = 0;
+    for(size_t k = 0; k < indices.size(); k++) {
+        int64_t index = indices[k]();
+        int64_t dim = array_dim(arr.ptr(), k);
+        if(k > 0 and (uint64_t) index >= (uint64_t) dim) {
+            dimension_error(named, k, index);
+        }
+        flat = flat * dim + index;
+    }
+    return flat;
+}
+
+
+// load an element of type E into a variable of a static type
+template<typename E>
+static Stmt load_element(Loc slot, Loc arr, IntExpr index, ResultType type)
+{
+    if(type == INTEGER) {
+        return [slot, arr, index]() {
+            int64_t i = index();
+            bound(slot).i(element<E>(bound(arr), i));
+        };
+    }
+    return [slot, arr, index]() {
+        int64_t i = index();
+        bound(slot).r(element<E>(bound(arr), i));
+    };
+}
+
+
+// build a comparison of two typed operands
+template<typename T>
+static CondExpr compare(CompareOp op, std::function<T()> l, std::function<T()> r)
+{
+    switch(op) {
+        case CMP_LT:
+            return [l, r]() { return l() < r(); };
+        case CMP_GT:
+            return [l, r]() { return l() > r(); };
+        case CMP_EQ:
+            return [l, r]() { return l() == r(); };
+        case CMP_NE:
+            return [l, r]() { return l() != r(); };
+    }
+    return []() { return false; };
+}
+
+
+// integer results wrap at the width of a boxed integer, reals are left alone
+static inline int64_t wrap(int64_t v) { return wrap_int(v); }
+static inline double wrap(double v) { return v; }
+static inline int64_t times(int64_t a, int64_t b) { return mul_int(a, b); }
+static inline double times(double a, double b) { return a * b; }
+static inline int64_t power(int64_t a, int64_t b) { return pow_int(a, b); }
+static inline double power(double a, double b) { return pow(a, b); }
+static inline double quotient(double a, double b) { return a / b; }
+static inline int64_t quotient(int64_t a, int64_t b)
+{
+    if(b == 0) throw std::runtime_error("Division by zero");
+    return wrap(a / b);
+}
+
+
+// build an arithmetic operation on two typed operands
+template<typename T>
+static std::function<T()> arith(ParseTree *tree, std::function<T()> l, std::function<T()> r)
+{
+    if(dynamic_cast<Add*>(tree)) {
+        return [l, r]() { return wrap(l() + r()); };
+    } else if(dynamic_cast<Sub*>(tree)) {
+        return [l, r]() { return wrap(l() - r()); };
+    } else if(dynamic_cast<Mul*>(tree)) {
+        return [l, r]() { return times(l(), r()); };
+    } else if(dynamic_cast<Div*>(tree)) {
+        return [l, r]() { return quotient(l(), r()); };
+    }
+
+    // what remains is pow
+    return [l, r]() { return power(l(), r()); };
+}
+
+
+// true if every guarded slot still has the type the code was compiled under
+static bool holds(const Guards &guards)
+{
+    for(const Guard &g : guards) {
+        if(g.slot->type() != g.type or (g.type == ARRAY and g.slot->element_type() != g.element)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// true if running a tree can change the type of a slot
+static bool declares(ParseTree *tree)
+{
+    if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<ArrayInit*>(tree) or
+       dynamic_cast<MapInit*>(tree) or dynamic_cast<ObjectCreation*>(tree) or dynamic_cast<ClassDefinition*>(tree) or
+       dynamic_cast<ObjectAccess*>(tree)) {
+        // method calls may declare anything
+        return true;
+    }
+
+    bool result = false;
+    for_children(tree, [&result](ParseTree *child) { result = result or declares(child); });
+    return result;
+}
+
+
+// collect the variables a tree uses, and those it declares itself
+static void names(ParseTree *tree, std::set<std::string> &used, std::set<std::string> &declared)
+{
+    if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        declared.insert(decl->child()->token().lexeme);
+        return;
+    } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(tree)) {
+        declared.insert(init->name()->token().lexeme);
+        for(int k = 0; k < init->rank(); k++) {
+            names(init->bound(k), used, declared);
+        }
+        return;
+    } else if(MapInit *init = dynamic_cast<MapInit*>(tree)) {
+        declared.insert(init->child()->token().lexeme);
+        return;
+    } else if(dynamic_cast<ObjectCreation*>(tree) or dynamic_cast<ObjectAccess*>(tree) or
+              dynamic_cast<ClassDefinition*>(tree) or dynamic_cast<AlphaNumeric*>(tree)) {
+        return;
+    } else if(dynamic_cast<Var*>(tree) or dynamic_cast<ArrayAssign*>(tree) or
+              dynamic_cast<ScanF*>(tree) or dynamic_cast<IncrementVar*>(tree) or
+              dynamic_cast<ArrayLoad*>(tree) or dynamic_cast<ArraySwap*>(tree)) {
+        // locals live in the frame, only globals are guarded
+        if(tree->slot() < 0) used.insert(tree->token().lexeme);
+    }
+
+    for_children(tree, [&](ParseTree *child) { names(child, used, declared); });
+}
+
+
+// collect the variables a tree assigns to
+static void assigned(ParseTree *tree, std::set<std::string> &changed)
+{
+    if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        changed.insert(assign->left()->token().lexeme);
+    } else if(dynamic_cast<IncrementVar*>(tree) or dynamic_cast<ArrayLoad*>(tree) or
+              dynamic_cast<ScanF*>(tree)) {
+        changed.insert(tree->token().lexeme);
+    } else if(ArraySwap *swap = dynamic_cast<ArraySwap*>(tree)) {
+        changed.insert((*swap->begin())->token().lexeme);
+    }
+    for_children(tree, [&changed](ParseTree *child) { assigned(child, changed); });
+}
+
+
+// true if an index has the same value on every pass of a loop
+static bool invariant(ParseTree *tree, const std::set<std::string> &changed)
+{
+    if(dynamic_cast<Number*>(tree)) {
+        return true;
+    } else if(dynamic_cast<Var*>(tree)) {
+        return changed.count(tree->token().lexeme) == 0;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return invariant(neg->child(), changed);
+    } else if(dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or dynamic_cast<Mul*>(tree)) {
+        BinaryOp *op = static_cast<BinaryOp*>(tree);
+        return invariant(op->left(), changed) and invariant(op->right(), changed);
+    }
+    return false;
+}
+
+
+// collect the indices a statement runs every time, those in a nested if
+// or loop may not run
+static void run_indices(ParseTree *tree, std::vector<ArrayIndex*> &indices)
+{
+    if(dynamic_cast<IfStatement*>(tree)) return;
+    if(ArrayIndex *index = dynamic_cast<ArrayIndex*>(tree)) {
+        indices.push_back(index);
+    }
+    for_children(tree, [&indices](ParseTree *child) { run_indices(child, indices); });
+}
+
+
+// the multi-dimensional indices run on every pass of a while loop which
+// stay on one row while it runs
+std::vector<ArrayIndex*> invariant_rows(IfStatement *loop)
+{
+    std::vector<ArrayIndex*> rows;
+    if(loop->token() != WHILE or declares(loop->right())) return rows;
+
+    std::set<std::string> changed;
+    assigned(loop->right(), changed);
+
+    std::vector<ArrayIndex*> indices;
+    NaryOp *body = static_cast<NaryOp*>(loop->right());
+    for(auto itr = body->begin(); itr != body->end(); itr++) {
+        run_indices(*itr, indices);
+    }
+    for(ArrayIndex *index : indices) {
+        bool fixed = true;
+        for(auto itr = index->begin(); itr + 1 < index->end(); itr++) {
+            fixed = fixed and invariant(*itr, changed);
+        }
+        if(fixed) rows.push_back(index);
+    }
+    return rows;
+}
+
+
+//////////////////////////////////////////
+// ClosureCompiler Implementation
+//////////////////////////////////////////
+
+// constructor
+ClosureCompiler::ClosureCompiler()
+{
+    // nothing to do
+}
+
+
+// compile a whole program (or a single statement)
+Stmt ClosureCompiler::compile(ParseTree *tree)
+{
+    _types.declare(tree);
+    return compile_stmt(tree);
+}
+
+
+// collect the variable types of the program hot units come from
+void ClosureCompiler::declare(ParseTree *program)
+{
+    _types.declare(program);
+}
+
+
+// compile a hot method or loop for the tiered interpreter, the compiled
+// form throws Deopt at its head if the slot types it assumes do not hold
+Compiled ClosureCompiler::optimize(ParseTree *unit)
+{
+    Guards g = guards(unit);
+
+    IfStatement *loop = dynamic_cast<IfStatement*>(unit);
+    if(loop and loop->token() == WHILE) {
+        std::vector<ArrayIndex*> rows;
+        Stmt hoisted = hoist_rows(loop, rows);
+        CondExpr cond = compile_cond(static_cast<ConditionalOp*>(loop->left()));
+        Stmt body = compile_stmt(loop->right());
+        for(ArrayIndex *index : rows) {
+            _rows.erase(index);
+        }
+
+        // a body which declares may change types between iterations
+        if(declares(loop->right())) {
+            return [g, cond, body]() {
+                while(true) {
+                    if(not holds(g)) throw Deopt();
+                    if(not cond()) break;
+                    body();
+                }
+            };
+        }
+
+        Stmt run = compile_loop(cond, body, hoisted);
+        return [g, run]() {
+            if(not holds(g)) throw Deopt();
+            run();
+        };
+    }
+
+    Stmt body = compile_stmt(unit);
+    return [g, body]() {
+        if(not holds(g)) throw Deopt();
+        body();
+    };
+}
+
+
+// the slot types a hot unit assumes on entry
+Guards ClosureCompiler::guards(ParseTree *unit)
+{
+    std::set<std::string> used;
+    std::set<std::string> declared;
+    names(unit, used, declared);
+
+    // variables the unit declares are not there until it runs
+    Guards result;
+    for(const std::string &name : used) {
+        ResultType type = _types.var_type(name);
+        if(declared.count(name) == 0 and (type == INTEGER or type == REAL or type == ARRAY)) {
+            result.push_back({env.slot(name), type, _types.storage(name)});
+        }
+    }
+    return result;
+}
+
+
+//////////////////////////////////////////
+// Statements
+//////////////////////////////////////////
+Stmt ClosureCompiler::compile_stmt(ParseTree *tree)
+{
+    if(dynamic_cast<Program*>(tree) or dynamic_cast<Statementblock*>(tree)) {
+        return compile_block(static_cast<NaryOp*>(tree));
+    } else if(IfStatement *ifs = dynamic_cast<IfStatement*>(tree)) {
+        return compile_if(ifs);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        return compile_assign(assign);
+    } else if(ArrayAssign *assign = dynamic_cast<ArrayAssign*>(tree)) {
+        return compile_array_assign(assign);
+    } else if(dynamic_cast<AlphaNumeric*>(tree)) {
+        // only ever found inside a print
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        return compile_print(print);
+    } else if(ScanF *scan = dynamic_cast<ScanF*>(tree)) {
+        return compile_scanf(scan);
+    } else if(ObjectAccess *call = dynamic_cast<ObjectAccess*>(tree)) {
+        if(call->begin() + 1 < call->end() and (*(call->begin()+1))->token() == LPAREN) {
+            return compile_call(call);
+        }
+    } else if(FieldAssign *assign = dynamic_cast<FieldAssign*>(tree)) {
+        ObjectAccess *access = static_cast<ObjectAccess*>(assign->left());
+        ResultType type = _types.type_of(access);
+        if(type == INTEGER) {
+            IntExpr e = compile_int(assign->right());
+            return [access, e]() {
+                int64_t v = e();
+                access->field()->i(v);
+            };
+        } else if(type == REAL) {
+            RealExpr e = compile_real(assign->right());
+            return [access, e]() {
+                double v = e();
+                access->field()->r(v);
+            };
+        }
+    } else if(IncrementVar *inc = dynamic_cast<IncrementVar*>(tree)) {
+        Loc slot = locate(inc->child());
+        Result step = inc->step();
+        ResultType type = _types.var_type(inc->child());
+        if(type == INTEGER and step.type() == INTEGER) {
+            int64_t by = step.i();
+            return [slot, by]() { Result &var = bound(slot); var.i(var.i() + by); };
+        } else if(type == REAL) {
+            double by = NUM_RESULT(step);
+            return [slot, by]() { Result &var = bound(slot); var.r(var.r() + by); };
+        }
+    } else if(ArrayAppend *append = dynamic_cast<ArrayAppend*>(tree)) {
+        // mismatched element types are reported by the evaluator
+        Loc arr = locate(append->left());
+        ResultType type = _types.type_of(append->right());
+        if(type == INTEGER and _types.element_type(append->left()) == INTEGER) {
+            IntExpr e = compile_int(append->right());
+            return [append, arr, e]() {
+                Result v;
+                v.i(e());
+                append->append(bound(arr), v);
+            };
+        } else if(type == REAL and _types.element_type(append->left()) == REAL) {
+            RealExpr e = compile_real(append->right());
+            return [append, arr, e]() {
+                Result v;
+                v.r(e());
+                append->append(bound(arr), v);
+            };
+        }
+    } else if(MapPut *put = dynamic_cast<MapPut*>(tree)) {
+        // the value is computed before the key, as in the evaluator
+        MapGet *at = static_cast<MapGet*>(put->left());
+        Loc map = locate(at->left());
+        ValueExpr value = compile_value(put->right());
+        ValueExpr key = compile_value(at->right());
+        return [put, map, value, key]() {
+            Result v = value();
+            put->put(bound(map), key(), v);
+        };
+    } else if(ArrayLoad *load = dynamic_cast<ArrayLoad*>(tree)) {
+        ResultType type = _types.var_type(load);
+        if((type == INTEGER or type == REAL) and _types.numbers(load->left()) != VOID) {
+            Loc slot = locate(load);
+            Loc arr = locate(load->left());
+            IntExpr index = compile_int(load->right());
+            if(_types.element_type(load->left()) == INTEGER) {
+                return by_element(_types.storage(load->left()), [&]<typename E>() {
+                    return load_element<E>(slot, arr, index, type);
+                });
+            }
+            return load_element<double>(slot, arr, index, type);
+        }
+    }
+
+    // everything else is run by the evaluator
+    return [tree]() { tree->eval(); };
+}
+
+
+Stmt ClosureCompiler::compile_block(NaryOp *block)
+{
+    std::vector<Stmt> stmts;
+    for(auto itr = block->begin(); itr != block->end(); itr++) {
+        stmts.push_back(compile_stmt(*itr));
+    }
+
+    return [stmts]() {
+        for(const Stmt &stmt : stmts) {
+            stmt();
+        }
+    };
+}
+
+
+Stmt ClosureCompiler::compile_if(IfStatement *ifs)
+{
+    std::vector<ArrayIndex*> rows;
+    Stmt hoisted = hoist_rows(ifs, rows);
+    CondExpr cond = compile_cond(static_cast<ConditionalOp*>(ifs->left()));
+    Stmt body = compile_stmt(ifs->right());
+    for(ArrayIndex *index : rows) {
+        _rows.erase(index);
+    }
+
+    if(ifs->token() == IF) {
+        return [cond, body]() {
+            if(cond()) body();
+        };
+    }
+
+    // a loop the array kernels can run takes its passes only if they
+    // decline it
+    Stmt loop = compile_loop(cond, body, hoisted);
+    if(not ifs->vectorizable()) {
+        return loop;
+    }
+    return [ifs, loop]() {
+        if(not ifs->vectorize()) loop();
+    };
+}
+
+
+// compute the invariant rows of a loop, each into a cell its accesses
+// add their last index to
+Stmt ClosureCompiler::hoist_rows(IfStatement *loop, std::vector<ArrayIndex*> &rows)
+{
+    std::vector<Stmt> stmts;
+    for(ArrayIndex *index : invariant_rows(loop)) {
+        // indices which do not match the array's dimensions are left to the evaluator
+        if(_types.type_of(index) != INTEGER) continue;
+
+        Loc arr = locate(index);
+        std::vector<IntExpr> leading;
+        for(auto itr = index->begin(); itr + 1 < index->end(); itr++) {
+            leading.push_back(compile_int(*itr));
+        }
+        auto row = std::make_shared<int64_t>(0);
+        stmts.push_back([arr, leading, row, index]() {
+            // a leading index outside its dimension is reported by an
+            // access to the row, if one runs
+            Result &a = bound(arr);
+            try {
+                *row = offset(a, leading, index) * array_dim(a.ptr(), leading.size());
+            } catch(std::runtime_error &e) {
+                *row = OUTSIDE_ROW;
+            }
+        });
+        _rows[index] = row;
+        rows.push_back(index);
+    }
+
+    if(stmts.empty()) return Stmt();
+    return [stmts]() {
+        for(const Stmt &stmt : stmts) {
+            stmt();
+        }
+    };
+}
+
+
+// a while loop, the hoisted rows are computed once it is known to run
+Stmt ClosureCompiler::compile_loop(CondExpr cond, Stmt body, Stmt rows)
+{
+    if(not rows) {
+        return [cond, body]() {
+            while(cond()) body();
+        };
+    }
+
+    return [cond, body, rows]() {
+        if(not cond()) return;
+        rows();
+        do {
+            body();
+        } while(cond());
+    };
+}
+
+
+Stmt ClosureCompiler::compile_assign(Assign *assign)
+{
+    ParseTree *target = assign->left();
+    ParseTree *expr = assign->right();
+    Loc slot = locate(target);
+    ResultType type = _types.var_type(target);
+
+    if(type == INTEGER) {
+        IntExpr e = compile_int(expr);
+        return [slot, e]() {
+            int64_t v = e();
+            bound(slot).i(v);
+        };
+    } else if(type == REAL) {
+        RealExpr e = compile_real(expr);
+        return [slot, e]() {
+            double v = e();
+            bound(slot).r(v);
+        };
+    }
+
+    // unknown types, arrays assigned whole among them, are evaluated
+    return [assign]() { assign->eval(); };
+}
+
+
+Stmt ClosureCompiler::compile_array_assign(ArrayAssign *assign)
+{
+    ResultType element = _types.numbers(assign);
+    ResultType type = _types.type_of(assign->right());
+    if(element == VOID or type == VOID) {
+        return [assign]() { assign->eval(); };
+    }
+
+    // the element type check is decided once
+    if((element == INTEGER) != (type == INTEGER)) {
+        return [assign]() {
+            assign->right()->eval();
+            assign->left()->eval();
+            std::cout<<"result type of expression does not match the array element type\n";
+        };
+    }
+
+    Loc arr = locate(assign);
+    IntExpr index = compile_int(assign->left());
+    if(type == INTEGER) {
+        IntExpr e = compile_int(assign->right());
+        return by_element(_types.storage(assign), [&]<typename E>() -> Stmt {
+            return [arr, index, e]() {
+                int64_t v = e();
+                int64_t i = index();
+                write_element<E>(bound(arr).ptr(), i, v);
+            };
+        });
+    }
+
+    RealExpr e = compile_real(assign->right());
+    return [arr, index, e]() {
+        double v = e();
+        int64_t i = index();
+        elements<double>(bound(arr))[i] = v;
+    };
+}
+
+
+Stmt ClosureCompiler::compile_print(Print *print)
+{
+    ParseTree *child = print->child();
+    if(dynamic_cast<AlphaNumeric*>(child)) {
+        std::string text = child->token().lexeme;
+        return [text]() { std::cout << text << std::endl; };
+    }
+
+    ResultType type = _types.type_of(child);
+    if(type == INTEGER) {
+        IntExpr e = compile_int(child);
+        return [e]() { std::cout << e() << std::endl; };
+    } else if(type == REAL) {
+        RealExpr e = compile_real(child);
+        return [e]() { std::cout << e() << std::endl; };
+    }
+    return [print]() { print->eval(); };
+}
+
+
+Stmt ClosureCompiler::compile_scanf(ScanF *scan)
+{
+    Loc slot = locate(scan);
+    ResultType type = _types.var_type(scan);
+
+    if(type == INTEGER) {
+        return [slot]() { int64_t v; std::cin >> v; bound(slot).i(v); };
+    } else if(type == REAL) {
+        return [slot]() { double v; std::cin >> v; bound(slot).r(v); };
+    }
+    return [scan]() { scan->eval(); };
+}
+
+
+Stmt ClosureCompiler::compile_call(ObjectAccess *call)
+{
+    // the receiver's class is only known at run time, so the compiled body
+    // is cached against the method the call site last dispatched to
+    auto cache = std::make_shared<std::pair<ParseTree*, Stmt*>>(nullptr, nullptr);
+    // a call in tail position is made by the caller, in the caller's frame
+    if(call->tail()) {
+        return [call]() {
+            Method *callee = static_cast<Method*>(call->method());
+            frames.defer(callee, call->arguments(callee));
+        };
+    }
+
+    return [this, call, cache]() {
+        Method *callee = static_cast<Method*>(call->method());
+        if(callee != cache->first) {
+            cache->first = callee;
+            cache->second = &method(callee);
+        }
+
+        // the callee runs in its own frame, as do the calls it leaves
+        Result *frame = call->arguments(callee);
+        CallScope scope(frame);
+        (*cache->second)();
+        while(Method *next = frames.tail_call(frame)) {
+            method(next)();
+        }
+    };
+}
+
+
+// get the compiled body of a method, compiling it on first use
+Stmt &ClosureCompiler::method(ParseTree *body)
+{
+    auto itr = _methods.find(body);
+    if(itr == _methods.end()) {
+        itr = _methods.insert({body, compile_stmt(body)}).first;
+    }
+    return itr->second;
+}
+
+
+//////////////////////////////////////////
+// Expressions
+//////////////////////////////////////////
+IntExpr ClosureCompiler::compile_int(ParseTree *tree)
+{
+    ResultType type = _types.type_of(tree);
+
+    // real expressions are computed as reals and truncated
+    if(type == REAL) {
+        RealExpr e = compile_real(tree);
+        return [e]() { return wrap_int((int64_t) e()); };
+    } else if(type != INTEGER) {
+        return [tree]() {
+            Result r = tree->eval();
+            return wrap_int((int64_t) NUM_RESULT(r));
+        };
+    }
+
+    if(dynamic_cast<Number*>(tree)) {
+        int64_t v = tree->eval().i();
+        return [v]() { return v; };
+    } else if(dynamic_cast<Var*>(tree)) {
+        Loc slot = locate(tree);
+        return [slot]() { return bound(slot).i(); };
+    } else if(ArrayIndex *index = dynamic_cast<ArrayIndex*>(tree)) {
+        return compile_index(index);
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        Loc arr = locate(access->left());
+        IntExpr index = compile_int(access->right());
+        return by_element(_types.storage(access->left()), [&]<typename E>() -> IntExpr {
+            return [arr, index]() {
+                int64_t i = index();
+                return element<E>(bound(arr), i);
+            };
+        });
+    } else if(ArrayLength *length = dynamic_cast<ArrayLength*>(tree)) {
+        Loc arr = locate(length->child());
+        return [arr]() { return array_length(bound(arr).ptr()); };
+    } else if(ArrayCount *count = dynamic_cast<ArrayCount*>(tree)) {
+        Loc arr = locate(count->left());
+        if(not count->right()) {
+            return [count, arr]() { return count->count(bound(arr)); };
+        }
+        ValueExpr value = compile_value(count->right());
+        return [count, arr, value]() {
+            Result v = value();
+            return count->count(bound(arr), v);
+        };
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        Loc a = locate(reduce->left());
+        Loc b = locate(reduce->right() ? reduce->right() : reduce->left());
+        return [reduce, a, b]() { return reduce->reduce(bound(a), bound(b)).i(); };
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        Loc map = locate(get->left());
+        ValueExpr key = compile_value(get->right());
+        return [get, map, key]() { return get->get(bound(map), key()).i(); };
+    } else if(MapContains *contains = dynamic_cast<MapContains*>(tree)) {
+        Loc map = locate(contains->left());
+        ValueExpr key = compile_value(contains->right());
+        return [contains, map, key]() { return (int64_t) contains->contains(bound(map), key()); };
+    } else if(ObjectAccess *access = dynamic_cast<ObjectAccess*>(tree)) {
+        return [access]() { return access->field()->i(); };
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        IntExpr e = compile_int(neg->child());
+        return [e]() { return wrap_int(-e()); };
+    }
+
+    // what remains is arithmetic
+    BinaryOp *op = static_cast<BinaryOp*>(tree);
+    return arith<int64_t>(tree, compile_int(op->left()), compile_int(op->right()));
+}
+
+
+RealExpr ClosureCompiler::compile_real(ParseTree *tree)
+{
+    ResultType type = _types.type_of(tree);
+
+    // integer expressions are computed as integers and widened
+    if(type == INTEGER) {
+        IntExpr e = compile_int(tree);
+        return [e]() { return (double) e(); };
+    } else if(type != REAL) {
+        return [tree]() {
+            Result r = tree->eval();
+            return (double) NUM_RESULT(r);
+        };
+    }
+
+    if(dynamic_cast<Number*>(tree)) {
+        double v = tree->eval().r();
+        return [v]() { return v; };
+    } else if(dynamic_cast<Var*>(tree)) {
+        Loc slot = locate(tree);
+        return [slot]() { return bound(slot).r(); };
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        Loc arr = locate(access->left());
+        IntExpr index = compile_int(access->right());
+        return [arr, index]() {
+            int64_t i = index();
+            return elements<double>(bound(arr))[i];
+        };
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        Loc map = locate(get->left());
+        ValueExpr key = compile_value(get->right());
+        return [get, map, key]() { return get->get(bound(map), key()).r(); };
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        Loc a = locate(reduce->left());
+        Loc b = locate(reduce->right() ? reduce->right() : reduce->left());
+        return [reduce, a, b]() { return reduce->reduce(bound(a), bound(b)).r(); };
+    } else if(ObjectAccess *access = dynamic_cast<ObjectAccess*>(tree)) {
+        return [access]() { return access->field()->r(); };
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        RealExpr e = compile_real(neg->child());
+        return [e]() { return -e(); };
+    }
+
+    // what remains is arithmetic
+    BinaryOp *op = static_cast<BinaryOp*>(tree);
+    return arith<double>(tree, compile_real(op->left()), compile_real(op->right()));
+}
+
+
+// an expression boxed as the evaluator would, for the runtime calls
+// which take either type
+ValueExpr ClosureCompiler::compile_value(ParseTree *tree)
+{
+    ResultType type = _types.type_of(tree);
+    if(type == INTEGER) {
+        IntExpr e = compile_int(tree);
+        return [e]() { Result r; r.i(e()); return r; };
+    } else if(type == REAL) {
+        RealExpr e = compile_real(tree);
+        return [e]() { Result r; r.r(e()); return r; };
+    }
+    return [tree]() { return tree->eval(); };
+}
+
+
+// the offset of an element of a multi-dimensional array
+IntExpr ClosureCompiler::compile_index(ArrayIndex *index)
+{
+    Loc arr = locate(index);
+    std::vector<IntExpr> indices;
+    for(auto itr = index->begin(); itr != index->end(); itr++) {
+        indices.push_back(compile_int(*itr));
+    }
+    IntExpr last = indices.back();
+
+    // a row hoisted out of the loop only has the last index added
+    int k = indices.size() - 1;
+    auto row = _rows.find(index);
+    if(row != _rows.end()) {
+        std::shared_ptr<int64_t> start = row->second;
+        return [arr, start, last, k, index, indices]() {
+            if(*start == OUTSIDE_ROW) return offset(bound(arr), indices, index);
+            int64_t j = last();
+            if((uint64_t) j >= (uint64_t) array_dim(bound(arr).ptr(), k)) {
+                dimension_error(index, k, j);
+            }
+            return *start + j;
+        };
+    }
+
+    if(indices.size() == 2) {
+        IntExpr first = indices[0];
+        return [arr, first, last, index]() {
+            int64_t i = first();
+            int64_t j = last();
+            int64_t dim = array_dim(bound(arr).ptr(), 1);
+            if((uint64_t) j >= (uint64_t) dim) {
+                dimension_error(index, 1, j);
+            }
+            return i * dim + j;
+        };
+    }
+    return [arr, indices, index]() { return offset(bound(arr), indices, index); };
+}
+
+
+CondExpr ClosureCompiler::compile_cond(ConditionalOp *cond)
+{
+    ResultType l = _types.type_of(cond->left());
+    ResultType r = _types.type_of(cond->right());
+
+    if(l == INTEGER and r == INTEGER) {
+        return compare<int64_t>(cond->op(), compile_int(cond->left()), compile_int(cond->right()));
+    } else if(l != VOID and r != VOID) {
+        return compare<double>(cond->op(), compile_real(cond->left()), compile_real(cond->right()));
+    }
+    return [cond]() { return cond->test(); };
+}
@@ -0,0 +1,90 @@
+// This file contains the closure compiler, which turns parse trees into
+// trees of C++ closures before they run. Variables are bound to their
+// storage, and operators are specialized on the static types of their
+// operands, so running a closure never looks anything up by name.
+#ifndef CLOSURE_H
+#define CLOSURE_H
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "op.h"
+#include "types.h"
+
+// compiled code
+typedef std::function<void()> Stmt;
+typedef std::function<int64_t()> IntExpr;
+typedef std::function<double()> RealExpr;
+typedef std::function<bool()> CondExpr;
+typedef std::function<Result()> ValueExpr;
+
+// a slot type optimized code is compiled under
+struct Guard
+{
+    Result *slot;
+    ResultType type;
+    ElementType element;    // for arrays
+};
+typedef std::vector<Guard> Guards;
+
+// the multi-dimensional indices run on every pass of a while loop which
+// stay on one row while it runs, their leading indices never change in
+// it (none if the loop may declare anything)
+std::vector<ArrayIndex*> invariant_rows(IfStatement *loop);
+
+// the row of a hoisted access whose leading indices are outside their
+// dimensions; the access then computes its whole offset, and fails there
+const int64_t OUTSIDE_ROW = -1;
+
+
+class ClosureCompiler : public Optimizer
+{
+public:
+    // constructor
+    ClosureCompiler();
+
+    // compile a whole program (or a single statement)
+    virtual Stmt compile(ParseTree *tree);
+
+    // collect the variable types of the program hot units come from
+    virtual void declare(ParseTree *program);
+
+    // compile a hot method or loop for the tiered interpreter
+    virtual Compiled optimize(ParseTree *unit);
+
+protected:
+    // statements
+    virtual Stmt compile_stmt(ParseTree *tree);
+    virtual Stmt compile_block(NaryOp *block);
+    virtual Stmt compile_if(IfStatement *ifs);
+    virtual Stmt compile_assign(Assign *assign);
+    virtual Stmt compile_array_assign(ArrayAssign *assign);
+    virtual Stmt compile_print(Print *print);
+    virtual Stmt compile_scanf(ScanF *scan);
+    virtual Stmt compile_call(ObjectAccess *call);
+
+    // compute the invariant rows of a loop, once before its first pass,
+    // and the loop itself
+    virtual Stmt hoist_rows(IfStatement *loop, std::vector<ArrayIndex*> &rows);
+    virtual Stmt compile_loop(CondExpr cond, Stmt body, Stmt rows);
+
+    // expressions
+    virtual IntExpr compile_int(ParseTree *tree);
+    virtual RealExpr compile_real(ParseTree *tree);
+    virtual CondExpr compile_cond(ConditionalOp *cond);
+    virtual IntExpr compile_index(ArrayIndex *index);
+    virtual ValueExpr compile_value(ParseTree *tree);
+
+    // get the compiled body of a method, compiling it on first use
+    virtual Stmt &method(ParseTree *body);
+
+    // the slot types a hot unit assumes on entry
+    virtual Guards guards(ParseTree *unit);
+
+private:
+    StaticTypes _types;                     // declared variable types
+    std::map<ParseTree*, Stmt> _methods;    // compiled method bodies
+    std::map<ArrayIndex*, std::shared_ptr<int64_t>> _rows;  // rows hoisted by the loops being compiled
+};
+#endif
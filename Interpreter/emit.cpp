@@ -0,0 +1,602 @@
+#include <iostream>
+#include <stdexcept>
+#include "emit.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// the fields of a record are named var.field, spelled with '_' and '.'
+// escaped under a prefix of their own
+static std::string field(const std::string &name)
+{
+    std::string result;
+    for(char c : name) {
+        if(c == '_') result += "_u";
+        else if(c == '.') result += "_d";
+        else result += c;
+    }
+    return result;
+}
+
+
+// names are prefixed so they can never collide with C++ names
+static std::string var(const std::string &name)
+{
+    if(name.find('.') != std::string::npos) return "r_" + field(name);
+    return "v_" + name;
+}
+
+
+static std::string cls(const std::string &name)
+{
+    return "c_" + name;
+}
+
+
+static std::string method(const std::string &name)
+{
+    return "m_" + name;
+}
+
+
+static std::string storage(const std::string &name)
+{
+    if(name.find('.') != std::string::npos) return "s_" + field(name);
+    return "f_" + name;
+}
+
+
+// indentation for a statement
+static std::string indent(int depth)
+{
+    return std::string(4 * depth, ' ');
+}
+
+
+// quote a string as a C++ literal
+static std::string quote(const std::string &text)
+{
+    std::string result = "\"";
+    for(char c : text) {
+        if(c == '\n') {
+            result += "\\n";
+            continue;
+        }
+        if(c == '"' or c == '\\') result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+
+// the C++ type of a scalar
+static std::string ctype(ResultType type)
+{
+    return type == INTEGER ? "int64_t" : "double";
+}
+
+
+// the C++ type of an array's elements, bit arrays are translated to a
+// byte per element
+static std::string element_ctype(ElementType element)
+{
+    switch(element) {
+        case ELEMENT_INT8:
+            return "int8_t";
+        case ELEMENT_INT16:
+            return "int16_t";
+        case ELEMENT_BIT:
+            return "bool";
+        case ELEMENT_INT64:
+            return "int64_t";
+        default:
+            return "double";
+    }
+}
+
+
+static std::string element_ctype(ArrayInit *init)
+{
+    return element_ctype(init->element_type());
+}
+
+
+// the number of elements of an array, written as a C++ expression of its bounds
+static std::string length(ArrayInit *init, std::function<std::string(ParseTree*)> bound)
+{
+    std::string result = bound(init->bound(0));
+    for(int k = 1; k < init->rank(); k++) {
+        result += " * " + bound(init->bound(k));
+    }
+    return result;
+}
+
+
+// the literal bounds of an array
+static std::string literal(ParseTree *bound)
+{
+    return bound->token().lexeme;
+}
+
+
+// does an array go on the C++ stack, as it goes in the frame
+static bool stack_array(ArrayInit *init)
+{
+    if(not init->in_frame()) return false;
+    int64_t n = 1;
+    for(int k = 0; k < init->rank(); k++) {
+        n *= init->bound(k)->eval().i();
+    }
+    return n <= FRAME_ARRAY_MAX;
+}
+
+
+// collect the arrays of a method which go on the C++ stack
+static void stack_arrays(ParseTree *tree, std::vector<ArrayInit*> &arrays)
+{
+    ArrayInit *init = dynamic_cast<ArrayInit*>(tree);
+    if(init and stack_array(init)) {
+        arrays.push_back(init);
+    }
+    for_children(tree, [&arrays](ParseTree *child) { stack_arrays(child, arrays); });
+}
+
+
+// report something we cannot translate
+static void unsupported(ParseTree *tree)
+{
+    throw std::runtime_error("Cannot translate " + std::string(TSTR[tree->token().token]) +
+                             " \"" + tree->token().lexeme + "\" to C++");
+}
+
+
+//////////////////////////////////////////
+// CppEmitter Implementation
+//////////////////////////////////////////
+
+// constructor
+CppEmitter::CppEmitter(std::ostream &os) : _os(os)
+{
+    _method = nullptr;
+}
+
+
+// write the translation of a program
+void CppEmitter::emit(ParseTree *program)
+{
+    _types.declare(program);
+    collect(program);
+
+    _os << "// Generated by calc --emit-cpp" << std::endl
+        << "#include <cstdint>" << std::endl
+        << "#include <iostream>" << std::endl
+        << "#include <cmath>" << std::endl << std::endl
+        << "#include <cstdlib>" << std::endl << std::endl
+        << "// integers are 48 bits, as they are in calc" << std::endl
+        << "static inline int64_t wrap(uint64_t v) { return (int64_t) (v << 16) >> 16; }"
+        << std::endl << std::endl
+        << "// powers are taken by squaring, so they wrap as products do" << std::endl
+        << "static inline int64_t power(int64_t a, int64_t b)" << std::endl
+        << "{" << std::endl
+        << "    if(b < 0) return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;" << std::endl
+        << "    int64_t result = 1;" << std::endl
+        << "    for(; b; b >>= 1) {" << std::endl
+        << "        if(b & 1) result = wrap((uint64_t) result * (uint64_t) a);" << std::endl
+        << "        a = wrap((uint64_t) a * (uint64_t) a);" << std::endl
+        << "    }" << std::endl
+        << "    return result;" << std::endl
+        << "}" << std::endl << std::endl
+        << "// division by zero stops the program, as it does in calc" << std::endl
+        << "static inline int64_t quotient(int64_t a, int64_t b)" << std::endl
+        << "{" << std::endl
+        << "    if(b != 0) return wrap(a / b);" << std::endl
+        << "    std::cout.flush();" << std::endl
+        << "    std::cerr << \"Division by zero\" << std::endl;" << std::endl
+        << "    std::exit(1);" << std::endl
+        << "}" << std::endl << std::endl
+        << "// an index outside an inner dimension stops the program, as it does in calc"
+        << std::endl
+        << "static inline int64_t inside(int64_t i, int64_t n, int k, const char *name)" << std::endl
+        << "{" << std::endl
+        << "    if((uint64_t) i < (uint64_t) n) return i;" << std::endl
+        << "    std::cout.flush();" << std::endl
+        << "    std::cerr << \"Index \" << i << \" is outside dimension \" << k"
+        << " << \" of array \" << name << std::endl;" << std::endl
+        << "    std::exit(1);" << std::endl
+        << "}" << std::endl << std::endl;
+
+    // classes are declared before the globals which point at them
+    for(ClassDefinition *def : _classes) {
+        _os << "struct " << cls(def->token().lexeme) << ";" << std::endl;
+    }
+    for(ClassDefinition *def : _classes) {
+        emit_class(def);
+    }
+    emit_globals();
+    for(ClassDefinition *def : _classes) {
+        emit_methods(def);
+    }
+
+    _os << std::endl << "int main()" << std::endl << "{" << std::endl;
+    emit_stmt(program, 1);
+    _os << "    return 0;" << std::endl << "}" << std::endl;
+}
+
+
+// collect the classes, objects and variables of a tree
+void CppEmitter::collect(ParseTree *tree)
+{
+    ParseTree *named = nullptr;
+    if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        named = decl->child();
+    } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(tree)) {
+        named = init->name();
+        std::string name = named->token().lexeme;
+
+        // translated arrays are plain pointers, which cannot grow
+        if(init->dynamic()) unsupported(init);
+
+        // elements are found with the literal bounds of the one declaration
+        if(init->rank() > 1) {
+            std::vector<std::string> bounds;
+            for(int k = 0; k < init->rank(); k++) {
+                if(not dynamic_cast<Number*>(init->bound(k))) unsupported(init);
+                bounds.push_back(literal(init->bound(k)));
+            }
+            if(_shapes.count(name) and _shapes[name] != bounds) unsupported(init);
+            _shapes[name] = bounds;
+        }
+    } else if(MapInit *init = dynamic_cast<MapInit*>(tree)) {
+        // the runtime's maps are not translated
+        unsupported(init);
+    } else if(ClassDefinition *def = dynamic_cast<ClassDefinition*>(tree)) {
+        // fields are members, not globals
+        _classes.push_back(def);
+        collect(def->right());
+        return;
+    } else if(Method *def = dynamic_cast<Method*>(tree)) {
+        // method locals live in the method, parameters in its signature
+        _method = def;
+        _locals[def];
+        for_children(tree, [this](ParseTree *child) { collect(child); });
+        _method = nullptr;
+        return;
+    } else if(ObjectCreation *obj = dynamic_cast<ObjectCreation*>(tree)) {
+        // objects created in a method are its locals
+        std::map<std::string, std::string> &objects = _method ? _localObjects[_method] : _objects;
+        std::string className = obj->child()->token().lexeme;
+        auto itr = objects.find(obj->token().lexeme);
+        if(itr != objects.end() and itr->second != className) {
+            throw std::runtime_error("Object " + obj->token().lexeme + " has two classes");
+        }
+        objects[obj->token().lexeme] = className;
+    }
+
+    // each variable is declared once in its scope, with one type
+    if(named) {
+        std::string name = named->token().lexeme;
+        if(_types.var_type(named) == VOID) {
+            throw std::runtime_error("Variable " + name + " is declared with two types");
+        }
+        std::vector<ParseTree*> &vars = _method ? _locals[_method] : _vars;
+        bool seen = false;
+        for(ParseTree *v : vars) {
+            seen = seen or v->token().lexeme == name;
+        }
+        if(not seen) vars.push_back(named);
+    }
+
+    for_children(tree, [this](ParseTree *child) { collect(child); });
+}
+
+
+// write a class and its method declarations, parents first
+void CppEmitter::emit_class(ClassDefinition *def)
+{
+    if(_emitted.count(def)) return;
+    _emitted.insert(def);
+
+    std::string parent;
+    if(def->isDerived) {
+        for(ClassDefinition *p : _classes) {
+            if(p->token().lexeme == def->parentName) {
+                emit_class(p);
+                parent = " : public " + cls(p->token().lexeme);
+            }
+        }
+        if(parent.empty()) {
+            throw std::runtime_error("Class " + def->parentName + " is not defined");
+        }
+    }
+
+    _os << std::endl << "struct " << cls(def->token().lexeme) << parent << std::endl
+        << "{" << std::endl;
+
+    // an instance owns its array fields, the inherited ones come from the base class
+    VarDeclList *fields = static_cast<VarDeclList*>(def->left());
+    std::string owned;
+    for(auto itr = fields->begin(); itr != fields->end(); itr++) {
+        if(ArrayInit *init = dynamic_cast<ArrayInit*>(*itr)) {
+            owned += " delete[] " + var(init->name()->token().lexeme) + ";";
+        }
+    }
+    _os << "    " << (def->isDerived ? "" : "virtual ") << "~" << cls(def->token().lexeme)
+        << "() {" << owned << " }" << std::endl;
+
+    for(auto itr = fields->begin(); itr != fields->end(); itr++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+            ResultType type = decl->token() == INTEGER_DECL ? INTEGER : REAL;
+            _os << "    " << ctype(type) << " " << var(decl->child()->token().lexeme)
+                << " = 0;" << std::endl;
+        } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(*itr)) {
+            // array fields are sized when the class is written
+            for(int k = 0; k < init->rank(); k++) {
+                if(not dynamic_cast<Number*>(init->bound(k))) unsupported(init);
+            }
+            _os << "    " << element_ctype(init) << " *" << var(init->name()->token().lexeme)
+                << " = new " << element_ctype(init) << "[" << length(init, literal)
+                << "];" << std::endl;
+        }
+    }
+
+    DefDeclList *defs = static_cast<DefDeclList*>(def->right());
+    for(auto itr = defs->begin(); itr != defs->end(); itr++) {
+        _os << "    virtual void " << signature(static_cast<Method*>(*itr)) << ";" << std::endl;
+    }
+    _os << "};" << std::endl;
+}
+
+
+// every declared variable and object is a global
+void CppEmitter::emit_globals()
+{
+    _os << std::endl;
+    for(ParseTree *named : _vars) {
+        std::string name = named->token().lexeme;
+        ResultType type = _types.var_type(named);
+        if(type == ARRAY) {
+            _os << element_ctype(_types.storage(named)) << " *" << var(name) << " = nullptr;" << std::endl;
+        } else {
+            _os << ctype(type) << " " << var(name) << " = 0;" << std::endl;
+        }
+    }
+
+    for(auto itr = _objects.begin(); itr != _objects.end(); itr++) {
+        _os << cls(itr->second) << " *" << var(itr->first) << " = nullptr;" << std::endl;
+    }
+}
+
+
+void CppEmitter::emit_methods(ClassDefinition *def)
+{
+    DefDeclList *defs = static_cast<DefDeclList*>(def->right());
+    for(auto itr = defs->begin(); itr != defs->end(); itr++) {
+        Method *m = static_cast<Method*>(*itr);
+        _os << std::endl << "void " << cls(def->token().lexeme) << "::"
+            << signature(m) << std::endl
+            << "{" << std::endl;
+        for(ParseTree *named : _locals[m]) {
+            std::string name = named->token().lexeme;
+            ResultType type = _types.var_type(named);
+            if(type == ARRAY) {
+                _os << "    " << element_ctype(_types.storage(named)) << " *" << var(name)
+                    << " = nullptr;" << std::endl;
+            } else {
+                _os << "    " << ctype(type) << " " << var(name) << " = 0;" << std::endl;
+            }
+        }
+        std::map<std::string, std::string> &objects = _localObjects[m];
+        for(auto obj = objects.begin(); obj != objects.end(); obj++) {
+            _os << "    " << cls(obj->second) << " *" << var(obj->first) << " = nullptr;" << std::endl;
+        }
+
+        // arrays which do not escape live as long as the call
+        std::vector<ArrayInit*> arrays;
+        stack_arrays(m, arrays);
+        for(ArrayInit *init : arrays) {
+            _os << "    " << element_ctype(init) << " " << storage(init->name()->token().lexeme) << "["
+                << length(init, literal) << "];" << std::endl;
+        }
+        emit_stmt(m, 1);
+        for(auto obj = objects.begin(); obj != objects.end(); obj++) {
+            _os << "    delete " << var(obj->first) << ";" << std::endl;
+        }
+        _os << "}" << std::endl;
+    }
+}
+
+
+// the name and parameters of a method, arrays are passed as pointers
+std::string CppEmitter::signature(Method *def)
+{
+    std::string result = method(def->token().lexeme) + "(";
+    for(auto itr = def->params_begin(); itr != def->params_end(); itr++) {
+        if(itr != def->params_begin()) result += ", ";
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+            ResultType type = decl->token() == INTEGER_DECL ? INTEGER : REAL;
+            result += ctype(type) + " " + var(decl->child()->token().lexeme);
+        } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(*itr)) {
+            // the shape of an array argument is only known when it runs
+            if(init->rank() > 1) unsupported(init);
+            result += element_ctype(init) + " *" + var(init->name()->token().lexeme);
+        }
+    }
+    return result + ")";
+}
+
+
+//////////////////////////////////////////
+// Statements
+//////////////////////////////////////////
+void CppEmitter::emit_stmt(ParseTree *tree, int depth)
+{
+    std::string pad = indent(depth);
+
+    if(dynamic_cast<Program*>(tree) or dynamic_cast<Statementblock*>(tree)) {
+        NaryOp *block = static_cast<NaryOp*>(tree);
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            emit_stmt(*itr, depth);
+        }
+    } else if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<ClassDefinition*>(tree) or
+              dynamic_cast<RecordDef*>(tree)) {
+        // these are global declarations
+    } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(tree)) {
+        std::string name = init->name()->token().lexeme;
+        if(stack_array(init)) {
+            _os << pad << var(name) << " = " << storage(name) << ";" << std::endl;
+        } else {
+            _os << pad << var(name) << " = new " << element_ctype(init) << "["
+                << length(init, [this](ParseTree *bound) { return expr(bound); }) << "];" << std::endl;
+        }
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        std::string name = assign->left()->token().lexeme;
+        ResultType type = _types.type_of(assign->left());
+        if(type == VOID) unsupported(assign->left());
+        _os << pad << var(name) << " = (" << ctype(type) << ") "
+            << expr(assign->right()) << ";" << std::endl;
+    } else if(ArrayAssign *assign = dynamic_cast<ArrayAssign*>(tree)) {
+        ResultType element = _types.numbers(assign);
+        ResultType type = _types.type_of(assign->right());
+        if(element == VOID) unsupported(assign);
+        if(type == VOID) unsupported(assign->right());
+
+        if((element == INTEGER) != (type == INTEGER)) {
+            _os << pad << "std::cout << "
+                << quote("result type of expression does not match the array element type\n")
+                << ";" << std::endl;
+        } else {
+            std::string name = assign->token().lexeme;
+            _os << pad << var(name) << "[" << expr(assign->left()) << "] = ("
+                << element_ctype(_types.storage(assign)) << ") " << expr(assign->right()) << ";"
+                << std::endl;
+        }
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        if(dynamic_cast<AlphaNumeric*>(print->child())) {
+            _os << pad << "std::cout << " << quote(print->child()->token().lexeme)
+                << " << std::endl;" << std::endl;
+        } else {
+            _os << pad << "std::cout << " << expr(print->child()) << " << std::endl;" << std::endl;
+        }
+    } else if(ScanF *scan = dynamic_cast<ScanF*>(tree)) {
+        if(_types.var_type(scan) == VOID) unsupported(scan);
+        _os << pad << "std::cin >> " << var(scan->token().lexeme) << ";" << std::endl;
+    } else if(IfStatement *ifs = dynamic_cast<IfStatement*>(tree)) {
+        _os << pad << (ifs->token() == IF ? "if " : "while ")
+            << cond(static_cast<ConditionalOp*>(ifs->left())) << " {" << std::endl;
+        emit_stmt(ifs->right(), depth + 1);
+        _os << pad << "}" << std::endl;
+    } else if(ObjectCreation *obj = dynamic_cast<ObjectCreation*>(tree)) {
+        // creating an object again replaces its old instance
+        _os << pad << "delete " << var(obj->token().lexeme) << ";" << std::endl;
+        _os << pad << var(obj->token().lexeme) << " = new "
+            << cls(obj->child()->token().lexeme) << "();" << std::endl;
+    } else if(FieldAssign *assign = dynamic_cast<FieldAssign*>(tree)) {
+        ResultType type = _types.type_of(assign->left());
+        if(type == VOID) unsupported(assign->left());
+        _os << pad << expr(assign->left()) << " = (" << ctype(type) << ") "
+            << expr(assign->right()) << ";" << std::endl;
+    } else if(ObjectAccess *access = dynamic_cast<ObjectAccess*>(tree)) {
+        // field accesses do nothing, calls dispatch through the vtable
+        if(access->begin() + 1 < access->end() and
+           (*(access->begin() + 1))->token() == LPAREN) {
+            std::string args;
+            for(auto itr = access->begin() + 2; itr != access->end(); itr++) {
+                if(not args.empty()) args += ", ";
+                if(dynamic_cast<Var*>(*itr) and _types.var_type(*itr) == ARRAY) {
+                    args += var((*itr)->token().lexeme);
+                } else {
+                    args += expr(*itr);
+                }
+            }
+            _os << pad << var(access->token().lexeme) << "->"
+                << method((*access->begin())->token().lexeme) << "(" << args << ");" << std::endl;
+        }
+    } else {
+        unsupported(tree);
+    }
+}
+
+
+//////////////////////////////////////////
+// Expressions
+//////////////////////////////////////////
+std::string CppEmitter::expr(ParseTree *tree)
+{
+    ResultType type = _types.type_of(tree);
+    if(type == VOID) unsupported(tree);
+
+    if(dynamic_cast<Number*>(tree)) {
+        return tree->token().lexeme;
+    } else if(dynamic_cast<Var*>(tree)) {
+        return var(tree->token().lexeme);
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        // compact elements are widened, so bytes are not printed as characters
+        std::string name = access->left()->token().lexeme;
+        std::string element = var(name) + "[(int64_t) " + expr(access->right()) + "]";
+        ElementType storage = _types.storage(access->left());
+        if(storage == ELEMENT_INT8 or storage == ELEMENT_INT16 or storage == ELEMENT_BIT) {
+            return "((int64_t) " + element + ")";
+        }
+        return element;
+    } else if(ObjectAccess *access = dynamic_cast<ObjectAccess*>(tree)) {
+        return var(access->token().lexeme) + "->" + var((*access->begin())->token().lexeme);
+    } else if(ArrayIndex *access = dynamic_cast<ArrayIndex*>(tree)) {
+        return index(access);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        if(type == INTEGER) return "wrap(-(uint64_t) " + expr(neg->child()) + ")";
+        return "(-" + expr(neg->child()) + ")";
+    } else if(dynamic_cast<ArrayLength*>(tree) or dynamic_cast<ArrayCount*>(tree) or
+              dynamic_cast<ArrayReduce*>(tree) or
+              dynamic_cast<MapGet*>(tree) or
+              dynamic_cast<MapContains*>(tree)) {
+        unsupported(tree);
+    }
+
+    BinaryOp *op = static_cast<BinaryOp*>(tree);
+    std::string l = expr(op->left());
+    std::string r = expr(op->right());
+
+    // integer arithmetic is done unsigned, so it wraps rather than overflows
+    if(type == INTEGER and not dynamic_cast<Pow*>(tree)) {
+        if(dynamic_cast<Div*>(tree)) return "quotient(" + l + ", " + r + ")";
+        const char *sym = dynamic_cast<Add*>(tree) ? " + " : dynamic_cast<Sub*>(tree) ? " - " : " * ";
+        return "wrap((uint64_t) " + l + sym + "(uint64_t) " + r + ")";
+    }
+    if(dynamic_cast<Add*>(tree)) {
+        return "(" + l + " + " + r + ")";
+    } else if(dynamic_cast<Sub*>(tree)) {
+        return "(" + l + " - " + r + ")";
+    } else if(dynamic_cast<Mul*>(tree)) {
+        return "(" + l + " * " + r + ")";
+    } else if(dynamic_cast<Div*>(tree)) {
+        return "(" + l + " / " + r + ")";
+    }
+
+    if(type == INTEGER) return "power(" + l + ", " + r + ")";
+    return "((" + ctype(type) + ") pow(" + l + ", " + r + "))";
+}
+
+
+std::string CppEmitter::cond(ConditionalOp *cond)
+{
+    static const char *ops[] = { " < ", " > ", " == ", " != " };
+    return "(" + expr(cond->left()) + ops[cond->op()] + expr(cond->right()) + ")";
+}
+
+
+// the row-major offset of an element of a multi-dimensional array
+std::string CppEmitter::index(ArrayIndex *index)
+{
+    auto shape = _shapes.find(index->token().lexeme);
+    if(shape == _shapes.end()) unsupported(index);
+
+    std::string result = "(int64_t) " + expr(*index->begin());
+    int k = 1;
+    for(auto itr = index->begin() + 1; itr != index->end(); itr++, k++) {
+        result = "(" + result + ") * " + shape->second[k] + " + inside(" + expr(*itr) + ", " +
+                 shape->second[k] + ", " + std::to_string(k + 1) + ", \"" +
+                 index->token().lexeme + "\")";
+    }
+    return "(" + result + ")";
+}
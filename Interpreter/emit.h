@@ -0,0 +1,56 @@
+// This file contains the C++ backend, which translates a calc program
+// into a standalone C++ program for the system compiler. Classes become
+// C++ classes with virtual methods, method locals become C++ locals, and
+// every other declared variable becomes a C++ global, just as those
+// declarations land in the global env.
+#ifndef EMIT_H
+#define EMIT_H
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "op.h"
+#include "types.h"
+
+
+class CppEmitter
+{
+public:
+    // constructor
+    CppEmitter(std::ostream &os);
+
+    // write the translation of a program
+    virtual void emit(ParseTree *program);
+
+protected:
+    // collect the classes, objects and variables of a tree
+    virtual void collect(ParseTree *tree);
+
+    // declarations
+    virtual void emit_class(ClassDefinition *def);
+    virtual void emit_globals();
+    virtual void emit_methods(ClassDefinition *def);
+    virtual std::string signature(Method *def);
+
+    // statements
+    virtual void emit_stmt(ParseTree *tree, int depth);
+
+    // expressions
+    virtual std::string expr(ParseTree *tree);
+    virtual std::string cond(ConditionalOp *cond);
+    virtual std::string index(ArrayIndex *index);
+
+private:
+    std::ostream &_os;
+    StaticTypes _types;
+    std::vector<ParseTree*> _vars;                  // declared variables, in order
+    std::map<Method*, std::vector<ParseTree*>> _locals;     // method locals, in order
+    std::map<Method*, std::map<std::string, std::string>> _localObjects;
+    Method *_method;                                // the method being collected
+    std::map<std::string, std::vector<std::string>> _shapes;   // bounds of multi-dimensional arrays
+    std::map<std::string, std::string> _objects;    // object name to class name
+    std::vector<ClassDefinition*> _classes;         // classes, in order
+    std::set<ClassDefinition*> _emitted;            // classes already written
+};
+#endif
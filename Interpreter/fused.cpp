@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include "fused.h"
+
+typedef FusedExpr::Step Step;
+
+// the elements computed at once; with a dozen steps, all their blocks
+// fit in the L1 cache
+static const int64_t BLOCK = 256;
+
+// a block of a step's elements, integers or reals as its type is
+union Lanes
+{
+    int64_t i[BLOCK];
+    double r[BLOCK];
+};
+
+// what a pass over the blocks reads and writes
+struct Pass
+{
+    const Step *steps;
+    int count;
+    Lanes *lanes;
+    void *const *arrays;
+    void *dest;
+    ElementType element;
+};
+
+// the loops over a block are inlined into both versions of a pass, so
+// each is vectorized for the instructions its version may use
+#define LANES static inline __attribute__((always_inline))
+
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// an integer as a real; integers have 48 bits, so one added to 2^52 +
+// 2^51 fills the low bits of that double's mantissa, and a vector add
+// converts it where the processor cannot convert 64 bit integers
+LANES double to_real(int64_t v)
+{
+    uint64_t bits = (uint64_t) v + 0x4338000000000000ull;
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d - 6755399441055744.0;
+}
+
+
+// elements at to at + m - 1 of an array into a block, or out of one;
+// whole blocks are copied by a loop of fixed length, which vectorizes
+template<typename E>
+LANES void load(Lanes &__restrict out, const void *arr, int64_t at, int64_t m)
+{
+    if constexpr(std::is_same_v<E, double>) {
+        memcpy(out.r, static_cast<const double*>(arr) + at, m * sizeof(double));
+    } else if constexpr(std::is_same_v<E, Bit>) {
+        for(int64_t k = 0; k < m; k++) out.i[k] = read_element<Bit>(arr, at + k);
+    } else if(m == BLOCK) {
+        const E *p = static_cast<const E*>(arr) + at;
+        for(int64_t k = 0; k < BLOCK; k++) out.i[k] = p[k];
+    } else {
+        const E *p = static_cast<const E*>(arr) + at;
+        for(int64_t k = 0; k < m; k++) out.i[k] = p[k];
+    }
+}
+
+
+template<typename E>
+LANES void store(void *arr, const Lanes &__restrict in, int64_t at, int64_t m)
+{
+    if constexpr(std::is_same_v<E, double>) {
+        memcpy(static_cast<double*>(arr) + at, in.r, m * sizeof(double));
+    } else if constexpr(std::is_same_v<E, Bit>) {
+        for(int64_t k = 0; k < m; k++) write_element<Bit>(arr, at + k, in.i[k]);
+    } else if(m == BLOCK) {
+        E *p = static_cast<E*>(arr) + at;
+        for(int64_t k = 0; k < BLOCK; k++) p[k] = (E) in.i[k];
+    } else {
+        E *p = static_cast<E*>(arr) + at;
+        for(int64_t k = 0; k < m; k++) p[k] = (E) in.i[k];
+    }
+}
+
+
+// an operator over every lane of a block; lanes past the end of the
+// last block hold elements of the block before, which are computed but
+// never stored
+template<typename F>
+LANES void ints(Lanes &__restrict out, const Lanes &l, const Lanes &r, F f)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.i[k] = f(l.i[k], r.i[k]);
+}
+
+
+template<typename F>
+LANES void reals(Lanes &__restrict out, const Lanes &l, const Lanes &r, F f)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.r[k] = f(l.r[k], r.r[k]);
+}
+
+
+template<typename F>
+LANES void ints(Lanes &__restrict out, const Lanes &l, F f)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.i[k] = f(l.i[k]);
+}
+
+
+template<typename F>
+LANES void reals(Lanes &__restrict out, const Lanes &l, F f)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.r[k] = f(l.r[k]);
+}
+
+
+LANES void widen(Lanes &__restrict out, const Lanes &l)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.r[k] = to_real(l.i[k]);
+}
+
+
+LANES void number(Lanes &__restrict out, int64_t at)
+{
+    for(int64_t k = 0; k < BLOCK; k++) out.i[k] = at + k;
+}
+
+
+//////////////////////////////////////////
+// Passes
+//////////////////////////////////////////
+
+// run every step over elements at to at + m - 1, and store the last
+LANES void pass_block(const Pass &p, int64_t at, int64_t m)
+{
+    for(int s = 0; s < p.count; s++) {
+        const Step &step = p.steps[s];
+        Lanes &out = p.lanes[s];
+        const Lanes &l = p.lanes[std::max(step.left, 0)];
+        const Lanes &r = p.lanes[std::max(step.right, 0)];
+        bool integer = step.type == INTEGER;
+        switch(step.code) {
+            case FusedExpr::LOAD:
+                switch(step.element) {
+                    case ELEMENT_INT8:
+                        load<int8_t>(out, p.arrays[step.left], at, m);
+                        break;
+                    case ELEMENT_INT16:
+                        load<int16_t>(out, p.arrays[step.left], at, m);
+                        break;
+                    case ELEMENT_BIT:
+                        load<Bit>(out, p.arrays[step.left], at, m);
+                        break;
+                    case ELEMENT_REAL:
+                        load<double>(out, p.arrays[step.left], at, m);
+                        break;
+                    default:
+                        load<int64_t>(out, p.arrays[step.left], at, m);
+                        break;
+                }
+                break;
+            case FusedExpr::INDEX:
+                number(out, at);
+                break;
+            case FusedExpr::CONST:
+                break;
+            case FusedExpr::WIDEN:
+                widen(out, l);
+                break;
+            case FusedExpr::ADD:
+                if(integer) {
+                    ints(out, l, r, [](int64_t a, int64_t b) {
+                        return wrap_int((int64_t) ((uint64_t) a + (uint64_t) b));
+                    });
+                } else {
+                    reals(out, l, r, [](double a, double b) { return a + b; });
+                }
+                break;
+            case FusedExpr::SUB:
+                if(integer) {
+                    ints(out, l, r, [](int64_t a, int64_t b) {
+                        return wrap_int((int64_t) ((uint64_t) a - (uint64_t) b));
+                    });
+                } else {
+                    reals(out, l, r, [](double a, double b) { return a - b; });
+                }
+                break;
+            case FusedExpr::MUL:
+                if(integer) {
+                    ints(out, l, r, [](int64_t a, int64_t b) { return mul_int(a, b); });
+                } else {
+                    reals(out, l, r, [](double a, double b) { return a * b; });
+                }
+                break;
+            case FusedExpr::DIV:
+                // integer division has no vector instruction, and stops
+                // at a zero divisor as the evaluator would
+                if(integer) {
+                    for(int64_t k = 0; k < m; k++) {
+                        if(r.i[k] == 0) throw std::runtime_error("Division by zero");
+                        out.i[k] = wrap_int(l.i[k] / r.i[k]);
+                    }
+                } else {
+                    reals(out, l, r, [](double a, double b) { return a / b; });
+                }
+                break;
+            case FusedExpr::POW:
+                if(integer) {
+                    ints(out, l, r, [](int64_t a, int64_t b) { return pow_int(a, b); });
+                } else {
+                    reals(out, l, r, [](double a, double b) { return pow(a, b); });
+                }
+                break;
+            case FusedExpr::NEG:
+                if(integer) {
+                    ints(out, l, [](int64_t a) { return wrap_int((int64_t) -(uint64_t) a); });
+                } else {
+                    reals(out, l, [](double a) { return -a; });
+                }
+                break;
+        }
+    }
+
+    const Lanes &result = p.lanes[p.count - 1];
+    switch(p.element) {
+        case ELEMENT_INT8:
+            store<int8_t>(p.dest, result, at, m);
+            break;
+        case ELEMENT_INT16:
+            store<int16_t>(p.dest, result, at, m);
+            break;
+        case ELEMENT_BIT:
+            store<Bit>(p.dest, result, at, m);
+            break;
+        case ELEMENT_REAL:
+            store<double>(p.dest, result, at, m);
+            break;
+        default:
+            store<int64_t>(p.dest, result, at, m);
+            break;
+    }
+}
+
+
+static void pass_scalar(const Pass &p, int64_t at, int64_t m)
+{
+    pass_block(p, at, m);
+}
+
+
+__attribute__((target("avx2")))
+static void pass_avx2(const Pass &p, int64_t at, int64_t m)
+{
+    pass_block(p, at, m);
+}
+
+
+//////////////////////////////////////////
+// FusedExpr Implementation
+//////////////////////////////////////////
+FusedExpr::FusedExpr(ParseTree *expr, const std::function<ParseTree*(ParseTree*)> &array,
+                     ParseTree *index)
+{
+    _type = _steps[compile(expr, array, index)].type;
+}
+
+
+ResultType FusedExpr::type() const
+{
+    return _type;
+}
+
+
+const std::vector<ParseTree*> &FusedExpr::arrays() const
+{
+    return _arrays;
+}
+
+
+bool FusedExpr::total() const
+{
+    for(const Step &step : _steps) {
+        if(step.code == DIV and step.type == INTEGER and
+           (_steps[step.right].code != CONST or _steps[step.right].value.i() == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void FusedExpr::run(Result &dest, int64_t lo, int64_t hi) const
+{
+    // constants fill their blocks once
+    std::vector<Lanes> lanes(_steps.size());
+    for(size_t s = 0; s < _steps.size(); s++) {
+        if(_steps[s].code != CONST) continue;
+        for(int64_t k = 0; k < BLOCK; k++) {
+            if(_steps[s].type == INTEGER) {
+                lanes[s].i[k] = _steps[s].value.i();
+            } else {
+                lanes[s].r[k] = _steps[s].value.r();
+            }
+        }
+    }
+
+    // nothing is allocated in a pass, so the arrays stay where they are
+    std::vector<void*> arrays;
+    for(ParseTree *named : _arrays) {
+        arrays.push_back(named->ref().ptr());
+    }
+
+    Pass pass = { _steps.data(), (int) _steps.size(), lanes.data(), arrays.data(),
+                  dest.ptr(), dest.element_type() };
+    static void (*const run_pass)(const Pass&, int64_t, int64_t) =
+        __builtin_cpu_supports("avx2") ? pass_avx2 : pass_scalar;
+    for(int64_t at = lo; at < hi; at += BLOCK) {
+        run_pass(pass, at, std::min(BLOCK, hi - at));
+    }
+}
+
+
+// compile a tree into steps, returning the index of its last
+int FusedExpr::compile(ParseTree *tree, const std::function<ParseTree*(ParseTree*)> &array,
+                       ParseTree *index)
+{
+    Step step = { CONST, VOID, -1, -1, ELEMENT_INT64, Result() };
+    BinaryOp *op = dynamic_cast<BinaryOp*>(tree);
+    if(ParseTree *named = array(tree)) {
+        step.code = LOAD;
+        step.element = named->ref().element_type();
+        step.type = step.element == ELEMENT_MAP ? VOID : value_of(step.element);
+        step.left = _arrays.size();
+        _arrays.push_back(named);
+    } else if(index and dynamic_cast<Var*>(tree) and tree->slot() == index->slot() and
+              tree->token().lexeme == index->token().lexeme) {
+        step.code = INDEX;
+        step.type = INTEGER;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        step.code = NEG;
+        step.left = compile(neg->child(), array, index);
+        step.type = _steps[step.left].type;
+    } else if(op and (dynamic_cast<Add*>(op) or dynamic_cast<Sub*>(op) or dynamic_cast<Mul*>(op) or
+                      dynamic_cast<Div*>(op) or dynamic_cast<Pow*>(op))) {
+        step.code = dynamic_cast<Add*>(op) ? ADD : dynamic_cast<Sub*>(op) ? SUB :
+                    dynamic_cast<Mul*>(op) ? MUL : dynamic_cast<Div*>(op) ? DIV : POW;
+        step.left = compile(op->left(), array, index);
+        step.right = compile(op->right(), array, index);
+
+        // integers are widened when the other operand is real
+        ResultType l = _steps[step.left].type;
+        ResultType r = _steps[step.right].type;
+        step.type = l == VOID or r == VOID ? VOID : l == INTEGER and r == INTEGER ? INTEGER : REAL;
+        if(step.type == REAL) {
+            step.left = widen(step.left, l);
+            step.right = widen(step.right, r);
+        }
+    } else {
+        // anything else is a number, the same for every element
+        step.value = tree->eval();
+        step.type = step.value.type() == INTEGER or step.value.type() == REAL ? step.value.type() : VOID;
+    }
+    return push(step);
+}
+
+
+// the real elements of a step, converted if they are integers
+int FusedExpr::widen(int step, ResultType type)
+{
+    if(type == REAL) return step;
+    Step conversion = { WIDEN, REAL, step, -1, ELEMENT_INT64, Result() };
+    return push(conversion);
+}
+
+
+int FusedExpr::push(const Step &step)
+{
+    _steps.push_back(step);
+    return _steps.size() - 1;
+}
+
+
+//////////////////////////////////////////
+// FusedLoop Implementation
+//////////////////////////////////////////
+
+// the elements each assignment computes before the next runs, so that
+// what one writes is still in cache when another reads it
+static const int64_t CHUNK = 16 * BLOCK;
+
+
+// is a tree the variable another names
+static bool same_var(ParseTree *tree, ParseTree *var)
+{
+    return dynamic_cast<Var*>(tree) and tree->slot() == var->slot() and
+           tree->token().lexeme == var->token().lexeme;
+}
+
+
+// does an expression read nothing but numbers, variables and the elements
+// at the counter, collecting the elements
+static bool elementwise(ParseTree *tree, ParseTree *counter, std::vector<ArrayAccess*> &reads)
+{
+    BinaryOp *op = dynamic_cast<BinaryOp*>(tree);
+    if(dynamic_cast<Number*>(tree) or dynamic_cast<Var*>(tree)) {
+        return true;
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        reads.push_back(access);
+        return dynamic_cast<Var*>(access->left()) and same_var(access->right(), counter);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return elementwise(neg->child(), counter, reads);
+    } else if(op and (dynamic_cast<Add*>(op) or dynamic_cast<Sub*>(op) or dynamic_cast<Mul*>(op) or
+                      dynamic_cast<Div*>(op) or dynamic_cast<Pow*>(op))) {
+        return elementwise(op->left(), counter, reads) and elementwise(op->right(), counter, reads);
+    }
+    return false;
+}
+
+
+// does a name hold an array of numbers with at least n elements
+static bool holds(ParseTree *named, int64_t n)
+{
+    Result &arr = named->ref();
+    return arr.type() == ARRAY and arr.element_type() != ELEMENT_MAP and
+           array_length(arr.ptr()) >= n;
+}
+
+
+FusedLoop::FusedLoop(ParseTree *counter, ParseTree *bound, const std::vector<ArrayAssign*> &stores,
+                     const std::vector<ArrayAccess*> &reads)
+    : _counter(counter), _bound(bound), _stores(stores), _reads(reads)
+{
+}
+
+
+FusedLoop *FusedLoop::match(IfStatement *loop)
+{
+    // while (i < n), counting up to a bound the body cannot change
+    ConditionalOp *cond = dynamic_cast<ConditionalOp*>(loop->left());
+    if(not cond or cond->op() != CMP_LT or not dynamic_cast<Var*>(cond->left())) {
+        return nullptr;
+    }
+    ParseTree *counter = cond->left();
+    ParseTree *bound = cond->right();
+    if(not dynamic_cast<Number*>(bound) and not dynamic_cast<ArrayLength*>(bound) and
+       (not dynamic_cast<Var*>(bound) or same_var(bound, counter))) {
+        return nullptr;
+    }
+
+    // element assignments at i, then i = i + 1; the body writes no
+    // variable but i, so everything else is the same on every pass
+    Statementblock *body = dynamic_cast<Statementblock*>(loop->right());
+    if(not body or body->begin() == body->end()) {
+        return nullptr;
+    }
+    IncrementVar *inc = dynamic_cast<IncrementVar*>(*(body->end() - 1));
+    if(not inc or not same_var(inc->child(), counter) or inc->step().type() != INTEGER or
+       inc->step().i() != 1) {
+        return nullptr;
+    }
+
+    std::vector<ArrayAssign*> stores;
+    std::vector<ArrayAccess*> reads;
+    for(auto itr = body->begin(); itr + 1 < body->end(); itr++) {
+        ArrayAssign *store = dynamic_cast<ArrayAssign*>(*itr);
+        if(not store or not same_var(store->left(), counter) or
+           not elementwise(store->right(), counter, reads)) {
+            return nullptr;
+        }
+        stores.push_back(store);
+    }
+    if(stores.empty()) {
+        return nullptr;
+    }
+    return new FusedLoop(counter, bound, stores, reads);
+}
+
+
+bool FusedLoop::run()
+{
+    // the loop runs from i to the bound, through arrays long enough for
+    // every pass, which leaves no pass to fail part way
+    Result start = _counter->eval();
+    Result end = _bound->eval();
+    if(start.type() != INTEGER or end.type() != INTEGER) {
+        return false;
+    }
+    int64_t lo = start.i();
+    int64_t hi = end.i();
+    if(lo < 0 or hi <= lo) {
+        return false;
+    }
+    for(ArrayAccess *access : _reads) {
+        if(not holds(access->left(), hi)) return false;
+    }
+    for(ArrayAssign *store : _stores) {
+        if(not holds(store, hi)) return false;
+    }
+
+    // each element is stored as the evaluator would have, or the loop is
+    // left to it to report the mismatch; a division which may stop part
+    // way through a chunk is left to it too, as the chunk would have
+    // stored elements past the one which failed
+    std::vector<FusedExpr> exprs;
+    exprs.reserve(_stores.size());
+    for(ArrayAssign *store : _stores) {
+        exprs.emplace_back(store->right(), [](ParseTree *leaf) -> ParseTree* {
+            ArrayAccess *access = dynamic_cast<ArrayAccess*>(leaf);
+            return access ? access->left() : nullptr;
+        }, _counter);
+        if(exprs.back().type() != value_of(store->ref().element_type()) or
+           not exprs.back().total()) {
+            return false;
+        }
+    }
+
+    // pass by pass, every element written depends only on the elements
+    // at its own index, so the chunks may run each assignment in turn
+    for(int64_t at = lo; at < hi; at += CHUNK) {
+        int64_t to = std::min(hi, at + CHUNK);
+        for(size_t s = 0; s < _stores.size(); s++) {
+            exprs[s].run(_stores[s]->ref(), at, to);
+        }
+    }
+    _counter->ref().i(hi);
+    return true;
+}
@@ -0,0 +1,95 @@
+// This file contains the fused kernels which compute whole arrays from
+// expressions, as in c = a * 2 + b. An expression is compiled into steps
+// which each work on a block of elements at once: arrays are read a block
+// at a time and numbers are computed before the first, so the blocks stay
+// in cache and no array the size of the operands is ever made. Each step
+// is a loop over a fixed number of lanes, which the compiler vectorizes,
+// and the steps are built for AVX2 too when the processor has it.
+#ifndef FUSED_H
+#define FUSED_H
+#include <functional>
+#include <vector>
+#include "op.h"
+
+class FusedExpr
+{
+public:
+    // compile an expression: the leaves array() returns a named array
+    // for are read an element at a time, a leaf naming the index
+    // variable is the number of each element, and the rest are
+    // evaluated now
+    FusedExpr(ParseTree *expr, const std::function<ParseTree*(ParseTree*)> &array,
+              ParseTree *index = nullptr);
+
+    // the type of the elements computed, VOID if a leaf is not a number
+    // or an array of numbers
+    virtual ResultType type() const;
+
+    // the arrays the expression reads
+    virtual const std::vector<ParseTree*> &arrays() const;
+
+    // true if no element can fail to compute: every integer division is
+    // by a number other than zero
+    virtual bool total() const;
+
+    // compute elements lo to hi - 1 into an array whose elements are of
+    // the expression's type; the arrays read must have hi elements
+    virtual void run(Result &dest, int64_t lo, int64_t hi) const;
+
+    // the steps of an expression, in the order they run
+    enum Code { LOAD, INDEX, CONST, WIDEN, ADD, SUB, MUL, DIV, POW, NEG };
+    struct Step
+    {
+        Code code;
+        ResultType type;        // of the elements it computes
+        int left;               // the steps an operator reads, or the
+        int right;              // array a load reads
+        ElementType element;    // how a load's array is stored
+        Result value;           // the number a constant is
+    };
+
+private:
+    int compile(ParseTree *tree, const std::function<ParseTree*(ParseTree*)> &array,
+                ParseTree *index);
+    int widen(int step, ResultType type);
+    int push(const Step &step);
+
+    std::vector<Step> _steps;
+    std::vector<ParseTree*> _arrays;
+    ResultType _type;
+};
+
+
+// A counted loop whose body only assigns elements at its counter:
+//
+//     while (i < n):
+//         c[i] = a[i] + b[i]
+//         i = i + 1
+//     endwhile
+//
+// Every element is read and written at its own index only, so no pass
+// depends on another, and the loop can run as fused expressions over all
+// its elements at once.
+class FusedLoop
+{
+public:
+    // the loop's counter, bound and assignments, and the accesses they
+    // read; match() finds them
+    FusedLoop(ParseTree *counter, ParseTree *bound, const std::vector<ArrayAssign*> &stores,
+              const std::vector<ArrayAccess*> &reads);
+    virtual ~FusedLoop() {}
+
+    // the form of a loop, nullptr if it does not have it
+    static FusedLoop *match(IfStatement *loop);
+
+    // run the loop to its end, false if the values it finds do not allow
+    // it, which leaves the loop to run pass by pass
+    virtual bool run();
+
+private:
+    ParseTree *_counter;                // the variable of the condition
+    ParseTree *_bound;                  // what it is compared with
+    std::vector<ArrayAssign*> _stores;  // the body's assignments
+    std::vector<ArrayAccess*> _reads;   // the elements they read
+};
+#endif
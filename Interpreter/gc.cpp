@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "alloc.h"
+#include "gc.h"
+
+// the heap
+Heap heap;
+
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// payloads are kept 8 byte aligned
+static size_t round_up(size_t bytes)
+{
+    return (bytes + 7) & ~(size_t) 7;
+}
+
+
+static double now_ms()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+//////////////////////////////////////////
+// Heap Implementation
+//////////////////////////////////////////
+
+// constructor and destructor
+Heap::Heap()
+{
+    _nursery = static_cast<char*>(Allocator::local().allocate(NURSERY_SIZE));
+    _top = _nursery;
+    _end = _nursery + NURSERY_SIZE;
+    _marking = false;
+
+    _oldBytes = 0;
+    _nextMajor = MIN_MAJOR;
+    _allocated = 0;
+    _minors = 0;
+    _majors = 0;
+    _pauseTotal = 0;
+    _pauseMax = 0;
+}
+
+
+Heap::~Heap()
+{
+    for(HeapHeader *h : _old) {
+        release(h);
+    }
+    Allocator::local().release(_nursery, NURSERY_SIZE);
+}
+
+
+// allocate a block, which may trigger a collection
+void *Heap::allocate(size_t bytes, HeapKind kind)
+{
+    size_t need = sizeof(HeapHeader) + round_up(bytes);
+    HeapHeader *h;
+    _allocated += bytes;
+
+    if(need > LARGE_BLOCK) {
+        // large blocks are never copied
+        if(_oldBytes + need > _nextMajor) major();
+        h = static_cast<HeapHeader*>(Allocator::local().allocate(need));
+        h->old = true;
+        _old.push_back(h);
+        _oldBytes += bytes;
+    } else {
+        if(need > (size_t) (_end - _top)) {
+            minor();
+            if(_oldBytes > _nextMajor) major();
+        }
+        h = reinterpret_cast<HeapHeader*>(_top);
+        h->old = false;
+        _top += need;
+    }
+
+    h->size = bytes;
+    h->kind = kind;
+    h->marked = false;
+    h->forward = nullptr;
+    return h->payload();
+}
+
+
+// collect the nursery, every survivor is promoted to the old space
+void Heap::minor()
+{
+    double start = now_ms();
+    trace_roots();
+    _top = _nursery;
+    _minors++;
+
+    double pause = now_ms() - start;
+    _pauseTotal += pause;
+    _pauseMax = std::max(_pauseMax, pause);
+}
+
+
+// collect the nursery and the old space
+void Heap::major()
+{
+    double start = now_ms();
+
+    // survivors of the nursery are marked as they are copied
+    _marking = true;
+    trace_roots();
+    _marking = false;
+    _top = _nursery;
+
+    // sweep the old space
+    size_t kept = 0;
+    _oldBytes = 0;
+    for(HeapHeader *h : _old) {
+        if(h->marked) {
+            h->marked = false;
+            _old[kept++] = h;
+            _oldBytes += h->size;
+        } else {
+            release(h);
+        }
+    }
+    _old.resize(kept);
+    _nextMajor = std::max(2 * _oldBytes, MIN_MAJOR);
+    _majors++;
+
+    double pause = now_ms() - start;
+    _pauseTotal += pause;
+    _pauseMax = std::max(_pauseMax, pause);
+}
+
+
+// the elements an array has room for, those carved off a frame have
+// none to spare
+int64_t Heap::capacity(const Result &arr)
+{
+    void *elements = arr.ptr();
+    size_t offset = shape_bytes(array_rank(elements));
+    HeapHeader *h = header(static_cast<char*>(elements) - offset);
+    if(not h) return array_length(elements);
+    return element_room(arr.element_type(), h->size - offset);
+}
+
+
+// grow an array to room for n elements, every handle to it is updated
+// if it moves
+void Heap::grow(Result &arr, int64_t n)
+{
+    Root root(arr);
+    size_t offset = shape_bytes(array_rank(arr.ptr()));
+    size_t bytes = offset + element_bytes(arr.element_type(), n);
+    char *from = static_cast<char*>(arr.ptr());
+    HeapHeader *h = header(from - offset);
+    char *block;
+
+    if(h and h->old) {
+        // old blocks are the allocator's own, which extends a large one's
+        // mapping rather than copying it
+        size_t need = sizeof(HeapHeader) + round_up(bytes);
+        HeapHeader *moved = static_cast<HeapHeader*>(
+            Allocator::local().reallocate(h, sizeof(HeapHeader) + round_up(h->size), need));
+        if(moved != h) std::replace(_old.begin(), _old.end(), h, moved);
+        _allocated += bytes - moved->size;
+        _oldBytes += bytes - moved->size;
+        moved->size = bytes;
+        block = static_cast<char*>(moved->payload());
+    } else {
+        // a collection may move the array before it is copied
+        block = static_cast<char*>(allocate(bytes, HEAP_ARRAY));
+        from = static_cast<char*>(arr.ptr());
+        memcpy(block, from - offset, offset + element_bytes(arr.element_type(), array_length(from)));
+    }
+
+    relocate(from, block + offset);
+}
+
+
+// temporaries which must survive an allocation
+void Heap::protect(Result *root)
+{
+    _roots.push_back(root);
+}
+
+
+void Heap::unprotect()
+{
+    _roots.pop_back();
+}
+
+
+// report collection counts, pause times and heap size
+void Heap::report(std::ostream &os) const
+{
+    os << "gc: " << _minors << " minor and " << _majors << " major collections, "
+       << _pauseTotal << " ms paused (" << _pauseMax << " ms max)" << std::endl
+       << "gc: " << _allocated / 1024 << " KB allocated, heap " << NURSERY_SIZE / 1024
+       << " KB nursery (" << (_top - _nursery) / 1024 << " KB used) and "
+       << _oldBytes / 1024 << " KB old in " << _old.size() << " blocks" << std::endl;
+}
+
+
+// copy a nursery block out, or mark an old one, returning its address
+void *Heap::evacuate(void *p)
+{
+    HeapHeader *h = header(p);
+    if(not h) return p;
+
+    if(h->old) {
+        if(_marking) h->marked = true;
+        return p;
+    } else if(h->forward) {
+        return h->forward;
+    }
+
+    // promote the block, leaving its new address behind
+    size_t bytes = sizeof(HeapHeader) + round_up(h->size);
+    HeapHeader *copy = static_cast<HeapHeader*>(Allocator::local().allocate(bytes));
+    memcpy(copy, h, bytes);
+    copy->old = true;
+    copy->marked = _marking;
+    _old.push_back(copy);
+    _oldBytes += h->size;
+
+    h->forward = copy->payload();
+    return h->forward;
+}
+
+
+// evacuate an array, whose handle points past its shape
+void *Heap::evacuate_array(void *elements)
+{
+    if(elements == nullptr) return nullptr;
+
+    size_t offset = shape_bytes(array_rank(elements));
+    char *block = static_cast<char*>(evacuate(static_cast<char*>(elements) - offset));
+    return block + offset;
+}
+
+
+// point every handle to an array's old elements at its new ones, the
+// handles are found just as the roots are traced
+void Heap::relocate(void *from, void *to)
+{
+    if(from == to) return;
+
+    auto move = [from, to](Result &r) {
+        if(r.type() == ARRAY and r.ptr() == from) r.array(to, r.element_type());
+    };
+    auto visit = [&move](Result &r) {
+        move(r);
+        if(r.type() == OBJECT) {
+            Instance *obj = static_cast<Instance*>(r.ptr());
+            for(int i = 0; i < obj->cls->field_count(); i++) {
+                move(obj->fields()[i]);
+            }
+        }
+    };
+    env.visit(visit);
+    frames.visit(visit);
+    for(Result *r : _roots) {
+        visit(*r);
+    }
+}
+
+
+// give an old block back to the allocator
+void Heap::release(HeapHeader *h)
+{
+    Allocator::local().release(h, sizeof(HeapHeader) + round_up(h->size));
+}
+
+
+// trace one root, instances only hold numbers and arrays so tracing
+// stops at their fields
+void Heap::trace(Result &r)
+{
+    if(r.type() == ARRAY) {
+        r.array(evacuate_array(r.ptr()), r.element_type());
+    } else if(r.type() == OBJECT) {
+        Instance *obj = static_cast<Instance*>(evacuate(r.ptr()));
+        r.ptr(OBJECT, obj);
+
+        Result *fields = obj->fields();
+        for(int i = 0; i < obj->cls->field_count(); i++) {
+            Result &field = fields[i];
+            if(field.type() == ARRAY) {
+                field.array(evacuate_array(field.ptr()), field.element_type());
+            }
+        }
+    }
+}
+
+
+void Heap::trace_roots()
+{
+    env.visit([this](Result &r) { trace(r); });
+    frames.visit([this](Result &r) { trace(r); });
+    for(Result *r : _roots) {
+        trace(*r);
+    }
+}
+
+
+// the header of a heap block (nullptr if p is not in the heap)
+HeapHeader *Heap::header(void *p)
+{
+    // blocks carved off a frame are freed with it
+    if(p == nullptr or frames.owns(p)) return nullptr;
+    return static_cast<HeapHeader*>(p) - 1;
+}
@@ -0,0 +1,115 @@
+// This file contains the garbage collected heap which arrays and object
+// instances live in. New blocks are bump allocated in a nursery, and the
+// survivors of a minor collection are copied out into a mark-sweep old
+// space. Roots are found precisely: the global env, the named slots of
+// every active frame, and temporaries the evaluator protects.
+#ifndef GC_H
+#define GC_H
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "op.h"
+
+// the kinds of heap blocks
+enum HeapKind
+{
+    HEAP_ARRAY=0,
+    HEAP_INSTANCE
+};
+
+
+// the header in front of every heap block
+struct HeapHeader
+{
+    size_t size;        // payload bytes
+    uint8_t kind;
+    bool old;           // in the old space
+    bool marked;        // reached by the current major collection
+    void *forward;      // where a copied nursery block went
+
+    // the payload after the header
+    void *payload() { return this + 1; }
+};
+
+
+// the heap sizes
+const size_t NURSERY_SIZE = 4 << 20;
+const size_t LARGE_BLOCK = NURSERY_SIZE / 8;    // allocated straight in the old space
+const size_t MIN_MAJOR = 16 << 20;              // old space bytes before a major collection
+
+
+class Heap
+{
+public:
+    // constructor and destructor
+    Heap();
+    virtual ~Heap();
+
+    // allocate a block, which may trigger a collection
+    virtual void *allocate(size_t bytes, HeapKind kind);
+
+    // collect the nursery, or the nursery and the old space
+    virtual void minor();
+    virtual void major();
+
+    // the elements an array has room for, and grow it to room for n
+    // (more than it has); every handle to it is updated if it moves
+    virtual int64_t capacity(const Result &arr);
+    virtual void grow(Result &arr, int64_t n);
+
+    // point every handle to an array's old elements at its new ones
+    virtual void relocate(void *from, void *to);
+
+    // temporaries which must survive an allocation
+    virtual void protect(Result *root);
+    virtual void unprotect();
+
+    // report collection counts, pause times and heap size
+    virtual void report(std::ostream &os) const;
+
+private:
+    // copy a nursery block out, or mark an old one, returning its address
+    void *evacuate(void *p);
+
+    // evacuate an array, whose handle points past its shape
+    void *evacuate_array(void *elements);
+
+    // give an old block back to the allocator
+    void release(HeapHeader *h);
+
+    // trace one root, its instance fields included
+    void trace(Result &r);
+    void trace_roots();
+
+    // the header of a heap block (nullptr if p is not in the heap)
+    HeapHeader *header(void *p);
+
+    char *_nursery;
+    char *_top;
+    char *_end;
+    std::vector<HeapHeader*> _old;
+    std::vector<Result*> _roots;    // protected temporaries
+    bool _marking;                  // in a major collection
+
+    // statistics
+    size_t _oldBytes;
+    size_t _nextMajor;
+    size_t _allocated;
+    size_t _minors;
+    size_t _majors;
+    double _pauseTotal;
+    double _pauseMax;
+};
+
+// the heap
+extern Heap heap;
+
+// Protects a temporary for as long as it is in scope
+class Root
+{
+public:
+    Root(Result &r) { heap.protect(&r); }
+    ~Root() { heap.unprotect(); }
+};
+#endif
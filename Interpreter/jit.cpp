@@ -0,0 +1,1541 @@
+#include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "jit.h"
+#include "map.h"
+
+// error raised by a statement called out from native code
+static std::exception_ptr pending;
+
+
+//////////////////////////////////////////
+// Runtime Entry Points
+//////////////////////////////////////////
+
+// run a statement the JIT does not translate, returning 1 on error
+static int jit_eval(ParseTree *tree)
+{
+    try {
+        tree->eval();
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// append to an array, returning 1 on error
+static int jit_append_int(ArrayAppend *append, Result *arr, int64_t v)
+{
+    try {
+        Result value;
+        value.i(v);
+        append->append(*arr, value);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+static int jit_append_real(ArrayAppend *append, Result *arr, double v)
+{
+    try {
+        Result value;
+        value.r(v);
+        append->append(*arr, value);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// maps take their key and value in two words of the caller's frame, each
+// an int or a double as the map's types are
+static Result unpack(const int64_t *word, ResultType type)
+{
+    Result r;
+    if(type == INTEGER) {
+        r.i(*word);
+    } else {
+        double v;
+        memcpy(&v, word, sizeof v);
+        r.r(v);
+    }
+    return r;
+}
+
+
+static void pack(int64_t *word, const Result &r, ResultType type)
+{
+    if(type == INTEGER) {
+        *word = (int64_t) NUM_RESULT(r);
+    } else {
+        double v = NUM_RESULT(r);
+        memcpy(word, &v, sizeof v);
+    }
+}
+
+
+// look a key up in a map, returning 1 on error
+static int jit_map_get(MapGet *get, Result *map, int64_t *io)
+{
+    try {
+        MapTable *t = map_table(*map);
+        pack(io + 1, get->get(*map, unpack(io, t->key)), t->value);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// set a key's value, the map may move so the runtime updates its slot
+static int jit_map_put(MapPut *put, Result *map, int64_t *io)
+{
+    try {
+        MapTable *t = map_table(*map);
+        put->put(*map, unpack(io, t->key), unpack(io + 1, t->value));
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+static int jit_map_contains(MapContains *contains, Result *map, int64_t *io)
+{
+    try {
+        Result found;
+        found.i(contains->contains(*map, unpack(io, map_table(*map)->key)));
+        pack(io + 1, found, INTEGER);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// count the elements of an array which are not zero, or equal a number,
+// into a word of the caller's frame, returning 1 on error
+static int jit_count(ArrayCount *count, Result *arr, int64_t *io)
+{
+    try {
+        *io = count->count(*arr);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+static int jit_count_value(ArrayCount *count, Result *arr, int64_t *io, double v)
+{
+    try {
+        Result value;
+        value.r(v);
+        *io = count->count(*arr, value);
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// reduce arrays into a word of the caller's frame, returning 1 on error
+static int jit_reduce(ArrayReduce *reduce, Result *a, Result *b, int64_t *io)
+{
+    try {
+        Result r = reduce->reduce(*a, *b);
+        pack(io, r, r.type());
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+    return 0;
+}
+
+
+// run a loop through the array kernels: 0 if they ran it, 2 if they
+// declined it and 1 on error
+static int jit_vectorize(IfStatement *loop)
+{
+    try {
+        return loop->vectorize() ? 0 : 2;
+    } catch(...) {
+        pending = std::current_exception();
+        return 1;
+    }
+}
+
+
+// integer division by zero, which native code checks for before idiv
+static int jit_div_zero()
+{
+    pending = std::make_exception_ptr(std::runtime_error("Division by zero"));
+    return 1;
+}
+
+
+// an index outside an inner dimension of an array
+static int jit_outside(ParseTree *named, int64_t k, int64_t index)
+{
+    try {
+        dimension_error(named, k, index);
+    } catch(...) {
+        pending = std::current_exception();
+    }
+    return 1;
+}
+
+
+// integer power, the address native code calls
+static int64_t jit_pow_int(int64_t l, int64_t r)
+{
+    return pow_int(l, r);
+}
+
+
+// real power, the address native code calls
+static double jit_pow(double l, double r)
+{
+    return pow(l, r);
+}
+
+
+//////////////////////////////////////////
+// NativeCode Implementation
+//////////////////////////////////////////
+
+// copy the code into executable memory
+NativeCode::NativeCode(const std::vector<unsigned char> &code,
+                       const std::vector<FrameGuard> &guards) : _guards(guards)
+{
+    _size = code.size();
+    _mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(_mem == MAP_FAILED) {
+        throw std::runtime_error("Could not map memory for native code");
+    }
+    memcpy(_mem, code.data(), _size);
+
+    // never writable and executable at the same time
+    if(mprotect(_mem, _size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(_mem, _size);
+        throw std::runtime_error("Could not make native code executable");
+    }
+}
+
+
+NativeCode::~NativeCode()
+{
+    munmap(_mem, _size);
+}
+
+
+// do the locals of the current frame have the types the code assumes
+bool NativeCode::fits() const
+{
+    for(const FrameGuard &guard : _guards) {
+        const Result &local = frames.fp[guard.slot];
+        if(local.type() != guard.type or
+           (guard.type == ARRAY and (local.element_type() != guard.element or
+                                     array_rank(local.ptr()) != guard.rank))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// run the code, rethrowing any error from a called out statement
+void NativeCode::run()
+{
+    int (*fn)() = (int (*)()) _mem;
+    if(fn()) {
+        std::exception_ptr e = pending;
+        pending = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+
+//////////////////////////////////////////
+// x86-64 Code Generation
+//////////////////////////////////////////
+
+// the registers we use, numbered as in the encoding
+enum Reg { RAX=0, RCX=1, RDX=2, RBP=5, RSI=6, RDI=7 };
+enum XReg { XMM0=0, XMM1=1 };
+
+// offsets of the payloads native code touches in a Result; a boxed int is
+// its low 48 bits, written with a 32 and a 16 bit store to keep the tag,
+// while the elements of an integer array are whole 64 bit integers
+static const int32_t OFF_INT = 0;
+static const int32_t OFF_REAL = 0;
+static const int32_t OFF_PTR = 0;
+
+// the offset of an array dimension from the elements
+static int32_t off_dim(int k)
+{
+    return -3 * (int32_t) sizeof(int64_t) - k * (int32_t) sizeof(int64_t);
+}
+
+// condition codes for jcc
+enum Cond
+{
+    JB=0x2, JAE=0x3, JE=0x4, JNE=0x5, JBE=0x6, JA=0x7,
+    JP=0xA, JL=0xC, JGE=0xD, JLE=0xE, JG=0xF
+};
+
+
+class Emitter
+{
+public:
+    Emitter();
+
+    // translate a loop, returning false if something went wrong
+    bool loop(IfStatement *loop);
+
+    // the finished code, and the frame types it assumes
+    const std::vector<unsigned char> &code() const;
+    const std::vector<FrameGuard> &guards() const;
+
+private:
+    // raw bytes
+    void emit(std::initializer_list<unsigned char> bytes);
+    void imm32(int32_t v);
+    void imm64(uint64_t v);
+
+    // instructions
+    void mov_imm(Reg r, const void *p);
+    void mov_imm(Reg r, int32_t v);
+    void mov_int(Reg r, int64_t v);
+    void load32(Reg dst, Reg base, int32_t disp);
+    void store32(Reg base, int32_t disp, Reg src);
+    void load64(Reg dst, Reg base, int32_t disp);
+    void loadsd(XReg dst, Reg base, int32_t disp);
+    void storesd(Reg base, int32_t disp, XReg src);
+    void load_int(Reg dst, Reg base, int32_t disp);
+    void store_int(Reg base, int32_t disp, Reg src);
+    void wrap(Reg r);
+    void lea(Reg dst, Reg base, int32_t disp);
+    void unbox(Reg r);
+    void push(Reg r);
+    void pop(Reg r);
+    void push_xmm0();
+    void pop_xmm1();
+    void call(const void *fn);
+    size_t jcc(Cond cc);
+    void jmp_to(size_t target);
+    void bind(size_t fixup);
+
+    // the address of a variable's storage, in the env or the frame
+    void address(Reg r, ParseTree *named);
+
+    // the element pointer of an array in rdx, moving the index from rax
+    // to rcx
+    void element_base(ParseTree *arr);
+
+    // element rcx of the array at rdx into rax, or from rax into it;
+    // reals are loaded into xmm0 and stored from xmm1
+    void load_element(ElementType element);
+    void store_element(ElementType element);
+
+    // multiply rax by a dimension of an index's array
+    void scale(ArrayIndex *index, int k);
+
+    // the row-major offset of the first n indices of an element in rax;
+    // an inner index outside its dimension leaves with an error, or for
+    // a row computed before a loop, jumps to the outside fixups
+    void offset(ArrayIndex *index, int n, std::vector<size_t> *outside = nullptr);
+
+    // check index k of an element, in rcx, against its dimension
+    void check_dim(ArrayIndex *index, int k, std::vector<size_t> *outside = nullptr);
+
+    // a spill slot below the saved registers, as a displacement from rbp
+    int32_t spill();
+
+    // a while loop, computing the rows which do not change in it once
+    bool loop_rows(IfStatement *loop, const std::vector<ArrayIndex*> &rows);
+
+    // the live value of a variable at loop entry, nullptr if undeclared
+    Result *live(ParseTree *named);
+
+    // the static type of an expression, VOID if it cannot be translated
+    ResultType type_of(ParseTree *tree);
+    ResultType var_type(ParseTree *named);
+    bool is_array(ParseTree *named);
+    bool is_map(ParseTree *named, ParseTree *key);
+    ResultType numbers(ParseTree *named);
+
+    // a map operation: the key is put in the first of two spill slots,
+    // and the runtime is called with the node, the map and the slots
+    int32_t map_key(ParseTree *map, ParseTree *key);
+    void map_call(const void *fn, ParseTree *op, ParseTree *map, int32_t io);
+
+    // reduce arrays into a spill slot, through the runtime
+    int32_t array_reduce(ArrayReduce *reduce);
+    int32_t array_count(ArrayCount *count);
+
+    // expressions: integers end in rax, reals in xmm0
+    void int_expr(ParseTree *tree);
+    void real_expr(ParseTree *tree);
+    void int_arith(ParseTree *tree);
+    void real_arith(ParseTree *tree);
+
+    // conditions jump to the returned fixups when false
+    bool cond(ConditionalOp *op, std::vector<size_t> &fixups);
+
+    // statements
+    void stmt(ParseTree *tree);
+    bool native_stmt(ParseTree *tree);
+    void callout(ParseTree *tree);
+
+    std::vector<unsigned char> _code;
+    std::vector<size_t> _exits;     // fixups for error exits
+    std::vector<FrameGuard> _guards;    // types of the locals used
+    int _pushed;                    // words pushed beyond the frame
+    int _slots;                     // spill slots in use
+    size_t _reserve;                // where the spill slots are reserved
+    std::map<ArrayIndex*, int32_t> _rows;   // spill slots of hoisted rows
+};
+
+
+Emitter::Emitter()
+{
+    _pushed = 0;
+    _slots = 0;
+    _reserve = 0;
+}
+
+
+const std::vector<unsigned char> &Emitter::code() const
+{
+    return _code;
+}
+
+
+const std::vector<FrameGuard> &Emitter::guards() const
+{
+    return _guards;
+}
+
+
+void Emitter::emit(std::initializer_list<unsigned char> bytes)
+{
+    _code.insert(_code.end(), bytes);
+}
+
+
+void Emitter::imm32(int32_t v)
+{
+    for(int i=0; i<4; i++) {
+        _code.push_back((v >> (8*i)) & 0xff);
+    }
+}
+
+
+void Emitter::imm64(uint64_t v)
+{
+    for(int i=0; i<8; i++) {
+        _code.push_back((v >> (8*i)) & 0xff);
+    }
+}
+
+
+// movabs r, imm64
+void Emitter::mov_imm(Reg r, const void *p)
+{
+    emit({0x48, (unsigned char) (0xB8 + r)});
+    imm64((uint64_t) p);
+}
+
+
+// mov r32, imm32
+void Emitter::mov_imm(Reg r, int32_t v)
+{
+    emit({(unsigned char) (0xB8 + r)});
+    imm32(v);
+}
+
+
+// an integer in r64, sign extended from 32 bits when that is enough
+void Emitter::mov_int(Reg r, int64_t v)
+{
+    if(v == (int32_t) v) {
+        emit({0x48, 0xC7, (unsigned char) (0xC0 | r)});  // mov r64, simm32
+        imm32((int32_t) v);
+    } else {
+        emit({0x48, (unsigned char) (0xB8 + r)});        // movabs r64, imm64
+        imm64((uint64_t) v);
+    }
+}
+
+
+// mov r32, [base+disp32]
+void Emitter::load32(Reg dst, Reg base, int32_t disp)
+{
+    emit({0x8B, (unsigned char) (0x80 | dst << 3 | base)});
+    imm32(disp);
+}
+
+
+// mov [base+disp32], r32
+void Emitter::store32(Reg base, int32_t disp, Reg src)
+{
+    emit({0x89, (unsigned char) (0x80 | src << 3 | base)});
+    imm32(disp);
+}
+
+
+// mov r64, [base+disp32]
+void Emitter::load64(Reg dst, Reg base, int32_t disp)
+{
+    emit({0x48, 0x8B, (unsigned char) (0x80 | dst << 3 | base)});
+    imm32(disp);
+}
+
+
+// movsd xmm, [base+disp32]
+void Emitter::loadsd(XReg dst, Reg base, int32_t disp)
+{
+    emit({0xF2, 0x0F, 0x10, (unsigned char) (0x80 | dst << 3 | base)});
+    imm32(disp);
+}
+
+
+// movsd [base+disp32], xmm
+void Emitter::storesd(Reg base, int32_t disp, XReg src)
+{
+    emit({0xF2, 0x0F, 0x11, (unsigned char) (0x80 | src << 3 | base)});
+    imm32(disp);
+}
+
+
+// a boxed integer into r64, sign extended from its 48 bits
+void Emitter::load_int(Reg dst, Reg base, int32_t disp)
+{
+    load64(dst, base, disp);
+    wrap(dst);
+}
+
+
+// the low 48 bits of r64 into a boxed integer, leaving its tag; r is
+// shifted down by 32
+void Emitter::store_int(Reg base, int32_t disp, Reg src)
+{
+    store32(base, disp, src);
+    emit({0x48, 0xC1, (unsigned char) (0xE8 | src), 0x20});     // shr r64, 32
+    emit({0x66, 0x89, (unsigned char) (0x80 | src << 3 | base)}); // mov [base+disp32+4], r16
+    imm32(disp + 4);
+}
+
+
+// sign extend the low 48 bits of r64, integer results wrap there
+void Emitter::wrap(Reg r)
+{
+    emit({0x48, 0xC1, (unsigned char) (0xE0 | r), 64 - INT_BITS});  // shl r64, 16
+    emit({0x48, 0xC1, (unsigned char) (0xF8 | r), 64 - INT_BITS});  // sar r64, 16
+}
+
+
+// lea r64, [base+disp32]
+void Emitter::lea(Reg dst, Reg base, int32_t disp)
+{
+    emit({0x48, 0x8D, (unsigned char) (0x80 | dst << 3 | base)});
+    imm32(disp);
+}
+
+
+// strip the tag and element type off a boxed pointer in r
+void Emitter::unbox(Reg r)
+{
+    emit({0x48, 0x21, (unsigned char) (0xD8 | r)});        // and r, rbx
+}
+
+
+void Emitter::push(Reg r)
+{
+    emit({(unsigned char) (0x50 + r)});
+    _pushed++;
+}
+
+
+void Emitter::pop(Reg r)
+{
+    emit({(unsigned char) (0x58 + r)});
+    _pushed--;
+}
+
+
+// sub rsp, 8; movsd [rsp], xmm0
+void Emitter::push_xmm0()
+{
+    emit({0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24});
+    _pushed++;
+}
+
+
+// movsd xmm1, [rsp]; add rsp, 8
+void Emitter::pop_xmm1()
+{
+    emit({0xF2, 0x0F, 0x10, 0x0C, 0x24, 0x48, 0x83, 0xC4, 0x08});
+    _pushed--;
+}
+
+
+// call a C function, keeping the stack 16 byte aligned
+void Emitter::call(const void *fn)
+{
+    bool pad = _pushed % 2;
+    if(pad) emit({0x48, 0x83, 0xEC, 0x08});
+    mov_imm(RAX, fn);
+    emit({0xFF, 0xD0});
+    if(pad) emit({0x48, 0x83, 0xC4, 0x08});
+}
+
+
+// jcc rel32, returning the position to patch
+size_t Emitter::jcc(Cond cc)
+{
+    emit({0x0F, (unsigned char) (0x80 | cc)});
+    imm32(0);
+    return _code.size() - 4;
+}
+
+
+// jmp rel32 to a known position
+void Emitter::jmp_to(size_t target)
+{
+    emit({0xE9});
+    imm32((int32_t) (target - (_code.size() + 4)));
+}
+
+
+// point a jump at the current position
+void Emitter::bind(size_t fixup)
+{
+    int32_t rel = (int32_t) (_code.size() - (fixup + 4));
+    memcpy(&_code[fixup], &rel, 4);
+}
+
+
+// the address of a variable's storage, in the env or the frame
+void Emitter::address(Reg r, ParseTree *named)
+{
+    if(named->slot() < 0) {
+        mov_imm(r, env.slot(named->token().lexeme));
+        return;
+    }
+
+    // locals move with the frame pointer, which is read on every use
+    mov_imm(r, &frames.fp);
+    load64(r, r, 0);
+    emit({0x48, 0x8D, (unsigned char) (0x80 | r << 3 | r)}); // lea r, [r+disp32]
+    imm32(named->slot() * (int32_t) sizeof(Result));
+}
+
+
+// the element pointer of an array in rdx, given the index in rax, which is
+// moved to rcx for the element access
+void Emitter::element_base(ParseTree *arr)
+{
+    emit({0x48, 0x89, 0xC1});          // mov rcx, rax
+    address(RDX, arr);
+    load64(RDX, RDX, OFF_PTR);
+    unbox(RDX);
+}
+
+
+// element rcx of the array at rdx into rax, sign extended, or xmm0 for
+// reals
+void Emitter::load_element(ElementType element)
+{
+    switch(element) {
+        case ELEMENT_INT8:
+            emit({0x48, 0x0F, 0xBE, 0x04, 0x0A}); // movsx rax, byte [rdx+rcx]
+            break;
+        case ELEMENT_INT16:
+            emit({0x48, 0x0F, 0xBF, 0x04, 0x4A}); // movsx rax, word [rdx+rcx*2]
+            break;
+        case ELEMENT_BIT:
+            emit({0x48, 0x0F, 0xA3, 0x0A});       // bt [rdx], rcx
+            emit({0x0F, 0x92, 0xC0});             // setc al
+            emit({0x0F, 0xB6, 0xC0});             // movzx eax, al
+            break;
+        case ELEMENT_REAL:
+            emit({0xF2, 0x0F, 0x10, 0x04, 0xCA}); // movsd xmm0, [rdx+rcx*8]
+            break;
+        default:
+            emit({0x48, 0x8B, 0x04, 0xCA});       // mov rax, [rdx+rcx*8]
+            break;
+    }
+}
+
+
+// rax, or xmm1 for reals, into element rcx of the array at rdx; integers
+// keep their low bits, and a bit is set by anything but zero
+void Emitter::store_element(ElementType element)
+{
+    switch(element) {
+        case ELEMENT_INT8:
+            emit({0x88, 0x04, 0x0A});             // mov [rdx+rcx], al
+            break;
+        case ELEMENT_INT16:
+            emit({0x66, 0x89, 0x04, 0x4A});       // mov [rdx+rcx*2], ax
+            break;
+        case ELEMENT_BIT:
+            emit({0x48, 0x0F, 0xB3, 0x0A});       // btr [rdx], rcx
+            emit({0x48, 0x85, 0xC0});             // test rax, rax
+            emit({0x74, 0x04});                   // jz over the bts
+            emit({0x48, 0x0F, 0xAB, 0x0A});       // bts [rdx], rcx
+            break;
+        case ELEMENT_REAL:
+            emit({0xF2, 0x0F, 0x11, 0x0C, 0xCA}); // movsd [rdx+rcx*8], xmm1
+            break;
+        default:
+            emit({0x48, 0x89, 0x04, 0xCA});       // mov [rdx+rcx*8], rax
+            break;
+    }
+}
+
+
+// multiply rax by a dimension of an index's array
+void Emitter::scale(ArrayIndex *index, int k)
+{
+    address(RDX, index);
+    load64(RDX, RDX, OFF_PTR);
+    unbox(RDX);
+    emit({0x48, 0x0F, 0xAF, 0x82});         // imul rax, [rdx+disp32]
+    imm32(off_dim(k));
+}
+
+
+// the row-major offset of the first n indices of an element in rax
+void Emitter::offset(ArrayIndex *index, int n, std::vector<size_t> *outside)
+{
+    int_expr(*index->begin());
+    for(int k = 1; k < n; k++) {
+        push(RAX);
+        int_expr(*(index->begin() + k));
+        emit({0x48, 0x89, 0xC1});           // mov rcx, rax
+        pop(RAX);
+        check_dim(index, k, outside);
+        push(RCX);
+        scale(index, k);
+        pop(RCX);
+        emit({0x48, 0x01, 0xC8});           // add rax, rcx
+    }
+}
+
+
+// index k of an element, in rcx, compared unsigned so that a negative
+// one is outside too; rax is kept
+void Emitter::check_dim(ArrayIndex *index, int k, std::vector<size_t> *outside)
+{
+    address(RDX, index);
+    load64(RDX, RDX, OFF_PTR);
+    unbox(RDX);
+    emit({0x48, 0x3B, 0x8A});               // cmp rcx, [rdx+disp32]
+    imm32(off_dim(k));
+    if(outside) {
+        outside->push_back(jcc(JAE));
+        return;
+    }
+
+    size_t inside = jcc(JB);
+    emit({0x48, 0x89, 0xCA});               // mov rdx, rcx
+    mov_imm(RSI, k);
+    mov_imm(RDI, index);
+    call((const void*) jit_outside);
+    emit({0x85, 0xC0});                     // test eax, eax
+    _exits.push_back(jcc(JNE));
+    bind(inside);
+}
+
+
+// a spill slot below the saved registers, as a displacement from rbp
+int32_t Emitter::spill()
+{
+    return -2 * (int32_t) sizeof(int64_t) - (int32_t) sizeof(int64_t) * _slots++;
+}
+
+
+//////////////////////////////////////////
+// Types
+//////////////////////////////////////////
+ResultType Emitter::type_of(ParseTree *tree)
+{
+    // types come from the live environment, which is settled by loop entry
+    if(dynamic_cast<Number*>(tree)) {
+        return tree->token() == INTLIT ? INTEGER : REAL;
+    } else if(dynamic_cast<Var*>(tree)) {
+        return var_type(tree);
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        // a map used before its declaration is read by the evaluator
+        if(type_of(access->right()) == VOID) return VOID;
+        return numbers(access->left());
+    } else if(ArrayIndex *index = dynamic_cast<ArrayIndex*>(tree)) {
+        // the indices must match the array's dimensions
+        if(not is_array(index) or array_rank(live(index)->ptr()) != index->rank()) return VOID;
+        for(auto itr = index->begin(); itr != index->end(); itr++) {
+            if(type_of(*itr) == VOID) return VOID;
+        }
+        return INTEGER;
+    } else if(ArrayLength *length = dynamic_cast<ArrayLength*>(tree)) {
+        return is_array(length->child()) ? INTEGER : VOID;
+    } else if(ArrayCount *count = dynamic_cast<ArrayCount*>(tree)) {
+        if(numbers(count->left()) == VOID) return VOID;
+        return not count->right() or type_of(count->right()) != VOID ? INTEGER : VOID;
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        // a dot product is real if either array is
+        ResultType type = numbers(reduce->left());
+        if(not reduce->right() or type == VOID) return type;
+        ResultType other = numbers(reduce->right());
+        if(other == VOID) return VOID;
+        return type == REAL or other == REAL ? REAL : INTEGER;
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        if(not is_map(get->left(), get->right())) return VOID;
+        return map_table(*live(get->left()))->value;
+    } else if(MapContains *contains = dynamic_cast<MapContains*>(tree)) {
+        return is_map(contains->left(), contains->right()) ? INTEGER : VOID;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return type_of(neg->child());
+    } else if(dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or
+              dynamic_cast<Mul*>(tree) or dynamic_cast<Div*>(tree) or
+              dynamic_cast<Pow*>(tree)) {
+        BinaryOp *op = static_cast<BinaryOp*>(tree);
+        ResultType l = type_of(op->left());
+        ResultType r = type_of(op->right());
+        if(l == VOID or r == VOID) return VOID;
+        return l == r ? l : REAL;
+    }
+    return VOID;
+}
+
+
+// the type of a scalar variable, VOID if it is not a declared number
+// the live value of a variable at loop entry, nullptr if undeclared
+Result *Emitter::live(ParseTree *named)
+{
+    std::string name = named->token().lexeme;
+    if(named->slot() < 0) {
+        return env.exists(name) ? &env[name] : nullptr;
+    }
+
+    // a local may have another type in the next call, so it is guarded
+    Result *local = &frames.fp[named->slot()];
+    if(local->type() == VOID) return nullptr;
+    for(const FrameGuard &guard : _guards) {
+        if(guard.slot == named->slot()) return local;
+    }
+    bool array = local->type() == ARRAY;
+    _guards.push_back({named->slot(), local->type(),
+                       array ? local->element_type() : ELEMENT_INT64,
+                       array ? array_rank(local->ptr()) : 0});
+    return local;
+}
+
+
+ResultType Emitter::var_type(ParseTree *named)
+{
+    Result *value = live(named);
+    if(not value) return VOID;
+    return value->type() == INTEGER or value->type() == REAL ? value->type() : VOID;
+}
+
+
+bool Emitter::is_array(ParseTree *named)
+{
+    Result *value = live(named);
+    return value and value->type() == ARRAY;
+}
+
+
+// the value type of the elements of an array of numbers, VOID if a
+// name does not hold one
+ResultType Emitter::numbers(ParseTree *named)
+{
+    if(not is_array(named)) return VOID;
+    ElementType element = live(named)->element_type();
+    return element == ELEMENT_MAP ? VOID : value_of(element);
+}
+
+
+// true if a name holds a map a key can be looked up in natively; the
+// evaluator reports real keys of integer maps
+bool Emitter::is_map(ParseTree *named, ParseTree *key)
+{
+    Result *value = live(named);
+    if(not value or value->type() != ARRAY or value->element_type() != ELEMENT_MAP) {
+        return false;
+    }
+    ResultType type = type_of(key);
+    return type == INTEGER or (type == REAL and map_table(*value)->key == REAL);
+}
+
+
+//////////////////////////////////////////
+// Maps
+//////////////////////////////////////////
+int32_t Emitter::map_key(ParseTree *map, ParseTree *key)
+{
+    // the value's slot is allocated first, so it is above the key's
+    spill();
+    int32_t io = spill();
+    if(map_table(*live(map))->key == INTEGER) {
+        int_expr(key);
+        emit({0x48, 0x89, 0x85});           // mov [rbp+disp32], rax
+        imm32(io);
+    } else {
+        real_expr(key);
+        storesd(RBP, io, XMM0);
+    }
+    return io;
+}
+
+
+void Emitter::map_call(const void *fn, ParseTree *op, ParseTree *map, int32_t io)
+{
+    lea(RDX, RBP, io);
+    address(RSI, map);
+    mov_imm(RDI, op);
+    call(fn);
+    emit({0x85, 0xC0});                     // test eax, eax
+    _exits.push_back(jcc(JNE));
+}
+
+
+int32_t Emitter::array_reduce(ArrayReduce *reduce)
+{
+    int32_t io = spill();
+    lea(RCX, RBP, io);
+    address(RDX, reduce->right() ? reduce->right() : reduce->left());
+    address(RSI, reduce->left());
+    mov_imm(RDI, reduce);
+    call((const void*) jit_reduce);
+    emit({0x85, 0xC0});                     // test eax, eax
+    _exits.push_back(jcc(JNE));
+    return io;
+}
+
+
+int32_t Emitter::array_count(ArrayCount *count)
+{
+    // a number to count is passed as a real
+    if(count->right()) real_expr(count->right());
+    int32_t io = spill();
+    lea(RDX, RBP, io);
+    address(RSI, count->left());
+    mov_imm(RDI, count);
+    call(count->right() ? (const void*) jit_count_value : (const void*) jit_count);
+    emit({0x85, 0xC0});                     // test eax, eax
+    _exits.push_back(jcc(JNE));
+    return io;
+}
+
+
+//////////////////////////////////////////
+// Expressions
+//////////////////////////////////////////
+void Emitter::int_expr(ParseTree *tree)
+{
+    if(type_of(tree) == REAL) {
+        real_expr(tree);
+        emit({0xF2, 0x48, 0x0F, 0x2C, 0xC0}); // cvttsd2si rax, xmm0
+        wrap(RAX);
+        return;
+    }
+
+    if(dynamic_cast<Number*>(tree)) {
+        mov_int(RAX, tree->eval().i());
+    } else if(dynamic_cast<Var*>(tree)) {
+        address(RAX, tree);
+        load_int(RAX, RAX, OFF_INT);
+    } else if(ArrayIndex *index = dynamic_cast<ArrayIndex*>(tree)) {
+        auto row = _rows.find(index);
+        if(row == _rows.end()) {
+            offset(index, index->rank());
+        } else {
+            // the row was computed when the loop started, unless one of
+            // its leading indices was outside its dimension
+            size_t done = 0;
+            if(index->rank() > 2) {
+                emit({0x48, 0x83, 0xBD});   // cmp qword [rbp+disp32], OUTSIDE_ROW
+                imm32(row->second);
+                emit({(unsigned char) OUTSIDE_ROW});
+                size_t hoisted = jcc(JNE);
+                offset(index, index->rank());
+                emit({0xE9});               // jmp done
+                imm32(0);
+                done = _code.size() - 4;
+                bind(hoisted);
+            }
+            int_expr(*(index->end() - 1));
+            emit({0x48, 0x89, 0xC1});       // mov rcx, rax
+            check_dim(index, index->rank() - 1);
+            emit({0x48, 0x03, 0x85});       // add rax, [rbp+disp32]
+            imm32(row->second);
+            if(done) bind(done);
+        }
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        int_expr(access->right());
+        element_base(access->left());
+        load_element(live(access->left())->element_type());
+    } else if(ArrayLength *length = dynamic_cast<ArrayLength*>(tree)) {
+        address(RDX, length->child());
+        load64(RDX, RDX, OFF_PTR);
+        unbox(RDX);
+        emit({0x48, 0x8B, 0x42, 0xF8});     // mov rax, [rdx-8]
+    } else if(ArrayCount *count = dynamic_cast<ArrayCount*>(tree)) {
+        int32_t io = array_count(count);
+        load64(RAX, RBP, io);
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        int32_t io = array_reduce(reduce);
+        load64(RAX, RBP, io);
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        int32_t io = map_key(get->left(), get->right());
+        map_call((const void*) jit_map_get, get, get->left(), io);
+        load64(RAX, RBP, io + (int32_t) sizeof(int64_t));
+    } else if(MapContains *contains = dynamic_cast<MapContains*>(tree)) {
+        int32_t io = map_key(contains->left(), contains->right());
+        map_call((const void*) jit_map_contains, contains, contains->left(), io);
+        load64(RAX, RBP, io + (int32_t) sizeof(int64_t));
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        int_expr(neg->child());
+        emit({0x48, 0xF7, 0xD8});           // neg rax
+        wrap(RAX);
+    } else {
+        int_arith(tree);
+    }
+}
+
+
+void Emitter::int_arith(ParseTree *tree)
+{
+    BinaryOp *op = static_cast<BinaryOp*>(tree);
+
+    // right goes on the stack, left ends up in rax and right in rcx
+    int_expr(op->right());
+    push(RAX);
+    int_expr(op->left());
+    pop(RCX);
+
+    if(dynamic_cast<Add*>(tree)) {
+        emit({0x48, 0x01, 0xC8});           // add rax, rcx
+    } else if(dynamic_cast<Sub*>(tree)) {
+        emit({0x48, 0x29, 0xC8});           // sub rax, rcx
+    } else if(dynamic_cast<Mul*>(tree)) {
+        emit({0x48, 0x0F, 0xAF, 0xC1});     // imul rax, rcx
+    } else if(dynamic_cast<Div*>(tree)) {
+        // a zero divisor leaves with an error rather than trapping
+        emit({0x48, 0x85, 0xC9});           // test rcx, rcx
+        size_t nonzero = jcc(JNE);
+        call((const void*) jit_div_zero);
+        emit({0x85, 0xC0});                 // test eax, eax
+        _exits.push_back(jcc(JNE));
+        bind(nonzero);
+        emit({0x48, 0x99, 0x48, 0xF7, 0xF9}); // cqo; idiv rcx
+    } else {
+        emit({0x48, 0x89, 0xC7});           // mov rdi, rax
+        emit({0x48, 0x89, 0xCE});           // mov rsi, rcx
+        call((const void*) jit_pow_int);
+    }
+    wrap(RAX);
+}
+
+
+void Emitter::real_expr(ParseTree *tree)
+{
+    if(type_of(tree) == INTEGER) {
+        int_expr(tree);
+        emit({0xF2, 0x48, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, rax
+        return;
+    }
+
+    if(dynamic_cast<Number*>(tree)) {
+        double v = tree->eval().r();
+        uint64_t bits;
+        memcpy(&bits, &v, 8);
+        emit({0x48, 0xB8});                 // movabs rax, bits
+        imm64(bits);
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC0}); // movq xmm0, rax
+    } else if(dynamic_cast<Var*>(tree)) {
+        address(RAX, tree);
+        loadsd(XMM0, RAX, OFF_REAL);
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        int_expr(access->right());
+        element_base(access->left());
+        load_element(ELEMENT_REAL);
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        int32_t io = map_key(get->left(), get->right());
+        map_call((const void*) jit_map_get, get, get->left(), io);
+        loadsd(XMM0, RBP, io + (int32_t) sizeof(int64_t));
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        int32_t io = array_reduce(reduce);
+        loadsd(XMM0, RBP, io);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        real_expr(neg->child());
+        emit({0x48, 0xB8});                 // movabs rax, sign bit
+        imm64(0x8000000000000000ull);
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC8}); // movq xmm1, rax
+        emit({0x66, 0x0F, 0x57, 0xC1});     // xorpd xmm0, xmm1
+    } else {
+        real_arith(tree);
+    }
+}
+
+
+void Emitter::real_arith(ParseTree *tree)
+{
+    BinaryOp *op = static_cast<BinaryOp*>(tree);
+
+    // right goes on the stack, left ends up in xmm0 and right in xmm1
+    real_expr(op->right());
+    push_xmm0();
+    real_expr(op->left());
+    pop_xmm1();
+
+    if(dynamic_cast<Add*>(tree)) {
+        emit({0xF2, 0x0F, 0x58, 0xC1});     // addsd xmm0, xmm1
+    } else if(dynamic_cast<Sub*>(tree)) {
+        emit({0xF2, 0x0F, 0x5C, 0xC1});     // subsd xmm0, xmm1
+    } else if(dynamic_cast<Mul*>(tree)) {
+        emit({0xF2, 0x0F, 0x59, 0xC1});     // mulsd xmm0, xmm1
+    } else if(dynamic_cast<Div*>(tree)) {
+        emit({0xF2, 0x0F, 0x5E, 0xC1});     // divsd xmm0, xmm1
+    } else {
+        call((const void*) jit_pow);
+    }
+}
+
+
+// conditions jump to the returned fixups when false
+bool Emitter::cond(ConditionalOp *op, std::vector<size_t> &fixups)
+{
+    ResultType l = type_of(op->left());
+    ResultType r = type_of(op->right());
+    if(l == VOID or r == VOID) return false;
+
+    if(l == INTEGER and r == INTEGER) {
+        int_expr(op->right());
+        push(RAX);
+        int_expr(op->left());
+        pop(RCX);
+        emit({0x48, 0x39, 0xC8});           // cmp rax, rcx
+        switch(op->op()) {
+            case CMP_LT: fixups.push_back(jcc(JGE)); break;
+            case CMP_GT: fixups.push_back(jcc(JLE)); break;
+            case CMP_EQ: fixups.push_back(jcc(JNE)); break;
+            case CMP_NE: fixups.push_back(jcc(JE)); break;
+        }
+        return true;
+    }
+
+    real_expr(op->right());
+    push_xmm0();
+    real_expr(op->left());
+    pop_xmm1();
+    emit({0x66, 0x0F, 0x2E, 0xC1});         // ucomisd xmm0, xmm1
+
+    // unordered compares (NaN) are only ever not-equal
+    switch(op->op()) {
+        case CMP_LT:
+            fixups.push_back(jcc(JP));
+            fixups.push_back(jcc(JAE));
+            break;
+        case CMP_GT:
+            fixups.push_back(jcc(JBE));
+            break;
+        case CMP_EQ:
+            fixups.push_back(jcc(JP));
+            fixups.push_back(jcc(JNE));
+            break;
+        case CMP_NE: {
+            size_t unordered = jcc(JP);
+            fixups.push_back(jcc(JE));
+            bind(unordered);
+            break;
+        }
+    }
+    return true;
+}
+
+
+//////////////////////////////////////////
+// Statements
+//////////////////////////////////////////
+
+// translate a loop, returning false if something went wrong
+bool Emitter::loop(IfStatement *loop)
+{
+    emit({0x55});                           // push rbp
+    emit({0x48, 0x89, 0xE5});               // mov rbp, rsp
+
+    // rbx holds the pointer mask for the whole loop, the stack stays
+    // 16 byte aligned
+    emit({0x53});                           // push rbx
+    emit({0x48, 0x81, 0xEC});               // sub rsp, imm32
+    _reserve = _code.size();
+    imm32(0);
+    emit({0x48, 0xBB});                     // movabs rbx, mask
+    imm64(Result::PTR_MASK);
+
+    if(not native_stmt(loop) or _pushed != 0) return false;
+
+    // reserve the spill slots, an odd number of words keeps the stack aligned
+    int32_t reserve = sizeof(int64_t) + 2 * sizeof(int64_t) * (_slots / 2);
+    memcpy(&_code[_reserve], &reserve, 4);
+
+    // normal exit returns 0
+    emit({0x31, 0xC0});                     // xor eax, eax
+    for(size_t fixup : _exits) {
+        bind(fixup);
+    }
+    emit({0x48, 0x8D, 0x65, 0xF8});         // lea rsp, [rbp-8]
+    emit({0x5B, 0x5D, 0xC3});               // pop rbx; pop rbp; ret
+    return true;
+}
+
+
+void Emitter::stmt(ParseTree *tree)
+{
+    if(not native_stmt(tree)) {
+        callout(tree);
+    }
+}
+
+
+// call the evaluator for a statement, leaving with 1 if it fails
+void Emitter::callout(ParseTree *tree)
+{
+    emit({0x48, 0xBF});                     // movabs rdi, tree
+    imm64((uint64_t) tree);
+    call((const void*) jit_eval);
+    emit({0x85, 0xC0});                     // test eax, eax
+    _exits.push_back(jcc(JNE));
+}
+
+
+bool Emitter::native_stmt(ParseTree *tree)
+{
+    if(dynamic_cast<Program*>(tree) or dynamic_cast<Statementblock*>(tree)) {
+        NaryOp *block = static_cast<NaryOp*>(tree);
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            stmt(*itr);
+        }
+        return true;
+    } else if(IfStatement *ifs = dynamic_cast<IfStatement*>(tree)) {
+        std::vector<ArrayIndex*> rows;
+        for(ArrayIndex *index : invariant_rows(ifs)) {
+            if(type_of(index) == INTEGER) rows.push_back(index);
+        }
+        if(not rows.empty()) return loop_rows(ifs, rows);
+
+        std::vector<size_t> fixups;
+        size_t top = _code.size();
+        size_t exits = _exits.size();
+        if(ifs->vectorizable()) {
+            // a loop the array kernels ran is skipped
+            mov_imm(RDI, ifs);
+            call((const void*) jit_vectorize);
+            emit({0x83, 0xF8, 0x01});       // cmp eax, 1
+            _exits.push_back(jcc(JE));
+            emit({0x85, 0xC0});             // test eax, eax
+            fixups.push_back(jcc(JE));
+        }
+        if(not cond(static_cast<ConditionalOp*>(ifs->left()), fixups)) {
+            _code.resize(top);
+            _exits.resize(exits);
+            return false;
+        }
+        stmt(ifs->right());
+        if(ifs->token() == WHILE) {
+            jmp_to(top);
+        }
+        for(size_t fixup : fixups) {
+            bind(fixup);
+        }
+        return true;
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        ResultType type = var_type(assign->left());
+        if(type == VOID or type_of(assign->right()) == VOID) return false;
+
+        if(type == INTEGER) {
+            int_expr(assign->right());
+            address(RCX, assign->left());
+            store_int(RCX, OFF_INT, RAX);
+        } else {
+            real_expr(assign->right());
+            address(RCX, assign->left());
+            storesd(RCX, OFF_REAL, XMM0);
+        }
+        return true;
+    } else if(IncrementVar *inc = dynamic_cast<IncrementVar*>(tree)) {
+        Result step = inc->step();
+        if(var_type(inc->child()) != INTEGER or step.type() != INTEGER) return false;
+
+        // the step is added to the sign extended value, so it wraps at 48 bits
+        if(step.i() != (int32_t) step.i()) return false;
+        address(RCX, inc->child());
+        load_int(RAX, RCX, OFF_INT);
+        emit({0x48, 0x05});                 // add rax, simm32
+        imm32((int32_t) step.i());
+        wrap(RAX);
+        store_int(RCX, OFF_INT, RAX);
+        return true;
+    } else if(ArrayLoad *load = dynamic_cast<ArrayLoad*>(tree)) {
+        ResultType type = var_type(load);
+        if(type == VOID or numbers(load->left()) == VOID or type_of(load->right()) == VOID) {
+            return false;
+        }
+
+        int_expr(load->right());
+        element_base(load->left());
+        ElementType element = live(load->left())->element_type();
+        load_element(element);
+        if(element != ELEMENT_REAL) {
+            if(type == REAL) emit({0xF2, 0x48, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, rax
+        } else {
+            if(type == INTEGER) {
+                emit({0xF2, 0x48, 0x0F, 0x2C, 0xC0}); // cvttsd2si rax, xmm0
+                wrap(RAX);
+            }
+        }
+        address(RCX, load);
+        if(type == INTEGER) {
+            store_int(RCX, OFF_INT, RAX);
+        } else {
+            storesd(RCX, OFF_REAL, XMM0);
+        }
+        return true;
+    } else if(ArrayAssign *assign = dynamic_cast<ArrayAssign*>(tree)) {
+        ResultType type = type_of(assign->right());
+        if(numbers(assign) == VOID or type == VOID or type_of(assign->left()) == VOID) {
+            return false;
+        }
+
+        // mismatched element types are reported by the evaluator
+        ElementType element = live(assign)->element_type();
+        if(value_of(element) != type) return false;
+
+        // the value is computed before the index, as in the evaluator
+        if(type == INTEGER) {
+            int_expr(assign->right());
+            push(RAX);
+            int_expr(assign->left());
+            element_base(assign);
+            pop(RAX);
+        } else {
+            real_expr(assign->right());
+            push_xmm0();
+            int_expr(assign->left());
+            element_base(assign);
+            pop_xmm1();
+        }
+        store_element(element);
+        return true;
+    } else if(ArrayAppend *append = dynamic_cast<ArrayAppend*>(tree)) {
+        ResultType type = type_of(append->right());
+        if(not is_array(append->left()) or type == VOID) return false;
+
+        // mismatched element types are reported by the evaluator, and the
+        // array may move so the runtime updates its slot
+        if(value_of(live(append->left())->element_type()) != type) return false;
+        if(type == INTEGER) {
+            int_expr(append->right());
+            emit({0x48, 0x89, 0xC2});       // mov rdx, rax
+        } else {
+            real_expr(append->right());
+        }
+        address(RSI, append->left());
+        mov_imm(RDI, append);
+        call(type == INTEGER ? (const void*) jit_append_int : (const void*) jit_append_real);
+        emit({0x85, 0xC0});                 // test eax, eax
+        _exits.push_back(jcc(JNE));
+        return true;
+    } else if(MapPut *put = dynamic_cast<MapPut*>(tree)) {
+        MapGet *at = static_cast<MapGet*>(put->left());
+        ResultType type = type_of(put->right());
+        if(not is_map(at->left(), at->right()) or type == VOID) return false;
+
+        // mismatched value types are reported by the evaluator; the value
+        // is computed first, and kept on the stack until the key's slot
+        // is known
+        if(map_table(*live(at->left()))->value != type) return false;
+        if(type == INTEGER) {
+            int_expr(put->right());
+            push(RAX);
+        } else {
+            real_expr(put->right());
+            push_xmm0();
+        }
+        int32_t io = map_key(at->left(), at->right());
+        pop(RAX);
+        emit({0x48, 0x89, 0x85});           // mov [rbp+disp32], rax
+        imm32(io + (int32_t) sizeof(int64_t));
+        map_call((const void*) jit_map_put, put, at->left(), io);
+        return true;
+    } else if(ArraySwap *swap = dynamic_cast<ArraySwap*>(tree)) {
+        ParseTree *temp = *swap->begin();
+        ParseTree *i = *(swap->begin() + 1);
+        ParseTree *j = *(swap->begin() + 2);
+        if(not is_array(swap) or type_of(i) == VOID or type_of(j) == VOID) {
+            return false;
+        }
+
+        // a temp of the other element type is reported by the evaluator,
+        // and compact elements are swapped there too
+        ResultType type = var_type(temp);
+        ElementType element = live(swap)->element_type();
+        if(type == VOID or value_of(element) != type) return false;
+        if(element != ELEMENT_INT64 and element != ELEMENT_REAL) return false;
+
+        int_expr(i);
+        push(RAX);
+        int_expr(j);
+        emit({0x48, 0x89, 0xC1});           // mov rcx, rax
+        pop(RAX);
+        address(RDX, swap);
+        load64(RDX, RDX, OFF_PTR);
+        unbox(RDX);
+        emit({0x48, 0x8B, 0x34, 0xC2});     // mov rsi, [rdx+rax*8]
+        emit({0x48, 0x8B, 0x3C, 0xCA});     // mov rdi, [rdx+rcx*8]
+        emit({0x48, 0x89, 0x3C, 0xC2});     // mov [rdx+rax*8], rdi
+        emit({0x48, 0x89, 0x34, 0xCA});     // mov [rdx+rcx*8], rsi
+
+        // the temp is left holding the old a[i], a real is moved whole
+        address(RAX, temp);
+        if(type == INTEGER) {
+            store_int(RAX, OFF_INT, RSI);
+        } else {
+            emit({0x48, 0x89, 0xB0});       // mov [rax+disp32], rsi
+            imm32(OFF_REAL);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+// a while loop, computing the rows which do not change in it once it is
+// known to run: the condition is tested before the rows and again at
+// the bottom of each pass
+bool Emitter::loop_rows(IfStatement *loop, const std::vector<ArrayIndex*> &rows)
+{
+    std::vector<size_t> fixups;
+    size_t top = _code.size();
+    ConditionalOp *test = static_cast<ConditionalOp*>(loop->left());
+    if(not cond(test, fixups)) {
+        _code.resize(top);
+        return false;
+    }
+
+    for(ArrayIndex *index : rows) {
+        // a leading index outside its dimension is reported by an access
+        // to the row, if one runs
+        std::vector<size_t> outside;
+        offset(index, index->rank() - 1, &outside);
+        scale(index, index->rank() - 1);
+        if(not outside.empty()) {
+            emit({0xE9});                   // jmp over
+            imm32(0);
+            size_t over = _code.size() - 4;
+            for(size_t fixup : outside) {
+                bind(fixup);
+            }
+            mov_int(RAX, OUTSIDE_ROW);
+            bind(over);
+        }
+        int32_t slot = spill();
+        emit({0x48, 0x89, 0x85});           // mov [rbp+disp32], rax
+        imm32(slot);
+        _rows[index] = slot;
+    }
+
+    size_t body = _code.size();
+    stmt(loop->right());
+    cond(test, fixups);
+    jmp_to(body);
+    for(size_t fixup : fixups) {
+        bind(fixup);
+    }
+    return true;
+}
+
+
+//////////////////////////////////////////
+// JitCompiler Implementation
+//////////////////////////////////////////
+
+// constructor and destructor
+JitCompiler::JitCompiler()
+{
+    // nothing to do
+}
+
+
+JitCompiler::~JitCompiler()
+{
+    for(NativeCode *code : _code) {
+        delete code;
+    }
+}
+
+
+// while loops are compiled to native code on first entry
+Stmt JitCompiler::compile_if(IfStatement *ifs)
+{
+    // loops the array kernels run stay closures, for the few whose
+    // values the kernels decline
+    Stmt interpreted = ClosureCompiler::compile_if(ifs);
+    if(ifs->token() != WHILE or ifs->vectorizable()) {
+        return interpreted;
+    }
+
+    // the native code is shared between copies of the closure
+    auto native = std::make_shared<NativeCode*>(nullptr);
+    auto tried = std::make_shared<bool>(false);
+    return [this, ifs, interpreted, native, tried]() {
+        if(not *tried) {
+            *tried = true;
+            *native = translate(ifs);
+        }
+
+        if(*native and (*native)->fits()) {
+            (*native)->run();
+        } else {
+            interpreted();
+        }
+    };
+}
+
+
+// translate a loop, returning nullptr if it cannot be done
+NativeCode *JitCompiler::translate(IfStatement *loop)
+{
+    Emitter emitter;
+    if(not emitter.loop(loop)) {
+        return nullptr;
+    }
+
+    NativeCode *code = new NativeCode(emitter.code(), emitter.guards());
+    _code.push_back(code);
+    return code;
+}
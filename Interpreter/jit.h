@@ -0,0 +1,59 @@
+// This file contains the baseline x86-64 JIT. It extends the closure
+// compiler: each while loop is translated into native code the first
+// time it runs, when the types of its variables are known. Statements
+// the JIT cannot translate are called out to the evaluator. Loops over
+// method locals are checked against the frame each time they start.
+#ifndef JIT_H
+#define JIT_H
+#include <vector>
+#include "closure.h"
+
+// a frame slot type native code is translated under
+struct FrameGuard
+{
+    int slot;
+    ResultType type;
+    ElementType element;    // for arrays
+    int rank;
+};
+
+
+// a block of executable machine code
+class NativeCode
+{
+public:
+    // copy the code into executable memory
+    NativeCode(const std::vector<unsigned char> &code, const std::vector<FrameGuard> &guards);
+    virtual ~NativeCode();
+
+    // do the locals of the current frame have the types the code assumes
+    virtual bool fits() const;
+
+    // run the code, rethrowing any error from a called out statement
+    virtual void run();
+
+private:
+    void *_mem;
+    size_t _size;
+    std::vector<FrameGuard> _guards;
+};
+
+
+class JitCompiler : public ClosureCompiler
+{
+public:
+    // constructor and destructor
+    JitCompiler();
+    virtual ~JitCompiler();
+
+protected:
+    // while loops are compiled to native code on first entry
+    virtual Stmt compile_if(IfStatement *ifs);
+
+    // translate a loop, returning nullptr if it cannot be done
+    virtual NativeCode *translate(IfStatement *loop);
+
+private:
+    std::vector<NativeCode*> _code;
+};
+#endif
@@ -22,6 +22,9 @@ const char* TSTR[] = {
     "IDENTIFIER",
     "INTEGER",
     "REAL",
+    "BYTE",
+    "SHORT",
+    "BOOL",
     "EQUAL",
     "RECORD",
     "END",
@@ -372,6 +375,12 @@ bool Lexer::lex_kw_id()
         _curtok.token = INTEGER_DECL;
     } else if(_curtok.lexeme == "real") {
         _curtok.token = REAL_DECL;
+    } else if(_curtok.lexeme == "byte") {
+        _curtok.token = BYTE_DECL;
+    } else if(_curtok.lexeme == "short") {
+        _curtok.token = SHORT_DECL;
+    } else if(_curtok.lexeme == "bool") {
+        _curtok.token = BOOL_DECL;
     } else if(_curtok.lexeme == "record") {
         _curtok.token = RECORD;
     } else if(_curtok.lexeme == "end") {
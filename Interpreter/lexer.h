@@ -24,6 +24,9 @@ enum Token
     IDENTIFIER,
     INTEGER_DECL,
     REAL_DECL,
+    BYTE_DECL,
+    SHORT_DECL,
+    BOOL_DECL,
     EQUAL,
     RECORD,
     END,
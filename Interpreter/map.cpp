@@ -0,0 +1,205 @@
+#include <cstring>
+#include <emmintrin.h>
+#include "gc.h"
+#include "map.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// keys are equal when their bits are, reals are normalized before they
+// get here
+static inline uint64_t bits(const Result &key)
+{
+    uint64_t b;
+    memcpy(&b, &key, sizeof b);
+    return b;
+}
+
+
+// mix the bits of a key, the low 7 go in its control byte and the rest
+// pick the first group it probes
+static inline uint64_t hash(const Result &key)
+{
+    uint64_t h = bits(key);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+
+// the slots of a group with a control byte, one bit each
+static inline uint32_t match(const int8_t *group, int8_t c)
+{
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+}
+
+
+// the slots of a group which are empty or deleted, the only control
+// bytes with their top bit set
+static inline uint32_t match_free(const int8_t *group)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+}
+
+
+// the slot of a key, -1 if it is not there; groups are probed in
+// triangular steps, which visits all of them
+static int64_t find(MapTable *t, const Result &key)
+{
+    uint64_t h = hash(key);
+    int64_t groups = t->capacity / MAP_GROUP;
+    int64_t g = (h >> 7) & (groups - 1);
+    for(int64_t step = 1; ; step++) {
+        const int8_t *group = t->ctrl() + g * MAP_GROUP;
+        for(uint32_t m = match(group, h & 0x7F); m; m &= m - 1) {
+            int64_t i = g * MAP_GROUP + __builtin_ctz(m);
+            if(bits(t->slots()[i].key) == bits(key)) return i;
+        }
+
+        // an empty slot ends the probe, the key would have gone there
+        if(match(group, CTRL_EMPTY)) return -1;
+        g = (g + step) & (groups - 1);
+    }
+}
+
+
+// the first empty or deleted slot on a hash's probe sequence
+static int64_t first_free(MapTable *t, uint64_t h)
+{
+    int64_t groups = t->capacity / MAP_GROUP;
+    int64_t g = (h >> 7) & (groups - 1);
+    for(int64_t step = 1; ; step++) {
+        uint32_t m = match_free(t->ctrl() + g * MAP_GROUP);
+        if(m) return g * MAP_GROUP + __builtin_ctz(m);
+        g = (g + step) & (groups - 1);
+    }
+}
+
+
+// allocate an empty map with a number of slots
+static Result allocate(ResultType key, ResultType value, int64_t capacity)
+{
+    size_t bytes = shape_bytes(0) + sizeof(MapTable) + capacity * (1 + sizeof(MapSlot));
+    char *block = static_cast<char*>(heap.allocate(bytes, HEAP_ARRAY));
+    int64_t *elements = reinterpret_cast<int64_t*>(block + shape_bytes(0));
+    elements[-1] = 0;
+    elements[-2] = 0;
+
+    MapTable *t = reinterpret_cast<MapTable*>(elements);
+    t->capacity = capacity;
+    t->deleted = 0;
+    t->key = key;
+    t->value = value;
+    memset(t->ctrl(), CTRL_EMPTY, capacity);
+
+    Result map;
+    map.array(elements, ELEMENT_MAP);
+    return map;
+}
+
+
+// move the keys of a map into a new table, which drops its tombstones
+static void rehash(Result &map, int64_t capacity)
+{
+    Root root(map);
+    MapTable *t = map_table(map);
+    Result grown = allocate(t->key, t->value, capacity);
+
+    // the allocation may have moved the map
+    MapTable *from = map_table(map);
+    MapTable *to = map_table(grown);
+    for(int64_t i = 0; i < from->capacity; i++) {
+        if(from->ctrl()[i] < 0) continue;
+        MapSlot &slot = from->slots()[i];
+        uint64_t h = hash(slot.key);
+        int64_t j = first_free(to, h);
+        to->ctrl()[j] = h & 0x7F;
+        to->slots()[j] = slot;
+    }
+    static_cast<int64_t*>(grown.ptr())[-1] = array_length(map.ptr());
+    heap.relocate(map.ptr(), grown.ptr());
+}
+
+
+//////////////////////////////////////////
+// Map Implementation
+//////////////////////////////////////////
+
+// create an empty map in the heap
+Result map_create(ResultType key, ResultType value)
+{
+    return allocate(key, value, MAP_GROUP);
+}
+
+
+// the value of a key, nullptr if it is not there
+Result *map_find(const Result &map, const Result &key)
+{
+    MapTable *t = map_table(map);
+    int64_t i = find(t, key);
+    return i < 0 ? nullptr : &t->slots()[i].value;
+}
+
+
+// the value of a key, added as a zero if it is not there
+Result *map_insert(Result &map, const Result &key)
+{
+    MapTable *t = map_table(map);
+    int64_t i = find(t, key);
+    if(i >= 0) return &t->slots()[i].value;
+
+    // at 7/8 full, tombstones included, the table doubles if the keys
+    // fill more than half of that, and is rebuilt at its size otherwise
+    int64_t count = array_length(map.ptr());
+    if((count + t->deleted + 1) * 8 > t->capacity * 7) {
+        bool grow = (count + 1) * 16 > t->capacity * 7;
+        rehash(map, grow ? 2 * t->capacity : t->capacity);
+        t = map_table(map);
+    }
+
+    uint64_t h = hash(key);
+    i = first_free(t, h);
+    if(t->ctrl()[i] == CTRL_DELETED) t->deleted--;
+    t->ctrl()[i] = h & 0x7F;
+    t->slots()[i].key = key;
+    t->slots()[i].value = Result(t->value);
+    static_cast<int64_t*>(map.ptr())[-1] = count + 1;
+    return &t->slots()[i].value;
+}
+
+
+// remove a key, returning false if it is not there
+bool map_remove(Result &map, const Result &key)
+{
+    MapTable *t = map_table(map);
+    int64_t i = find(t, key);
+    if(i < 0) return false;
+
+    // every probe through a group with an empty slot ends there, so a
+    // slot in one can be emptied again rather than left a tombstone
+    if(match(t->ctrl() + i / MAP_GROUP * MAP_GROUP, CTRL_EMPTY)) {
+        t->ctrl()[i] = CTRL_EMPTY;
+    } else {
+        t->ctrl()[i] = CTRL_DELETED;
+        t->deleted++;
+    }
+    static_cast<int64_t*>(map.ptr())[-1]--;
+    return true;
+}
+
+
+// apply a function to every key, in table order
+void map_each(const Result &map, const std::function<void(const Result&)> &fn)
+{
+    MapTable *t = map_table(map);
+    for(int64_t g = 0; g < t->capacity; g += MAP_GROUP) {
+        for(uint32_t m = ~match_free(t->ctrl() + g) & 0xFFFF; m; m &= m - 1) {
+            fn(t->slots()[g + __builtin_ctz(m)].key);
+        }
+    }
+}
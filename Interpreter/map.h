@@ -0,0 +1,60 @@
+// This file contains the hash maps scripts declare, from integer or real
+// keys to integer or real values. They are open addressing tables in the
+// style of Swiss tables: each slot has a control byte holding 7 bits of
+// its key's hash, and a probe compares a group of 16 of them at once, so
+// most lookups read one group of control bytes and one slot.
+#ifndef MAP_H
+#define MAP_H
+#include <cstdint>
+#include <functional>
+#include "op.h"
+
+// control bytes, a full slot holds the low 7 bits of its key's hash
+const int8_t CTRL_EMPTY = -128;
+const int8_t CTRL_DELETED = -2;
+
+// the slots probed together, and the fewest a map has
+const int64_t MAP_GROUP = 16;
+
+
+// a key and its value
+struct MapSlot
+{
+    Result key;
+    Result value;
+};
+
+
+// A map is an array with no dimensions whose elements are its table, so
+// it is collected and passed like one. Its length is the number of keys.
+struct MapTable
+{
+    int64_t capacity;       // slots, a power of two and a whole number of groups
+    int64_t deleted;        // slots holding a tombstone
+    ResultType key;
+    ResultType value;
+
+    // the control bytes, then the slots
+    int8_t *ctrl() { return reinterpret_cast<int8_t*>(this + 1); }
+    MapSlot *slots() { return reinterpret_cast<MapSlot*>(ctrl() + capacity); }
+};
+
+// the table of a map
+inline MapTable *map_table(const Result &map) { return static_cast<MapTable*>(map.ptr()); }
+
+// create an empty map in the heap
+Result map_create(ResultType key, ResultType value);
+
+// the value of a key, nullptr if it is not there
+Result *map_find(const Result &map, const Result &key);
+
+// the value of a key, added as a zero if it is not there; the map may be
+// moved to grow it, and every handle to it is updated
+Result *map_insert(Result &map, const Result &key);
+
+// remove a key, returning false if it is not there
+bool map_remove(Result &map, const Result &key);
+
+// apply a function to every key, in table order
+void map_each(const Result &map, const std::function<void(const Result&)> &fn);
+#endif
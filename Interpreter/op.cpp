@@ -1,11 +1,24 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <sys/resource.h>
 #include "lexer.h"
 #include "op.h"
+#include "gc.h"
+#include "map.h"
+#include "reduce.h"
+#include "fused.h"
 
 // global reference environment for variables
-static RefEnv env;
+RefEnv env;
+Optimizer *optimizer = nullptr;
+
+// the call stack, in slots
+Frames frames(1 << 20);
 
 
 //////////////////////////////////////////
@@ -14,14 +27,14 @@ static RefEnv env;
 static ResultType coerce(Result left, Result right) 
 {
     // if the types match, there is no coercion
-    if(left.type == right.type) return left.type;
+    if(left.type() == right.type()) return left.type();
 
     // if either left or right is void, so is the result
-    if(left.type == VOID or right.type == VOID) return VOID;
+    if(left.type() == VOID or right.type() == VOID) return VOID;
 
     // perform type widening
-    if((left.type == REAL and right.type == INTEGER) or 
-       (left.type == INTEGER and right.type == REAL)) {
+    if((left.type() == REAL and right.type() == INTEGER) or 
+       (left.type() == INTEGER and right.type() == REAL)) {
         return REAL;
     }
 
@@ -31,27 +44,277 @@ static ResultType coerce(Result left, Result right)
 }
 
 
+// read an element out of an array, by its element type
+static Result array_read(const Result &arr, int64_t index)
+{
+    Result res;
+    switch(arr.element_type()) {
+        case ELEMENT_INT64:
+            res.i(read_element<int64_t>(arr.ptr(), index));
+            break;
+        case ELEMENT_INT8:
+            res.i(read_element<int8_t>(arr.ptr(), index));
+            break;
+        case ELEMENT_INT16:
+            res.i(read_element<int16_t>(arr.ptr(), index));
+            break;
+        case ELEMENT_BIT:
+            res.i(read_element<Bit>(arr.ptr(), index));
+            break;
+        case ELEMENT_REAL:
+            res.r(static_cast<double*>(arr.ptr())[index]);
+            break;
+        default:
+            break;
+    }
+
+    return res;
+}
+
+
+// can a value be stored in an array, reporting it if not
+static bool matches(const Result &arr, const Result &rhs)
+{
+    if ((value_of(arr.element_type()) == INTEGER) != (rhs.type() == INTEGER)) {
+        std::cout<<"result type of expression does not match the array element type\n";
+        return false;
+    }
+    return true;
+}
+
+
+// write an element into an array, checking the element type
+static void array_write(Result &arr, int64_t index, const Result &rhs)
+{
+    ElementType element = arr.element_type();
+    if (not matches(arr, rhs)) {
+        return;
+    } else if (element == ELEMENT_INT64) {
+        write_element<int64_t>(arr.ptr(), index, rhs.i());
+    } else if (element == ELEMENT_INT8) {
+        write_element<int8_t>(arr.ptr(), index, rhs.i());
+    } else if (element == ELEMENT_INT16) {
+        write_element<int16_t>(arr.ptr(), index, rhs.i());
+    } else if (element == ELEMENT_BIT) {
+        write_element<Bit>(arr.ptr(), index, rhs.i());
+    } else {
+        static_cast<double*>(arr.ptr())[index] = rhs.r();
+    }
+}
+
+
+// check that a name holds an array, of one dimension if it is to grow
+static void check_array(const Result &arr, ParseTree *named, bool growing)
+{
+    if(arr.type() != ARRAY) {
+        throw std::runtime_error(named->token().lexeme + " is not an array");
+    }
+    int dims = array_rank(arr.ptr());
+    if(growing and dims != 1) {
+        throw std::runtime_error("Array " + named->token().lexeme + " has " +
+                                 std::to_string(dims) + " dimensions");
+    }
+}
+
+
+// check that a name holds an array of numbers, which maps are not
+static void check_numbers(const Result &arr, ParseTree *named)
+{
+    check_array(arr, named, false);
+    if(arr.element_type() == ELEMENT_MAP) {
+        throw std::runtime_error("Array " + named->token().lexeme + " does not hold numbers");
+    }
+}
+
+
+// check that a name holds a map, and box a key as its keys are: integers
+// are widened for a map of reals, whose zero is never negative
+static Result map_key(const Result &map, const Result &key, ParseTree *named)
+{
+    if(map.type() != ARRAY or map.element_type() != ELEMENT_MAP) {
+        throw std::runtime_error(named->token().lexeme + " is not a map");
+    }
+
+    ResultType type = map_table(map)->key;
+    if(type == INTEGER and key.type() == INTEGER) {
+        return key;
+    } else if(type == REAL and (key.type() == INTEGER or key.type() == REAL)) {
+        Result real;
+        real.r(NUM_RESULT(key) + 0.0);
+        return real;
+    }
+    throw std::runtime_error("Keys of " + named->token().lexeme + " are " +
+                             (type == INTEGER ? "integers" : "reals"));
+}
+
+
+// look a key up, a missing key reads as zero so counts need no setup
+static Result map_read(const Result &map, const Result &key, ParseTree *named)
+{
+    Result *value = map_find(map, map_key(map, key, named));
+    return value ? *value : Result(map_table(map)->value);
+}
+
+
+// set a key's value, the handle is updated if the map moves
+static void map_write(Result &map, const Result &key, const Result &value, ParseTree *named)
+{
+    Result boxed = map_key(map, key, named);
+    if((map_table(map)->value == INTEGER) != (value.type() == INTEGER)) {
+        std::cout<<"result type of expression does not match the map value type\n";
+        return;
+    }
+    *map_insert(map, boxed) = value;
+}
+
+
+// an element of an array, or the value of a key in a map the parser took
+// for an array: one used before its declaration, or declared on another
+// line of the REPL, is only known to be a map once it runs
+static Result element_read(const Result &arr, const Result &index, ParseTree *named)
+{
+    if(arr.type() == ARRAY and arr.element_type() == ELEMENT_MAP) {
+        return map_read(arr, index, named);
+    }
+    return array_read(arr, index.i());
+}
+
+
+static void element_write(Result &arr, const Result &index, const Result &value, ParseTree *named)
+{
+    if(arr.type() == ARRAY and arr.element_type() == ELEMENT_MAP) {
+        map_write(arr, index, value, named);
+    } else {
+        array_write(arr, index.i(), value);
+    }
+}
+
+
+// apply a compiled comparison to two values
+template<typename T>
+static bool compare(CompareOp op, T l, T r)
+{
+    switch(op) {
+        case CMP_LT:
+            return l < r;
+        case CMP_GT:
+            return l > r;
+        case CMP_EQ:
+            return l == r;
+        case CMP_NE:
+            return l != r;
+    }
+    return false;
+}
+
+
+// compare two numeric results, widening to real when the types differ
+static bool compare(CompareOp op, const Result &l, const Result &r)
+{
+    if(l.type() == INTEGER and r.type() == INTEGER) {
+        return compare(op, l.i(), r.i());
+    }
+    return compare<double>(op, NUM_RESULT(l), NUM_RESULT(r));
+}
+
+
+// true if an index expression is a plain variable or literal
+static bool simple_index(ParseTree *a)
+{
+    return dynamic_cast<Var*>(a) or dynamic_cast<Number*>(a);
+}
+
+
+// true if two index expressions are the same variable or literal
+static bool same_index(ParseTree *a, ParseTree *b)
+{
+    if(a == nullptr or b == nullptr) return false;
+
+    if(dynamic_cast<Var*>(a) and dynamic_cast<Var*>(b)) {
+        return a->token().lexeme == b->token().lexeme;
+    }
+    if(dynamic_cast<Number*>(a) and dynamic_cast<Number*>(b)) {
+        return a->token().lexeme == b->token().lexeme;
+    }
+    return false;
+}
+
+
+// replace the statement triple t = a[i]; a[i] = a[j]; a[j] = t with a swap
+static void fuse_swaps(std::vector<ParseTree*> &stmts)
+{
+    for(int k=0; k+2 < (int) stmts.size(); k++) {
+        ArrayLoad *load = dynamic_cast<ArrayLoad*>(stmts[k]);
+        ArrayAssign *first = dynamic_cast<ArrayAssign*>(stmts[k+1]);
+        ArrayAssign *second = dynamic_cast<ArrayAssign*>(stmts[k+2]);
+        if(not load or not first or not second) continue;
+
+        // a[i] = a[j]
+        std::string arrName = load->left()->token().lexeme;
+        ArrayAccess *access = dynamic_cast<ArrayAccess*>(first->right());
+        if(first->token().lexeme != arrName or 
+           not same_index(first->left(), load->right()) or
+           not access or access->left()->token().lexeme != arrName or
+           not simple_index(access->right())) {
+            continue;
+        }
+
+        // a[j] = t
+        Var *temp = dynamic_cast<Var*>(second->right());
+        if(second->token().lexeme != arrName or
+           not same_index(second->left(), access->right()) or
+           not temp or temp->token().lexeme != load->token().lexeme) {
+            continue;
+        }
+
+        // the swap reads both indices first, so t must be neither
+        if(same_index(temp, load->right()) or same_index(temp, access->right())) {
+            continue;
+        }
+
+        // build the swap out of the pieces of the triple
+        ArraySwap *swap = new ArraySwap(load->left()->token());
+        swap->slot(load->left()->slot());
+        swap->push(temp);
+        swap->push(load->right());
+        swap->push(access->right());
+        second->right(nullptr);
+        load->right(nullptr);
+        access->right(nullptr);
+
+        delete load;
+        delete first;
+        delete second;
+        stmts[k] = swap;
+        stmts.erase(stmts.begin() + k + 1, stmts.begin() + k + 3);
+    }
+}
+
+
 //////////////////////////////////////////
 // Multi-Typed Result Returns
 //////////////////////////////////////////
 
 // handy string conversion for debugging
-const char* RTSTR[] = { "VOID", "INTEGER", "REAL" };
+const char* RTSTR[] = { "VOID", "INTEGER", "REAL", "ARRAY", "CLASSDECLARATION", "OBJECT", "BOOLEAN" };
 
 // print result values
 std::ostream& operator<<(std::ostream& os, const Result &result)
 {
     // handle the numeric types
-    if(result.type == INTEGER) return os << result.val.i;
+    if(result.type() == INTEGER) return os << result.i();
 
-    switch(result.type) {
+    switch(result.type()) {
         case VOID:
             break;
         case INTEGER:
-            os << result.val.i;
+            os << result.i();
             break;
         case REAL:
-            os << result.val.r;
+            os << result.r();
+            break;
+        case BOOLEAN:
+            os << result.b();
             break;
         default:
             break;
@@ -81,16 +344,16 @@ void RefEnv::declare(const std::string &name, ResultType type)
     }
 
     // create the variable and add it to the table
-    Result var;
-    var.type = type;
-    _symtab[name] = var;
+    _symtab[name] = Result(type);
 }
 
 
 // check to see if a name exists in the environment
 bool RefEnv::exists(const std::string &name)
 {
-    return _symtab.find(name) != _symtab.end();
+    // undeclared slots are held as VOID
+    auto itr = _symtab.find(name);
+    return itr != _symtab.end() and itr->second.type() != VOID;
 }
 
 
@@ -105,20 +368,166 @@ Result& RefEnv::operator[](const std::string &name)
     return _symtab[name];
 }
 
-RefEnv RefEnv::getEnv(const std::string &objName) {
-    if (_objtab.find(objName) != _objtab.end()) {
-        return _objtab[objName];
-    } else
-        return *(new RefEnv());
+
+// apply a function to every variable, which are the roots the env holds
+void RefEnv::visit(const std::function<void(Result&)> &fn)
+{
+    for(auto &entry : _symtab) {
+        fn(entry.second);
+    }
+}
+
+
+// get stable storage for a name, whether or not it is declared yet
+Result* RefEnv::slot(const std::string &name)
+{
+    auto itr = _symtab.find(name);
+    if(itr == _symtab.end()) {
+        itr = _symtab.insert({name, Result()}).first;
+    }
+    return &itr->second;
+}
+
+
+// constructor and destructor
+Frames::Frames(int capacity)
+{
+    // slots are set as frames are carved, so the stack is left untouched
+    // until it is used
+    _base = static_cast<Result*>(Allocator::local().allocate(capacity * sizeof(Result)));
+    _limit = _base + capacity;
+    fp = nullptr;
+    sp = _base;
+    depth = 0;
+    limit = MAX_DEPTH;
+    _tail = nullptr;
+    _tailFrame = nullptr;
+
+    // calls may use the native stack up to a safety margin below its limit
+    char here;
+    struct rlimit rl;
+    _native = &here;
+    _nativeSize = 8L << 20;
+    if(getrlimit(RLIMIT_STACK, &rl) == 0 and rl.rlim_cur != RLIM_INFINITY) {
+        _nativeSize = rl.rlim_cur;
+    }
+    _nativeSize -= 512L << 10;
+}
+
+
+Frames::~Frames()
+{
+    Allocator::local().release(_base, (_limit - _base) * sizeof(Result));
+}
+
+
+// carve n undeclared slots off the top of the stack
+Result *Frames::alloc(int n)
+{
+    if(n > _limit - sp) {
+        throw std::runtime_error("Stack overflow");
+    }
+
+    Result *frame = sp;
+    std::fill(frame, frame + n, Result());
+    sp += n;
+    _named.push_back({frame, n});
+    return frame;
+}
+
+
+// free a frame and everything above it
+void Frames::pop(Result *frame)
+{
+    sp = frame;
+    while(not _named.empty() and _named.back().first >= frame) {
+        _named.pop_back();
+    }
+}
+
+
+// apply a function to the named slots of every frame, which are the
+// roots the stack holds
+void Frames::visit(const std::function<void(Result&)> &fn)
+{
+    for(auto &named : _named) {
+        for(int i = 0; i < named.second; i++) {
+            fn(named.first[i]);
+        }
+    }
+}
+
+
+// carve raw storage for the current frame off the top of the stack
+void *Frames::carve(size_t bytes)
+{
+    size_t n = (bytes + sizeof(Result) - 1) / sizeof(Result);
+    if(fp == nullptr or n > (size_t) (_limit - sp)) {
+        return nullptr;
+    }
+
+    void *block = sp;
+    sp += n;
+    return block;
+}
+
+
+// is a pointer into the stack
+bool Frames::owns(const void *p) const
+{
+    return p >= (const void*) _base and p < (const void*) _limit;
+}
+
+
+// enter a frame, checking the depth limit
+void Frames::enter(Result *frame)
+{
+    // the evaluator recurses on the native stack, which must not overflow
+    char here;
+    if(depth >= limit or _native - &here > _nativeSize) {
+        pop(frame);
+        throw std::runtime_error(depth >= limit ?
+            "Call depth limit of " + std::to_string(limit) + " exceeded" :
+            "Stack overflow at call depth " + std::to_string(depth));
+    }
+    depth++;
+    fp = frame;
+}
+
+
+// leave a frame, freeing it and everything above it
+void Frames::leave(Result *caller, Result *frame)
+{
+    depth--;
+    fp = caller;
+    pop(frame);
+    _tail = nullptr;
 }
 
-void RefEnv::setEnv(const std::string &objName) {
-    RefEnv *newenv = new RefEnv();
-    env.declare(objName, OBJECT);
-    _objtab[objName] = *newenv;
+
+// leave a call in tail position to the caller
+void Frames::defer(Method *callee, Result *frame)
+{
+    _tail = callee;
+    _tailFrame = frame;
 }
 
 
+// move a deferred call down into frame, returning its method
+Method *Frames::tail_call(Result *frame)
+{
+    Method *callee = _tail;
+    if(callee) {
+        int n = callee->frame_size();
+        _tail = nullptr;
+        std::copy(_tailFrame, _tailFrame + n, frame);
+        pop(frame);
+        sp = frame + n;
+        _named.push_back({frame, n});
+    }
+    return callee;
+}
+
 //////////////////////////////////////////
 // UnaryOp Implementation
 //////////////////////////////////////////
@@ -152,6 +561,16 @@ void UnaryOp::child(ParseTree *_child)
 }
 
 
+// fuse the child
+ParseTree *UnaryOp::fuse()
+{
+    if(_child) {
+        _child = _child->fuse();
+    }
+    return this;
+}
+
+
 // print the tree with 1 child
 void UnaryOp::print(int depth) const
 {
@@ -217,6 +636,20 @@ void BinaryOp::right(ParseTree *child)
 }
 
 
+// fuse both children
+ParseTree *BinaryOp::fuse()
+{
+    if(_lchild) {
+        _lchild = _lchild->fuse();
+    }
+
+    if(_rchild) {
+        _rchild = _rchild->fuse();
+    }
+    return this;
+}
+
+
 // print the tree with 2 children
 void BinaryOp::print(int depth) const
 {
@@ -278,6 +711,18 @@ std::vector<ParseTree*>::const_iterator NaryOp::end() const
 }
 
 
+// fuse all the children
+ParseTree *NaryOp::fuse()
+{
+    for(auto itr = _children.begin(); itr != _children.end(); itr++) {
+        if(*itr) {
+            *itr = (*itr)->fuse();
+        }
+    }
+    return this;
+}
+
+
 // print the tree
 void NaryOp::print(int depth) const
 {
@@ -299,6 +744,53 @@ void NaryOp::print(int depth) const
 }
 
 
+//////////////////////////////////////////
+// Tiered implementation
+//////////////////////////////////////////
+int Tiered::_promotions = 0;
+int Tiered::_deopts = 0;
+
+Tiered::Tiered() : _count(0), _promoted(false)
+{
+    // This space left intentionally blank
+}
+
+
+void Tiered::report(std::ostream &os)
+{
+    os << "tiers: " << _promotions << " promoted, " << _deopts << " fell back" << std::endl;
+}
+
+
+// count executions, and optimize the unit once they reach the threshold
+void Tiered::promote(ParseTree *unit, int count, int threshold)
+{
+    if(_promoted or optimizer == nullptr) return;
+
+    _count += count;
+    if(_count >= threshold) {
+        _promoted = true;
+        _compiled = optimizer->optimize(unit);
+        _promotions++;
+    }
+}
+
+
+// run the optimized form, false if it fell back to the tree-walker
+bool Tiered::run_optimized()
+{
+    try {
+        _compiled();
+        return true;
+    } catch(Deopt &e) {
+        // the optimized form is never trusted again
+        _compiled = nullptr;
+        _deopts++;
+        return false;
+    }
+}
+
+
 //////////////////////////////////////////
 // Program implementation
 //////////////////////////////////////////
@@ -317,12 +809,29 @@ Result Program::eval()
 
     // programs return void
     Result result;
-    result.type = VOID;
 
     return result;
 }
 
 
+// run the body of a method, in the optimized tier once it is hot
+void Program::invoke()
+{
+    promote(this, 1, HOT_CALLS);
+    if(not _compiled or not run_optimized()) {
+        eval();
+    }
+}
+
+
+ParseTree *Program::fuse()
+{
+    NaryOp::fuse();
+    fuse_swaps(_children);
+    return this;
+}
+
+
 void Program::print(int depth) const
 {
     int n = _children.size();
@@ -345,81 +854,305 @@ void Program::print(int depth) const
 
 
 //////////////////////////////////////////
-// Add implementation
+// Method implementation
 //////////////////////////////////////////
 
-Add::Add(LexerToken _token) : BinaryOp(_token)
+// the node naming the variable a declaration declares
+static ParseTree *declared(ParseTree *decl)
 {
-    // This space left intentionally blank
+    if(VarDecl *var = dynamic_cast<VarDecl*>(decl)) {
+        return var->child();
+    } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(decl)) {
+        return init->name();
+    } else if(MapInit *init = dynamic_cast<MapInit*>(decl)) {
+        return init->child();
+    } else if(dynamic_cast<ObjectCreation*>(decl)) {
+        return decl;
+    }
+    return nullptr;
 }
 
 
-Result Add::eval() 
+// give every local declared in a tree a slot
+static void declare_locals(ParseTree *tree, std::map<std::string, int> &locals)
 {
-    // evaluate the children
-    Result l = left()->eval();
-    Result r = right()->eval();
-
-    // get the type of the result
-    Result result;
-    result.type = coerce(l, r);
+    ParseTree *name = declared(tree);
+    if(name and locals.count(name->token().lexeme) == 0) {
+        int index = locals.size();
+        locals[name->token().lexeme] = index;
+    }
+    for_children(tree, [&locals](ParseTree *child) { declare_locals(child, locals); });
+}
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) + NUM_RESULT(r));
 
-    return result;
+// point every node which names a local at its slot
+static void bind_locals(ParseTree *tree, const std::map<std::string, int> &locals)
+{
+    if(dynamic_cast<Var*>(tree) or dynamic_cast<ArrayAccess*>(tree) or
+       dynamic_cast<ArrayAssign*>(tree) or dynamic_cast<ArrayIndex*>(tree) or
+       dynamic_cast<ScanF*>(tree) or
+       dynamic_cast<ObjectAccess*>(tree) or dynamic_cast<ObjectCreation*>(tree)) {
+        auto itr = locals.find(tree->token().lexeme);
+        if(itr != locals.end()) {
+            tree->slot(itr->second);
+        }
+    }
+    for_children(tree, [&locals](ParseTree *child) { bind_locals(child, locals); });
 }
 
 
-//////////////////////////////////////////
-// Sub implementation
-//////////////////////////////////////////
-
-Sub::Sub(LexerToken _token) : BinaryOp(_token)
+// collect the arrays passed to calls in tail position, which run after
+// the frame that holds their arguments is gone, and the objects whose
+// fields are passed, as their arrays are held with them
+static void escaping(ParseTree *tree, std::set<std::string> &names)
 {
-    // This space left intentionally blank
+    ObjectAccess *call = dynamic_cast<ObjectAccess*>(tree);
+    if(call and call->tail()) {
+        for(auto itr = call->begin() + 2; itr < call->end(); itr++) {
+            if(dynamic_cast<Var*>(*itr) or dynamic_cast<ObjectAccess*>(*itr)) {
+                names.insert((*itr)->token().lexeme);
+            }
+        }
+    }
+    for_children(tree, [&names](ParseTree *child) { escaping(child, names); });
 }
 
 
-Result Sub::eval() 
+// place the locals which never outlive the frame in it
+static void place_locals(ParseTree *tree, const std::set<std::string> &escaped)
 {
-    // evaluate the children
-    Result l = left()->eval();
-    Result r = right()->eval();
-
-    // get the type of the result
-    Result result;
-    result.type = coerce(l, r);
+    if(ArrayInit *init = dynamic_cast<ArrayInit*>(tree)) {
+        // only fixed size arrays, larger ones go to the heap when they run
+        bool fixed = not init->dynamic();
+        for(int k = 0; k < init->rank(); k++) {
+            fixed = fixed and dynamic_cast<Number*>(init->bound(k));
+        }
+        ParseTree *name = init->name();
+        init->in_frame(name->slot() >= 0 and fixed and escaped.count(name->token().lexeme) == 0);
+    } else if(ObjectCreation *obj = dynamic_cast<ObjectCreation*>(tree)) {
+        // objects cannot be passed or stored, so a local one only escapes
+        // through the fields a tail call is passed
+        obj->in_frame(obj->slot() >= 0 and escaped.count(obj->token().lexeme) == 0);
+    }
+    for_children(tree, [&escaped](ParseTree *child) { place_locals(child, escaped); });
+}
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) - NUM_RESULT(r));
 
-    return result;
+// mark the calls which are the last thing a method does, looking into
+// the last statement of an if
+static void mark_tail(ParseTree *last)
+{
+    if(ObjectAccess *call = dynamic_cast<ObjectAccess*>(last)) {
+        call->tail(call->begin() + 1 != call->end() and
+                   (*(call->begin() + 1))->token() == LPAREN);
+    } else if(IfStatement *ifs = dynamic_cast<IfStatement*>(last)) {
+        NaryOp *block = dynamic_cast<NaryOp*>(ifs->right());
+        if(ifs->token() == IF and block and block->begin() != block->end()) {
+            mark_tail(*(block->end() - 1));
+        }
+    }
 }
 
 
-//////////////////////////////////////////
-// Mul implementation
-//////////////////////////////////////////
-
-Mul::Mul(LexerToken _token) : BinaryOp(_token)
+Method::Method(LexerToken _token) : Program(_token)
 {
-    // This space left intentionally blank
+    _size = 0;
 }
 
 
-Result Mul::eval() 
+// add a parameter declaration
+void Method::param(ParseTree *decl)
+{
+    _params.push_back(decl);
+}
+
+
+// access iterators for the parameters
+std::vector<ParseTree*>::const_iterator Method::params_begin() const
+{
+    return _params.begin();
+}
+
+
+std::vector<ParseTree*>::const_iterator Method::params_end() const
+{
+    return _params.end();
+}
+
+
+int Method::arity() const
+{
+    return _params.size();
+}
+
+
+// give every parameter and local a slot in the frame, parameters first
+void Method::resolve()
+{
+    std::map<std::string, int> locals;
+    for(ParseTree *decl : _params) {
+        std::string name = declared(decl)->token().lexeme;
+        if(locals.count(name)) {
+            throw std::runtime_error("Parameter " + name + " is declared twice");
+        }
+        int index = locals.size();
+        locals[name] = index;
+        declared(decl)->slot(index);
+    }
+    declare_locals(this, locals);
+    bind_locals(this, locals);
+    _size = locals.size();
+
+    if(begin() != end()) {
+        mark_tail(*(end() - 1));
+    }
+
+    // escape analysis, for the locals which can be carved off the frame
+    std::set<std::string> escaped;
+    escaping(this, escaped);
+    place_locals(this, escaped);
+}
+
+
+// the number of slots in a frame
+int Method::frame_size() const
+{
+    return _size;
+}
+
+
+// store an argument in its parameter's slot, checking its type
+void Method::bind(Result *frame, int i, const Result &arg)
+{
+    ParseTree *decl = _params[i];
+    bool isInt = decl->token() == INTEGER_DECL;
+    bool fits;
+
+    if(ArrayInit *init = dynamic_cast<ArrayInit*>(decl)) {
+        // arrays are passed by reference, only the handle is copied
+        int dims = init->dynamic() ? 1 : init->rank();
+        fits = arg.type() == ARRAY and arg.element_type() == init->element_type() and
+               arg.ptr() and array_rank(arg.ptr()) == dims;
+        if(fits) frame[i] = arg;
+    } else if(MapInit *init = dynamic_cast<MapInit*>(decl)) {
+        // and so are maps
+        fits = arg.type() == ARRAY and arg.element_type() == ELEMENT_MAP and
+               map_table(arg)->key == init->key_type() and
+               map_table(arg)->value == init->value_type();
+        if(fits) frame[i] = arg;
+    } else {
+        fits = arg.type() == INTEGER or arg.type() == REAL;
+        if(fits) {
+            frame[i] = Result(isInt ? INTEGER : REAL);
+            NUM_ASSIGN(frame[i], NUM_RESULT(arg));
+        }
+    }
+
+    if(not fits) {
+        throw std::runtime_error("Argument " + std::to_string(i + 1) + " of " +
+                                 token().lexeme + " has the wrong type");
+    }
+}
+
+
+// run the body in a frame from Frames::alloc, which is freed on return
+void Method::call(Result *frame)
+{
+    CallScope scope(frame);
+    invoke();
+
+    // calls in tail position run here, reusing the frame
+    while(Method *next = frames.tail_call(frame)) {
+        next->invoke();
+    }
+}
+
+
+//////////////////////////////////////////
+// Add implementation
+//////////////////////////////////////////
+
+Add::Add(LexerToken _token) : BinaryOp(_token)
+{
+    // This space left intentionally blank
+}
+
+
+Result Add::eval() 
 {
     // evaluate the children
     Result l = left()->eval();
     Result r = right()->eval();
 
     // get the type of the result
-    Result result;
-    result.type = coerce(l, r);
+    Result result(coerce(l, r));
+
+    // perform the operation, integers stay integers
+    if(result.type() == INTEGER) {
+        result.i(l.i() + r.i());
+    } else {
+        NUM_ASSIGN(result, NUM_RESULT(l) + NUM_RESULT(r));
+    }
+
+    return result;
+}
+
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) * NUM_RESULT(r));
+//////////////////////////////////////////
+// Sub implementation
+//////////////////////////////////////////
+
+Sub::Sub(LexerToken _token) : BinaryOp(_token)
+{
+    // This space left intentionally blank
+}
+
+
+Result Sub::eval() 
+{
+    // evaluate the children
+    Result l = left()->eval();
+    Result r = right()->eval();
+
+    // get the type of the result
+    Result result(coerce(l, r));
+
+    // perform the operation, integers stay integers
+    if(result.type() == INTEGER) {
+        result.i(l.i() - r.i());
+    } else {
+        NUM_ASSIGN(result, NUM_RESULT(l) - NUM_RESULT(r));
+    }
+
+    return result;
+}
+
+
+//////////////////////////////////////////
+// Mul implementation
+//////////////////////////////////////////
+
+Mul::Mul(LexerToken _token) : BinaryOp(_token)
+{
+    // This space left intentionally blank
+}
+
+
+Result Mul::eval() 
+{
+    // evaluate the children
+    Result l = left()->eval();
+    Result r = right()->eval();
+
+    // get the type of the result
+    Result result(coerce(l, r));
+
+    // perform the operation, integers stay integers
+    if(result.type() == INTEGER) {
+        result.i(mul_int(l.i(), r.i()));
+    } else {
+        NUM_ASSIGN(result, NUM_RESULT(l) * NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -442,11 +1175,15 @@ Result Div::eval()
     Result r = right()->eval();
 
     // get the type of the result
-    Result result;
-    result.type = coerce(l, r);
+    Result result(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) / NUM_RESULT(r));
+    // perform the operation, integers stay integers
+    if(result.type() == INTEGER) {
+        if(r.i() == 0) throw std::runtime_error("Division by zero");
+        result.i(l.i() / r.i());
+    } else {
+        NUM_ASSIGN(result, NUM_RESULT(l) / NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -469,11 +1206,14 @@ Result Pow::eval()
     Result r = right()->eval();
 
     // get the type of the result
-    Result result;
-    result.type = coerce(l, r);
+    Result result(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, pow(NUM_RESULT(l), NUM_RESULT(r)));
+    // perform the operation, integers stay integers
+    if(result.type() == INTEGER) {
+        result.i(pow_int(l.i(), r.i()));
+    } else {
+        NUM_ASSIGN(result, pow(NUM_RESULT(l), NUM_RESULT(r)));
+    }
 
     return result;
 }
@@ -511,15 +1251,28 @@ void Neg::print(int depth) const
 // Number implementation
 //////////////////////////////////////////
 
+// parse an integer literal, false if it does not fit in an integer
+bool int_literal(const std::string &lexeme, int64_t &value)
+{
+    const int64_t max = (int64_t(1) << (INT_BITS - 1)) - 1;
+    value = 0;
+    for(char c : lexeme) {
+        if(c < '0' or c > '9' or value > (max - (c - '0')) / 10) return false;
+        value = value * 10 + (c - '0');
+    }
+    return not lexeme.empty();
+}
+
+
 Number::Number(LexerToken _token) : ParseTree(_token)
 {
     //get the number's value
     if(_token == INTLIT) {
-        _val.type = INTEGER;
-        _val.val.i = stoi(_token.lexeme);
+        int64_t v = 0;
+        int_literal(_token.lexeme, v);
+        _val.i(v);
     } else if(_token == REALLIT) {
-        _val.type = REAL;
-        _val.val.r = stod(_token.lexeme);
+        _val.r(stod(_token.lexeme));
     }
 }
 
@@ -537,6 +1290,7 @@ Result Number::eval()
 ParseTree::ParseTree(LexerToken &token)
 {
     this->_token = token;
+    this->_slot = -1;
 }
 
 
@@ -553,6 +1307,13 @@ LexerToken ParseTree::token() const
 }
 
 
+// leaves have nothing to fuse
+ParseTree *ParseTree::fuse()
+{
+    return this;
+}
+
+
 // print the tree (for debug purposes)
 void ParseTree::print(int depth) const
 {
@@ -580,6 +1341,67 @@ void ParseTree::print_prefix(int depth) const
 }
 
 
+// the frame slot the name of this node refers to (-1 for the global env)
+int ParseTree::slot() const
+{
+    return _slot;
+}
+
+
+void ParseTree::slot(int index)
+{
+    _slot = index;
+}
+
+
+// the storage the name of this node refers to
+Result &ParseTree::ref()
+{
+    if(_slot < 0) {
+        return env[_token.lexeme];
+    }
+
+    Result &local = frames.fp[_slot];
+    if(local.type() == VOID) {
+        throw std::runtime_error(_token.lexeme + " not defined.");
+    }
+    return local;
+}
+
+
+// declare the name of this node, in its frame or the global env
+Result &ParseTree::declare(ResultType type)
+{
+    if(_slot < 0) {
+        env.declare(_token.lexeme, type);
+        return env[_token.lexeme];
+    }
+
+    Result &local = frames.fp[_slot];
+    if(local.type() != VOID) {
+        throw std::runtime_error("Redeclaration of " + _token.lexeme);
+    }
+    local = Result(type);
+    return local;
+}
+
+
+// apply a function to each child of a tree
+void for_children(ParseTree *tree, std::function<void(ParseTree*)> fn)
+{
+    if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        if(op->child()) fn(op->child());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        if(op->left()) fn(op->left());
+        if(op->right()) fn(op->right());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            if(*itr) fn(*itr);
+        }
+    }
+}
+
+
 
 //////////////////////////////////////////
 // Var Implementation
@@ -592,7 +1414,7 @@ Var::Var(LexerToken _token) : ParseTree(_token)
 
 Result Var::eval()
 {
-    return env[token().lexeme];;
+    return ref();
 }
 
 
@@ -607,7 +1429,6 @@ Print::Print(LexerToken _token) : UnaryOp(_token)
 Result Print::eval()
 {
     Result result;
-    result.type = VOID;
 
     //print the result of the child
     std::cout << child()->eval() << std::endl;
@@ -621,20 +1442,19 @@ Result Print::eval()
 ScanF::ScanF(LexerToken _token) : ParseTree(_token) {}
 
 Result ScanF::eval() {
-    int userInput;
+    int64_t userInput;
     double userIp;
 
 
     // check type of the variable
-    Result var = env[token().lexeme];
-    if (var.type == INTEGER) {
+    Result &var = ref();
+    if (var.type() == INTEGER) {
         std::cin >> userInput;
-        var.val.i = userInput;
-    } else if (var.type == REAL) {
+        var.i(userInput);
+    } else if (var.type() == REAL) {
         std::cin >> userIp;
-        var.val.r = userIp;
+        var.r(userIp);
     }
-    env[token().lexeme] = var;
     Result res;
     return res;
 }
@@ -642,43 +1462,107 @@ Result ScanF::eval() {
 //////////////////////////////////////////
 // IF Implementation
 //////////////////////////////////////////
-IfStatement::IfStatement(LexerToken _token) : BinaryOp(_token){}
+IfStatement::IfStatement(LexerToken _token) : BinaryOp(_token), _fused(nullptr) {}
+
+IfStatement::~IfStatement() {
+    delete _fused;
+}
 
 Result IfStatement::eval() {
+    // the parser always puts a conditional op on the left
+    ConditionalOp *cond = static_cast<ConditionalOp*>(left());
+
     if (token() == IF) {
         // check if condition and then execute the if block
-        if (left()->eval().val.i == 1 && left()->eval().type == VOID) {
+        if (cond->test()) {
             // evaluate the block
             right()->eval();
         }
     } else if(token() == WHILE) {
-        while(left()->eval().val.i == 1 && left()->eval().type == VOID) {
+        // a loop the array kernels can run never takes a pass, and an
+        // optimized loop runs to the end unless it deoptimizes
+        bool done = vectorize() or (_compiled and run_optimized());
+        while(not done and cond->test()) {
             right()->eval();
+
+            // a loop which turns hot switches to the optimized form at its
+            // head, and picks up in the tree-walker again if that deoptimizes
+            promote(this, 1, HOT_BACKEDGES);
+            done = _compiled and run_optimized();
         }
     }
     Result res;
     return res;
 }
 
+ParseTree *IfStatement::fuse() {
+    BinaryOp::fuse();
+
+    // the body is fused first, so its counter is an IncrementVar
+    if (token() == WHILE) {
+        delete _fused;
+        _fused = FusedLoop::match(this);
+    }
+    return this;
+}
+
+bool IfStatement::vectorizable() const {
+    return _fused != nullptr;
+}
+
+bool IfStatement::vectorize() {
+    return _fused and _fused->run();
+}
+
 //////////////////////////////////////////
 // ConditionalOp Implementation
 //////////////////////////////////////////
-ConditionalOp::ConditionalOp(LexerToken _token) : BinaryOp(_token){}
+ConditionalOp::ConditionalOp(LexerToken _token) : BinaryOp(_token)
+{
+    // compile the operator once so evaluation never looks at the lexeme
+    if (_token.lexeme == "<") {
+        _op = CMP_LT;
+    } else if (_token.lexeme == ">") {
+        _op = CMP_GT;
+    } else if (_token.lexeme == "is") {
+        _op = CMP_EQ;
+    } else if (_token.lexeme == "~") {
+        _op = CMP_NE;
+    } else {
+        throw std::runtime_error("Unknown conditional operator " + _token.lexeme);
+    }
+}
 
 Result ConditionalOp::eval() {
     Result result;
-    result.type = VOID;
+    result.b(test());
+    return result;
+}
+
+bool ConditionalOp::test() {
+    Result l = left()->eval();
+    Result r = right()->eval();
+    return compare(_op, l, r);
+}
+
+CompareOp ConditionalOp::op() const {
+    return _op;
+}
+
+ParseTree *ConditionalOp::fuse() {
+    BinaryOp::fuse();
 
-    if (token().lexeme == "<") {
-        result.val.i = left()->eval().val.i < right()->eval().val.i;
-    } else if (token().lexeme == ">") {
-        result.val.i = left()->eval().val.i > right()->eval().val.i;
-    } else if (token().lexeme == "is") {
-        result.val.i = left()->eval().val.i == right()->eval().val.i;
-    } else if (token().lexeme == "is") {
-        result.val.i = left()->eval().val.i != right()->eval().val.i;
+    // a[i] < b[j] becomes an ArrayCompare
+    if (dynamic_cast<ArrayAccess*>(left()) and dynamic_cast<ArrayAccess*>(right())) {
+        ArrayCompare *cmp = new ArrayCompare(token());
+        cmp->left(left());
+        cmp->right(right());
+        left(nullptr);
+        right(nullptr);
+        delete this;
+        return cmp;
     }
-    return result;
+    return this;
 }
 
 //////////////////////////////////////////
@@ -688,7 +1572,6 @@ AlphaNumeric::AlphaNumeric(LexerToken _token) : Print(_token) {}
 
 Result AlphaNumeric::eval() {
     Result result;
-    result.type = VOID;
 
     //print the alphanumberic string provided in the child
     std::cout << child()->token().lexeme;
@@ -706,37 +1589,109 @@ Result Statementblock::eval() {
         (*itr)->eval();
     }
     Result res;
-    res.type = VOID;
     return res;
 }
 
+ParseTree *Statementblock::fuse() {
+    NaryOp::fuse();
+    fuse_swaps(_children);
+    return this;
+}
+
 //////////////////////////////////////////
 // ArrayInit Implementation
 //////////////////////////////////////////
-ArrayInit::ArrayInit(LexerToken _token) : NaryOp(_token) {}
+ArrayInit::ArrayInit(LexerToken _token) : NaryOp(_token)
+{
+    _inFrame = false;
+}
 
 Result ArrayInit::eval() {
     //initialize an array in the env
+    Result arr = allocate(_inFrame);
+
+    // next add the Result to env (or the frame)
+    name()->declare(ARRAY) = arr;
+    Result res;
+    return res;
+}
+
+// allocate a new array of the declared type and shape
+Result ArrayInit::allocate(bool inFrame) {
     Result arr;
-    int size = (*begin())->eval().val.i;
+    int dims = dynamic() ? 1 : rank();
+    std::vector<int64_t> shape(dims);
+    int64_t length = 1;
+    for (int k = 0; k < dims; k++) {
+        shape[k] = dynamic() ? 0 : bound(k)->eval().i();
+        if (shape[k] < 0) {
+            throw std::runtime_error("Array " + name()->token().lexeme + " has a negative bound");
+        }
+        if (__builtin_mul_overflow(length, shape[k], &length) or
+            length > (int64_t) (SIZE_MAX / 16)) {
+            throw std::runtime_error("Array " + name()->token().lexeme + " is too large");
+        }
+    }
 
-    if (token() == INTEGER_DECL) {
-        arr.val.arr.isInt = true;         // set if it an int array or real array
-        arr.val.arr.ptr = new int[size];  // create new array
+    // small arrays which do not escape are freed with their frame, the
+    // rest are collected
+    ElementType element = element_type();
+    size_t bytes = shape_bytes(dims) + element_bytes(element, length);
+    void *block = inFrame and length <= FRAME_ARRAY_MAX ? frames.carve(bytes) : nullptr;
+    if (not block) {
+        block = heap.allocate(bytes, HEAP_ARRAY);
     }
-    else {
-        arr.val.arr.isInt = false;
-        arr.val.arr.ptr = new double[size];
+
+    // the shape goes in front of the elements
+    int64_t *elements = reinterpret_cast<int64_t*>(static_cast<char*>(block) + shape_bytes(dims));
+    elements[-1] = length;
+    elements[-2] = dims;
+    for (int k = 0; k < dims; k++) {
+        elements[-3 - k] = shape[k];
     }
-    arr.val.arr.size = size;
+    memset(elements, 0, element_bytes(element, length));
 
-    // next add the Result to env
-    std::string name = (*(begin() + 1))->token().lexeme;
-    env.declare(name, ARRAY);
-    env[name] = arr;
-    env[name].type = ARRAY;
-    Result res;
-    return res;
+    arr.array(elements, element);
+    return arr;
+}
+
+ElementType ArrayInit::element_type() const {
+    switch (token().token) {
+        case BYTE_DECL:
+            return ELEMENT_INT8;
+        case SHORT_DECL:
+            return ELEMENT_INT16;
+        case BOOL_DECL:
+            return ELEMENT_BIT;
+        case INTEGER_DECL:
+            return ELEMENT_INT64;
+        default:
+            return ELEMENT_REAL;
+    }
+}
+
+ParseTree *ArrayInit::name() const {
+    return *(end() - 1);
+}
+
+int ArrayInit::rank() const {
+    return end() - begin() - 1;
+}
+
+ParseTree *ArrayInit::bound(int k) const {
+    return *(begin() + k);
+}
+
+bool ArrayInit::dynamic() const {
+    return rank() == 0;
+}
+
+bool ArrayInit::in_frame() const {
+    return _inFrame;
+}
+
+void ArrayInit::in_frame(bool local) {
+    _inFrame = local;
 }
 
 //////////////////////////////////////////
@@ -748,9 +1703,8 @@ VarDecl::VarDecl(LexerToken _token) : UnaryOp(_token)
 
 Result VarDecl::eval()
 {
-    ResultType var_type;
+    ResultType var_type = VOID;
     Result result;
-    result.type = VOID;
 
     //get the variable type
     switch(token().token)
@@ -766,12 +1720,77 @@ Result VarDecl::eval()
     }
 
     //perform the declaration
-    env.declare(child()->token().lexeme, var_type);
+    child()->declare(var_type);
 
     return result;
 }
 
 
+// an array on the left of = is assigned every element at once: names of
+// arrays in the expression are read an element at a time, the rest once
+static void array_compute(Result &arr, ParseTree *named, ParseTree *rhs)
+{
+    FusedExpr expr(rhs, [](ParseTree *leaf) -> ParseTree* {
+        return dynamic_cast<Var*>(leaf) and leaf->ref().type() == ARRAY ? leaf : nullptr;
+    });
+
+    std::string name = named->token().lexeme;
+    check_numbers(arr, named);
+    int64_t n = array_length(arr.ptr());
+    for(ParseTree *other : expr.arrays()) {
+        check_numbers(other->ref(), other);
+        if(array_length(other->ref().ptr()) != n) {
+            throw std::runtime_error("Arrays " + name + " and " + other->token().lexeme +
+                                     " differ in length");
+        }
+    }
+    if(expr.type() == VOID) {
+        throw std::runtime_error("Array " + name + " can only be computed from numbers");
+    }
+
+    // a mismatch is reported once, rather than for every element
+    Result sample(expr.type());
+    if(matches(arr, sample)) {
+        expr.run(arr, 0, n);
+    }
+}
+
+
+// c = x once fused into an ArrayLoad, for an array c
+static void array_fill(Result &arr, ParseTree *named, const Result &value)
+{
+    check_numbers(arr, named);
+    if(value.type() != INTEGER and value.type() != REAL) {
+        throw std::runtime_error("Array " + named->token().lexeme + " can only be computed from numbers");
+    }
+    if(not matches(arr, value)) return;
+    int64_t n = array_length(arr.ptr());
+    for(int64_t i = 0; i < n; i++) {
+        array_write(arr, i, value);
+    }
+}
+
+
+// c = c + k once fused into an IncrementVar, for an array c
+static void array_step(Result &arr, ParseTree *named, const Result &step)
+{
+    check_numbers(arr, named);
+    bool integers = value_of(arr.element_type()) == INTEGER and step.type() == INTEGER;
+    Result sample(integers ? INTEGER : REAL);
+    if(not matches(arr, sample)) return;
+    int64_t n = array_length(arr.ptr());
+    for(int64_t i = 0; i < n; i++) {
+        Result val = array_read(arr, i);
+        if(integers) {
+            val.i(val.i() + step.i());
+        } else {
+            val.r(NUM_RESULT(val) + NUM_RESULT(step));
+        }
+        array_write(arr, i, val);
+    }
+}
+
+
 //////////////////////////////////////////
 // Assign Impelementation
 //////////////////////////////////////////
@@ -782,20 +1801,72 @@ Assign::Assign(LexerToken _token) : BinaryOp(_token)
 
 Result Assign::eval()
 {
+    // whether a whole array is assigned depends on what the name holds now
+    Result &target = left()->ref();
+    if(target.type() == ARRAY) {
+        array_compute(target, left(), right());
+        Result result;
+        return result;
+    }
+
     // get the value and name to assign
     Result val = right()->eval();
-    std::string name = left()->token().lexeme;
 
     //perform the assignment
-    NUM_ASSIGN(env[name], NUM_RESULT(val));
+    NUM_ASSIGN(target, NUM_RESULT(val));
 
     Result result;
-    result.type = VOID;
 
     return result;
 }
 
 
+ParseTree *Assign::fuse()
+{
+    BinaryOp::fuse();
+    std::string name = left()->token().lexeme;
+
+    // x = a[i] becomes an ArrayLoad
+    ArrayAccess *access = dynamic_cast<ArrayAccess*>(right());
+    if(access) {
+        ArrayLoad *load = new ArrayLoad(left()->token());
+        load->slot(left()->slot());
+        load->left(access->left());
+        load->right(access->right());
+        access->left(nullptr);
+        access->right(nullptr);
+        delete this;
+        return load;
+    }
+
+    // x = x + c, x = c + x and x = x - c become an IncrementVar
+    BinaryOp *op = dynamic_cast<BinaryOp*>(right());
+    if(not dynamic_cast<Add*>(op) and not dynamic_cast<Sub*>(op)) {
+        return this;
+    }
+    ParseTree *var = op->left();
+    ParseTree *num = op->right();
+    if(dynamic_cast<Add*>(op) and dynamic_cast<Number*>(var)) {
+        std::swap(var, num);
+    }
+    if(not dynamic_cast<Var*>(var) or var->token().lexeme != name or
+       not dynamic_cast<Number*>(num)) {
+        return this;
+    }
+
+    Result step = num->eval();
+    if(dynamic_cast<Sub*>(op)) {
+        NUM_ASSIGN(step, -NUM_RESULT(step));
+    }
+    IncrementVar *inc = new IncrementVar(left()->token(), step);
+    inc->slot(left()->slot());
+    inc->child(left());
+    left(nullptr);
+    delete this;
+    return inc;
+}
+
+
 //////////////////////////////////////////
 // ArrayDecl Impelementation
 //////////////////////////////////////////
@@ -809,7 +1880,6 @@ Result ArrayDecl::eval()
 
     //return void
     Result result;
-    result.type = VOID;
     return result;
 }
 
@@ -823,16 +1893,8 @@ Result ArrayAccess::eval()
 {
     // left has the array name
     // right has the expression
-    int index = right()->eval().val.i;
-    std::string arrName = left()->token().lexeme;
-
-    Result arr = env[arrName];
-    int* arrayPtr = static_cast<int*>(arr.val.arr.ptr);
-    Result res;
-    res.type = arr.val.arr.isInt ? INTEGER : REAL;
-    NUM_ASSIGN(res, arrayPtr[index]);
-
-    return res;
+    Result index = right()->eval();
+    return element_read(left()->ref(), index, left());
 }
 
 //////////////////////////////////////////
@@ -846,18 +1908,7 @@ Result ArrayAssign::eval() {
     // right has another expression
     Result rhs = right()->eval();
     Result index = left()->eval();
-    int ind = index.val.i;
-    std::string varName = token().lexeme;
-    bool isint = env[varName].val.arr.isInt;
-    if ((isint and rhs.type != INTEGER) or (not isint and rhs.type == INTEGER)) {
-        std::cout<<"result type of expression does not match the array element type\n";
-    } else {
-        int *arrayPtr = static_cast<int*>(env[varName].val.arr.ptr);
-        if (rhs.type == INTEGER)
-            arrayPtr[ind] = rhs.val.i;
-        else
-            arrayPtr[ind] = rhs.val.r;
-    }
+    element_write(ref(), index, rhs, this);
     return rhs;
 }
 
@@ -871,15 +1922,390 @@ ArrayIndex::ArrayIndex(LexerToken _token) : NaryOp(_token)
 }
 
 
+// the row-major offset of the element, the last index varies fastest
 Result ArrayIndex::eval()
 {
+    Result &arr = ref();
+    if(arr.type() != ARRAY) {
+        throw std::runtime_error(token().lexeme + " is not an array");
+    }
+    int dims = array_rank(arr.ptr());
+    if(dims != rank()) {
+        throw std::runtime_error("Array " + token().lexeme + " has " +
+                                 std::to_string(dims) + " dimensions");
+    }
 
-    //return void
+    int64_t flat = 0;
+    int k = 0;
+    for(auto itr = begin(); itr != end(); itr++, k++) {
+        int64_t index = (*itr)->eval().i();
+        int64_t dim = array_dim(arr.ptr(), k);
+        if(k > 0 and (uint64_t) index >= (uint64_t) dim) {
+            dimension_error(this, k, index);
+        }
+        flat = flat * dim + index;
+    }
+
+    Result result;
+    result.i(flat);
+    return result;
+}
+
+
+int ArrayIndex::rank() const
+{
+    return end() - begin();
+}
+
+
+void dimension_error(ParseTree *named, int k, int64_t index)
+{
+    throw std::runtime_error("Index " + std::to_string(index) + " is outside dimension " +
+                             std::to_string(k + 1) + " of array " + named->token().lexeme);
+}
+
+
+//////////////////////////////////////////
+// ArrayAppend Implementation
+//////////////////////////////////////////
+ArrayAppend::ArrayAppend(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result ArrayAppend::eval()
+{
+    // the value first, it may move the array
+    Result value = right()->eval();
+    append(left()->ref(), value);
+    Result result;
+    return result;
+}
+
+
+// append a value to the array, the handle is updated if it moves
+void ArrayAppend::append(Result &arr, const Result &value)
+{
+    check_array(arr, left(), true);
+    if(not matches(arr, value)) return;
+
+    // capacity doubles, so each element is copied O(1) times on average
+    int64_t length = array_length(arr.ptr());
+    if(length == heap.capacity(arr)) {
+        heap.grow(arr, std::max<int64_t>(2 * length, MIN_CAPACITY));
+    }
+
+    array_write(arr, length, value);
+    int64_t *shape = static_cast<int64_t*>(arr.ptr());
+    shape[-1] = shape[-3] = length + 1;
+}
+
+
+//////////////////////////////////////////
+// ArrayReserve Implementation
+//////////////////////////////////////////
+ArrayReserve::ArrayReserve(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result ArrayReserve::eval()
+{
+    int64_t n = right()->eval().i();
+    Result &arr = left()->ref();
+    check_array(arr, left(), true);
+    if(n < 0) {
+        throw std::runtime_error("Array " + left()->token().lexeme + " cannot hold " +
+                                 std::to_string(n) + " elements");
+    }
+
+    if(n > heap.capacity(arr)) {
+        heap.grow(arr, n);
+    }
+    Result result;
+    return result;
+}
+
+
+//////////////////////////////////////////
+// MapInit Implementation
+//////////////////////////////////////////
+MapInit::MapInit(LexerToken _token) : UnaryOp(_token)
+{
+    _key = INTEGER;
+}
+
+
+Result MapInit::eval()
+{
+    Result map = map_create(_key, value_type());
+    child()->declare(ARRAY) = map;
+    Result result;
+    return result;
+}
+
+
+ResultType MapInit::key_type() const
+{
+    return _key;
+}
+
+
+void MapInit::key_type(ResultType type)
+{
+    _key = type;
+}
+
+
+ResultType MapInit::value_type() const
+{
+    return token() == INTEGER_DECL ? INTEGER : REAL;
+}
+
+
+//////////////////////////////////////////
+// MapGet Implementation
+//////////////////////////////////////////
+MapGet::MapGet(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result MapGet::eval()
+{
+    Result key = right()->eval();
+    return get(left()->ref(), key);
+}
+
+
+// look a key up, a missing key reads as zero so counts need no setup
+Result MapGet::get(const Result &map, const Result &key)
+{
+    return map_read(map, key, left());
+}
+
+
+//////////////////////////////////////////
+// MapPut Implementation
+//////////////////////////////////////////
+MapPut::MapPut(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result MapPut::eval()
+{
+    // the value is computed before the key, as for arrays
+    Result value = right()->eval();
+    MapGet *at = static_cast<MapGet*>(left());
+    Result key = at->right()->eval();
+    put(at->left()->ref(), key, value);
+    return value;
+}
+
+
+// set a key's value, the handle is updated if the map moves
+void MapPut::put(Result &map, const Result &key, const Result &value)
+{
+    map_write(map, key, value, static_cast<MapGet*>(left())->left());
+}
+
+
+//////////////////////////////////////////
+// MapContains Implementation
+//////////////////////////////////////////
+MapContains::MapContains(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result MapContains::eval()
+{
+    Result key = right()->eval();
+    Result result;
+    result.i(contains(left()->ref(), key));
+    return result;
+}
+
+
+bool MapContains::contains(const Result &map, const Result &key)
+{
+    return map_find(map, map_key(map, key, left())) != nullptr;
+}
+
+
+//////////////////////////////////////////
+// MapRemove Implementation
+//////////////////////////////////////////
+MapRemove::MapRemove(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result MapRemove::eval()
+{
+    Result key = right()->eval();
+    Result &map = left()->ref();
+    map_remove(map, map_key(map, key, left()));
+    Result result;
+    return result;
+}
+
+
+//////////////////////////////////////////
+// MapKeys Implementation
+//////////////////////////////////////////
+MapKeys::MapKeys(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result MapKeys::eval()
+{
+    Result &map = left()->ref();
+    Result &keys = right()->ref();
+    if(map.type() != ARRAY or map.element_type() != ELEMENT_MAP) {
+        throw std::runtime_error(left()->token().lexeme + " is not a map");
+    }
+    check_array(keys, right(), true);
+    if(value_of(keys.element_type()) != map_table(map)->key) {
+        throw std::runtime_error("Array " + right()->token().lexeme +
+                                 " cannot hold the keys of " + left()->token().lexeme);
+    }
+
+    // growing the array may move the map, both are read from their slots
+    int64_t count = array_length(map.ptr());
+    if(count > heap.capacity(keys)) {
+        heap.grow(keys, count);
+    }
+    int64_t n = 0;
+    map_each(map, [&keys, &n](const Result &key) { array_write(keys, n++, key); });
+
+    int64_t *shape = static_cast<int64_t*>(keys.ptr());
+    shape[-1] = shape[-3] = count;
+    Result result;
+    return result;
+}
+
+
+//////////////////////////////////////////
+// ArrayLength Implementation
+//////////////////////////////////////////
+ArrayLength::ArrayLength(LexerToken _token) : UnaryOp(_token)
+{
+}
+
+
+Result ArrayLength::eval()
+{
+    Result &arr = child()->ref();
+    check_array(arr, child(), false);
     Result result;
-    result.type = VOID;
+    result.i(array_length(arr.ptr()));
     return result;
 }
 
+
+//////////////////////////////////////////
+// ArrayCount Implementation
+//////////////////////////////////////////
+ArrayCount::ArrayCount(LexerToken _token) : BinaryOp(_token)
+{
+}
+
+
+Result ArrayCount::eval()
+{
+    Result &arr = left()->ref();
+    check_numbers(arr, left());
+    Result result;
+    if(not right()) {
+        result.i(count(arr));
+        return result;
+    }
+
+    Result value = right()->eval();
+    if(value.type() != INTEGER and value.type() != REAL) {
+        throw std::runtime_error("Elements of " + left()->token().lexeme +
+                                 " can only be counted by a number");
+    }
+    result.i(count(left()->ref(), value));
+    return result;
+}
+
+
+int64_t ArrayCount::count(const Result &arr)
+{
+    return array_nonzero(arr);
+}
+
+
+int64_t ArrayCount::count(const Result &arr, const Result &value)
+{
+    return array_count(arr, value);
+}
+
+
+//////////////////////////////////////////
+// ArrayReduce Implementation
+//////////////////////////////////////////
+ArrayReduce::ArrayReduce(LexerToken _token) : BinaryOp(_token)
+{
+    // compile the builtin once so reductions never look at the lexeme
+    if (_token.lexeme == "sum") {
+        _op = REDUCE_SUM;
+    } else if (_token.lexeme == "min") {
+        _op = REDUCE_MIN;
+    } else if (_token.lexeme == "max") {
+        _op = REDUCE_MAX;
+    } else if (_token.lexeme == "dot") {
+        _op = REDUCE_DOT;
+    } else {
+        throw std::runtime_error("Unknown reduction " + _token.lexeme);
+    }
+}
+
+
+Result ArrayReduce::eval()
+{
+    Result &a = left()->ref();
+    check_numbers(a, left());
+    if(not right()) return reduce(a, a);
+
+    Result &b = right()->ref();
+    check_numbers(b, right());
+    return reduce(a, b);
+}
+
+
+Result ArrayReduce::reduce(const Result &a, const Result &b)
+{
+    switch(_op) {
+        case REDUCE_SUM:
+            return array_sum(a);
+        case REDUCE_DOT:
+            if(array_length(a.ptr()) != array_length(b.ptr())) {
+                throw std::runtime_error("Arrays " + left()->token().lexeme + " and " +
+                                         right()->token().lexeme + " differ in length");
+            }
+            return array_dot(a, b);
+        default:
+            break;
+    }
+
+    // the least and greatest of nothing are not defined
+    if(array_length(a.ptr()) == 0) {
+        throw std::runtime_error("Array " + left()->token().lexeme + " is empty");
+    }
+    return _op == REDUCE_MIN ? array_min(a) : array_max(a);
+}
+
+
+ReduceOp ArrayReduce::op() const
+{
+    return _op;
+}
+
 //////////////////////////////////////////
 // class definition Implementation
 //////////////////////////////////////////
@@ -887,91 +2313,336 @@ ClassDefinition::ClassDefinition(LexerToken _token) : BinaryOp(_token) {}
 Result ClassDefinition::eval() {
     //left has variable declaration
     //right has function definitions
+
+    // build the vtable, starting from the parent's so that inherited
+    // methods come from every ancestor
+    _vtable.clear();
+    if (isDerived) {
+        if (not env.exists(parentName) or env[parentName].type() != CLASSDECLARATION) {
+            throw std::runtime_error("Class " + parentName + " not defined.");
+        }
+        ClassDefinition *parent = static_cast<ClassDefinition*>(env[parentName].ptr());
+        _vtable = parent->_vtable;
+        _layout = parent->_layout;
+        _offsets = parent->_offsets;
+    } else {
+        _layout.clear();
+        _offsets.clear();
+    }
+
+    // our fields follow the inherited ones, the declarations alternate
+    // with their access modifiers
+    VarDeclList *decls = (VarDeclList*) left();
+    for (auto it = decls->begin(); it != decls->end(); it++) {
+        std::string name;
+        if (VarDecl *decl = dynamic_cast<VarDecl*>(*it)) {
+            name = decl->child()->token().lexeme;
+        } else if (ArrayInit *init = dynamic_cast<ArrayInit*>(*it)) {
+            name = init->name()->token().lexeme;
+        } else {
+            continue;
+        }
+        _offsets[name] = _layout.size();
+        _layout.push_back(*it);
+    }
+
+    // our own methods override the inherited ones
+    DefDeclList *deflist = (DefDeclList*) right();
+    for (auto it = deflist->begin(); it != deflist->end(); it++) {
+        int sel = selector((*it)->token().lexeme);
+        if (sel >= (int) _vtable.size()) {
+            _vtable.resize(sel + 1, nullptr);
+        }
+        _vtable[sel] = *it;
+    }
+
     Result classNode;
-    classNode.val.ptr = this;
+    classNode.ptr(CLASSDECLARATION, this);
     env.declare(token().lexeme, CLASSDECLARATION);
     env[token().lexeme] = classNode;
     Result res;
     return res;
 }
 
+// the method a selector dispatches to (nullptr if there is none)
+ParseTree *ClassDefinition::lookup(int selector) const
+{
+    return selector < (int) _vtable.size() ? _vtable[selector] : nullptr;
+}
+
+// every method name gets a selector, its index in every vtable
+int ClassDefinition::selector(const std::string &methodName)
+{
+    static std::map<std::string, int> selectors;
+    auto itr = selectors.find(methodName);
+    if (itr == selectors.end()) {
+        int sel = selectors.size();
+        itr = selectors.insert({methodName, sel}).first;
+    }
+    return itr->second;
+}
+
+// the offset of a field in every instance (-1 if there is none)
+int ClassDefinition::field(const std::string &name) const
+{
+    auto itr = _offsets.find(name);
+    return itr == _offsets.end() ? -1 : itr->second;
+}
+
+// create an instance, with its fields in one block after the header
+Instance *ClassDefinition::instantiate(bool inFrame)
+{
+    size_t bytes = sizeof(Instance) + _layout.size() * sizeof(Result);
+    void *block = inFrame ? frames.carve(bytes) : nullptr;
+    inFrame = block != nullptr;
+    if (not block) block = heap.allocate(bytes, HEAP_INSTANCE);
+
+    // the fields are set before an array allocation can trace them
+    Result self;
+    self.ptr(OBJECT, block);
+    static_cast<Instance*>(block)->cls = this;
+    Result *fields = static_cast<Instance*>(block)->fields();
+    for (int i = 0; i < (int) _layout.size(); i++) {
+        fields[i] = Result();
+    }
+
+    // the arrays of an instance in a frame go in the frame with it, the
+    // instance may move while they are allocated
+    Root root(self);
+    for (int i = 0; i < (int) _layout.size(); i++) {
+        Result field;
+        if (ArrayInit *init = dynamic_cast<ArrayInit*>(_layout[i])) {
+            field = init->allocate(inFrame);
+        } else {
+            field = Result(_layout[i]->token() == INTEGER_DECL ? INTEGER : REAL);
+        }
+        static_cast<Instance*>(self.ptr())->fields()[i] = field;
+    }
+    return static_cast<Instance*>(self.ptr());
+}
+
+// the number of fields of an instance
+int ClassDefinition::field_count() const
+{
+    return _layout.size();
+}
+
+// does an array still have the shape its declaration gives it
+static bool declared_shape(ArrayInit *init, const Result &arr)
+{
+    if (init->dynamic()) {
+        return array_length(arr.ptr()) == 0;
+    } else if (array_rank(arr.ptr()) != init->rank()) {
+        return false;
+    }
+    for (int k = 0; k < init->rank(); k++) {
+        if (array_dim(arr.ptr(), k) != init->bound(k)->eval().i()) return false;
+    }
+    return true;
+}
+
+// reset an instance in place, as a new one would be: its arrays are
+// zeroed where they are, or allocated again if their shape has changed
+void ClassDefinition::reset(Instance *obj)
+{
+    Result *fields = obj->fields();
+    for (int i = 0; i < (int) _layout.size(); i++) {
+        if (fields[i].type() != ARRAY) {
+            NUM_ASSIGN(fields[i], 0);
+            continue;
+        }
+        ArrayInit *init = static_cast<ArrayInit*>(_layout[i]);
+        if (declared_shape(init, fields[i])) {
+            memset(fields[i].ptr(), 0, element_bytes(init->element_type(), array_length(fields[i].ptr())));
+        } else {
+            fields[i] = init->allocate();
+        }
+    }
+}
+
 //////////////////////////////////////////
 // object creation Implementation
 //////////////////////////////////////////
-ObjectCreation::ObjectCreation(LexerToken _token) : UnaryOp(_token) {}
+ObjectCreation::ObjectCreation(LexerToken _token) : UnaryOp(_token) {
+    _inFrame = false;
+}
 Result ObjectCreation::eval() {
 
-    // create reference env for the object
-    std::string objectName = token().lexeme;
-    env.setEnv(objectName);
-
-    // create new entry for object in global env.. this holds the class name
+    // the class must be defined before it is instantiated
     std::string className = child()->token().lexeme;
-    char *ptr = new char[className.length() + 1];
-    //std::strcpy(ptr, className.c_str());
-    int i = 0;
-    while (i < className.length() + 1) {
-        ptr[i] = className[i];
-        i++;
+    if (not env.exists(className) or env[className].type() != CLASSDECLARATION) {
+        throw std::runtime_error("Class " + className + " not defined.");
     }
-    env[objectName].val.ptr = ptr;
 
+    ClassDefinition *def = static_cast<ClassDefinition*>(env[className].ptr());
     Result res;
+
+    // a local object lives in the frame, created again it is reset in place
+    if (slot() >= 0) {
+        Result &local = frames.fp[slot()];
+        Instance *old = local.type() == OBJECT ? static_cast<Instance*>(local.ptr()) : nullptr;
+        if (local.type() != VOID and not old) {
+            throw std::runtime_error("Redeclaration of " + token().lexeme);
+        } else if (old and old->cls == def and frames.owns(old)) {
+            def->reset(old);
+            return res;
+        }
+        Instance *obj = def->instantiate(_inFrame);
+        local.ptr(OBJECT, obj);
+        return res;
+    }
+
+    // creating an object again replaces its old instance, which is
+    // collected once nothing refers to it
+    std::string objectName = token().lexeme;
+    if (env.exists(objectName) and env[objectName].type() != OBJECT) {
+        throw std::runtime_error("Redeclaration of " + objectName);
+    }
+
+    // the object's entry in the global env points at its instance
+    Instance *obj = def->instantiate();
+    if (not env.exists(objectName)) {
+        env.declare(objectName, OBJECT);
+    }
+    env[objectName].ptr(OBJECT, obj);
     return res;
 }
 
+bool ObjectCreation::in_frame() const {
+    return _inFrame;
+}
+
+void ObjectCreation::in_frame(bool local) {
+    _inFrame = local;
+}
+
 //////////////////////////////////////////
 // object access Implementation
 //////////////////////////////////////////
-ObjectAccess::ObjectAccess(LexerToken _token) : NaryOp(_token) {}
+ObjectAccess::ObjectAccess(LexerToken _token) : NaryOp(_token)
+{
+    _receiver = nullptr;
+    _selector = -1;
+    _cachedClass = nullptr;
+    _cachedMethod = nullptr;
+    _cachedOffset = -1;
+    _tail = false;
+}
 Result ObjectAccess::eval() {
     // check if a function or variable
-    if ((*(begin()+1)) == nullptr) {
+    if (begin() + 1 == end()) {
         //it is a variable access
-        std::string varName = (*begin())->token().lexeme;
-        std::string objName = token().lexeme;
-        // get class name from the env
-        char *class_name = static_cast<char*>(env[objName].val.ptr);
-        // now we have class name, look for the class node
-        std::string className(class_name);
-        ClassDefinition *def = (ClassDefinition*) env[className].val.ptr; // contains the class node
+        return *field();
     } else if ((*(begin()+1))->token() == LPAREN) {
-        //it is a function.. evaluate the function
-        std::string objName = token().lexeme;
-        std::string methodName = (*begin())->token().lexeme;
-
-        // get class name from the env
-        char *class_name = static_cast<char*>(env[objName].val.ptr);
-        // now we have class name, look for the class node
-        std::string className(class_name);
-        ClassDefinition *def = (ClassDefinition*) env[className].val.ptr; // contains the class node
-
-        // right child has the function list
-        DefDeclList *deflist = (DefDeclList*) def->right();
-        for (auto it = deflist->begin(); it != deflist->end(); it++) {
-            if ((*it)->token().lexeme == methodName) {
-                (*it)->eval();
-                Result res;
-                return res;
-            }
+        //it is a function.. evaluate the function in its own frame, a
+        //tail call is left for the caller to make in its frame
+        Method *callee = static_cast<Method*>(method());
+        if (_tail) {
+            frames.defer(callee, arguments(callee));
+        } else {
+            callee->call(arguments(callee));
         }
+    }
+    Result res;
+    return res;
+}
 
-        //if function is not found look in the parent
-        if (def->isDerived) {
-            std::string parentClassName = def->parentName;
-            def = (ClassDefinition*) env[parentClassName].val.ptr;
-            deflist = (DefDeclList*) def->right();
-            for (auto it = deflist->begin(); it != deflist->end(); it++) {
-                if ((*it)->token().lexeme == methodName) {
-                    (*it)->eval();
-                    Result res;
-                    return res;
-                }
-            }
+ParseTree *ObjectAccess::method() {
+    // monomorphic inline cache, the vtable is only consulted when the
+    // receiver's class changes
+    ClassDefinition *def = receiver()->cls;
+    if (def != _cachedClass) {
+        ParseTree *found = def->lookup(_selector);
+        if (found == nullptr) {
+            throw std::runtime_error("Method: " + (*begin())->token().lexeme +
+                                     " not found in: " + token().lexeme);
         }
+        _cachedClass = def;
+        _cachedMethod = found;
+    }
+    return _cachedMethod;
+}
+
+Result *ObjectAccess::field() {
+    // the offset is only looked up when the receiver's class changes
+    Instance *obj = receiver();
+    if (obj->cls != _cachedClass) {
+        int offset = obj->cls->field((*begin())->token().lexeme);
+        if (offset < 0) {
+            throw std::runtime_error("Field: " + (*begin())->token().lexeme +
+                                     " not found in: " + token().lexeme);
+        }
+        _cachedClass = obj->cls;
+        _cachedOffset = offset;
+    }
+    return obj->fields() + _cachedOffset;
+}
 
-        throw std::runtime_error("Method: " + methodName + " not found in: " + objName);
+Instance *ObjectAccess::receiver() {
+    // bind the receiver and the selector on the first access
+    if (_receiver == nullptr) {
+        _receiver = env.slot(token().lexeme);
+        _selector = ClassDefinition::selector((*begin())->token().lexeme);
     }
+
+    // an object created in a method is one of its locals, and lives in the
+    // frame; any other is a global in the env
+    Result *obj = slot() < 0 ? _receiver : &frames.fp[slot()];
+    if (obj->type() == VOID) {
+        throw std::runtime_error(token().lexeme + " not defined.");
+    } else if (obj->type() != OBJECT) {
+        throw std::runtime_error(token().lexeme + " is not an object.");
+    }
+    return static_cast<Instance*>(obj->ptr());
+}
+
+int ObjectAccess::argc() const {
+    // the children are the method name, the parenthesis, then the arguments
+    return end() - begin() - 2;
+}
+
+Result *ObjectAccess::arguments(Method *callee) {
+    if (argc() != callee->arity()) {
+        throw std::runtime_error("Method: " + callee->token().lexeme + " takes " +
+                                 std::to_string(callee->arity()) + " arguments");
+    }
+
+    // the frame is carved off first, so calls in the arguments go above it
+    Result *frame = frames.alloc(callee->frame_size());
+    try {
+        int i = 0;
+        for (auto it = begin() + 2; it != end(); it++, i++) {
+            callee->bind(frame, i, (*it)->eval());
+        }
+    } catch (...) {
+        frames.pop(frame);
+        throw;
+    }
+    return frame;
+}
+
+bool ObjectAccess::tail() const {
+    return _tail;
+}
+
+void ObjectAccess::tail(bool isTail) {
+    _tail = isTail;
+}
+
+//////////////////////////////////////////
+// field assignment Implementation
+//////////////////////////////////////////
+FieldAssign::FieldAssign(LexerToken _token) : BinaryOp(_token) {}
+Result FieldAssign::eval() {
+    Result val = right()->eval();
+    Result *field = static_cast<ObjectAccess*>(left())->field();
+    if (field->type() != INTEGER and field->type() != REAL) {
+        throw std::runtime_error("Cannot assign to " + left()->token().lexeme + "." +
+                                 (*static_cast<ObjectAccess*>(left())->begin())->token().lexeme);
+    }
+
+    //perform the assignment
+    NUM_ASSIGN(*field, NUM_RESULT(val));
     Result res;
     return res;
 }
@@ -1006,27 +2677,160 @@ RecordDef::RecordDef(LexerToken _token) : NaryOp(_token)
 
 Result RecordDef::eval()
 {
+    // the fields were laid out by the parser
+    Result result;
+    return result;
+}
+
+
+// add a field, given its type's token
+bool RecordDef::field(const std::string &name, LexerToken type)
+{
+    if(has(name)) return false;
+    _fields.push_back({name, type});
+    return true;
+}
+
+
+bool RecordDef::has(const std::string &name) const
+{
+    for(auto &field : _fields) {
+        if(field.first == name) return true;
+    }
+    return false;
+}
+
+
+const std::vector<std::pair<std::string, LexerToken>> &RecordDef::fields() const
+{
+    return _fields;
+}
+
+
+//////////////////////////////////////////
+// IncrementVar Implementation
+//////////////////////////////////////////
+IncrementVar::IncrementVar(LexerToken _token, Result step) : UnaryOp(_token)
+{
+    _step = step;
+}
+
+
+Result IncrementVar::eval()
+{
+    // one lookup, then bump the variable in place
+    Result &var = child()->ref();
+    if(var.type() == ARRAY) {
+        array_step(var, child(), _step);
+    } else if(var.type() == INTEGER and _step.type() == INTEGER) {
+        var.i(var.i() + _step.i());
+    } else {
+        NUM_ASSIGN(var, NUM_RESULT(var) + NUM_RESULT(_step));
+    }
 
-    //return void
     Result result;
-    result.type = VOID;
     return result;
 }
 
 
+Result IncrementVar::step() const
+{
+    return _step;
+}
+
+
+void IncrementVar::print(int depth) const
+{
+    print_prefix(depth);
+    std::cout << "INCREMENT: " << token().lexeme << " += " << _step << std::endl;
+}
+
+
 //////////////////////////////////////////
-// RecordAccess Implementation
+// ArrayLoad Implementation
 //////////////////////////////////////////
-RecordAccess::RecordAccess(LexerToken _token) : BinaryOp(_token)
+ArrayLoad::ArrayLoad(LexerToken _token) : BinaryOp(_token)
 {
 }
 
 
-Result RecordAccess::eval()
+Result ArrayLoad::eval()
 {
+    Result index = right()->eval();
+    Result val = element_read(left()->ref(), index, left());
+    Result &target = ref();
+    if(target.type() == ARRAY) {
+        array_fill(target, this, val);
+    } else {
+        NUM_ASSIGN(target, NUM_RESULT(val));
+    }
+
+    Result result;
+    return result;
+}
+
+
+//////////////////////////////////////////
+// ArrayCompare Implementation
+//////////////////////////////////////////
+ArrayCompare::ArrayCompare(LexerToken _token) : ConditionalOp(_token)
+{
+}
+
+
+bool ArrayCompare::test()
+{
+    BinaryOp *l = static_cast<BinaryOp*>(left());
+    BinaryOp *r = static_cast<BinaryOp*>(right());
+
+    // look up the arrays once, sharing the lookup when they are the same
+    Result &a = l->left()->ref();
+    Result &b = l->left()->token().lexeme == r->left()->token().lexeme ? 
+                a : r->left()->ref();
+
+    Result lval = element_read(a, l->right()->eval(), l->left());
+    Result rval = element_read(b, r->right()->eval(), r->left());
+    return compare(_op, lval, rval);
+}
+
+
+ParseTree *ArrayCompare::fuse()
+{
+    // already fused
+    return this;
+}
+
+
+//////////////////////////////////////////
+// ArraySwap Implementation
+//////////////////////////////////////////
+ArraySwap::ArraySwap(LexerToken _token) : NaryOp(_token)
+{
+}
+
+
+Result ArraySwap::eval()
+{
+    Result &arr = ref();
+    Result &temp = (*begin())->ref();
+    Result i = (*(begin()+1))->eval();
+    Result j = (*(begin()+2))->eval();
+
+    // temp = a[i]; a[i] = a[j]; a[j] = temp
+    NUM_ASSIGN(temp, NUM_RESULT(element_read(arr, i, this)));
+    element_write(arr, i, element_read(arr, j, this), this);
+    element_write(arr, j, temp, this);
 
-    //return void
     Result result;
-    result.type = VOID;
     return result;
 }
+
+
+void ArraySwap::print(int depth) const
+{
+    print_prefix(depth);
+    std::cout << "SWAP: " << token().lexeme << std::endl;
+    for(auto itr = begin(); itr != end(); itr++) {
+        (*itr)->print(depth+1);
+    }
+}
\ No newline at end of file
@@ -2,30 +2,19 @@
 // trees of the calc operations. 
 #ifndef OP_H
 #define OP_H
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <functional>
 #include <vector>
 #include <map>
 #include "lexer.h"
+#include "alloc.h"
 
 
 //////////////////////////////////////////
 // Multi-Typed Result Returns
 //////////////////////////////////////////
-struct arrstruct {
-    int size;
-    void *ptr;
-    bool isInt;
-};
-
-union ResultField
-{
-    int i;
-    double r;
-    struct arrstruct arr;
-    void *ptr;
-};
-
-
 enum ResultType 
 {
     VOID=0,
@@ -33,17 +22,172 @@ enum ResultType
     REAL,
     ARRAY,
     CLASSDECLARATION,
-    OBJECT
+    OBJECT,
+    BOOLEAN
 };
 
 
-struct Result
+// The element types arrays are stored as, each in a contiguous block of
+// its own width
+enum ElementType
 {
-    // the value and type of the result
-    ResultField val;
-    ResultType type;
+    ELEMENT_INT64=0,    // integer arrays, as wide as the integers they hold
+    ELEMENT_REAL,
+    ELEMENT_MAP,        // the table of a hash map, see map.h
+    ELEMENT_INT8,
+    ELEMENT_INT16,
+    ELEMENT_BIT         // packed 64 to a word, the lowest bit first
 };
 
+// the element type of an array of a value type, and the reverse; every
+// element type but reals holds integers
+inline ElementType element_of(ResultType type) { return type == INTEGER ? ELEMENT_INT64 : ELEMENT_REAL; }
+inline ResultType value_of(ElementType element) { return element == ELEMENT_REAL ? REAL : INTEGER; }
+
+// the bytes n elements take, bits are rounded up to whole words
+inline size_t element_bytes(ElementType element, int64_t n)
+{
+    switch(element) {
+        case ELEMENT_INT8:
+            return n;
+        case ELEMENT_INT16:
+            return n * sizeof(int16_t);
+        case ELEMENT_BIT:
+            return (n + 63) / 64 * sizeof(uint64_t);
+        case ELEMENT_INT64:
+            return n * sizeof(int64_t);
+        default:
+            return n * sizeof(double);
+    }
+}
+
+// the elements which fit in a number of bytes
+inline int64_t element_room(ElementType element, size_t bytes)
+{
+    if(element == ELEMENT_BIT) return bytes / sizeof(uint64_t) * 64;
+    return bytes / element_bytes(element, 1);
+}
+
+// Integer elements are read and written through their C++ type, and bit
+// elements through this one. Stores keep the low bits of a value, except
+// that a bit is set by any value but zero.
+struct Bit { };
+
+template<typename E> inline int64_t read_element(const void *elements, int64_t i)
+{
+    return static_cast<const E*>(elements)[i];
+}
+
+template<> inline int64_t read_element<Bit>(const void *elements, int64_t i)
+{
+    return static_cast<const uint64_t*>(elements)[i >> 6] >> (i & 63) & 1;
+}
+
+template<typename E> inline void write_element(void *elements, int64_t i, int64_t v)
+{
+    static_cast<E*>(elements)[i] = (E) v;
+}
+
+template<> inline void write_element<Bit>(void *elements, int64_t i, int64_t v)
+{
+    uint64_t &word = static_cast<uint64_t*>(elements)[i >> 6];
+    uint64_t bit = (uint64_t) 1 << (i & 63);
+    word = v ? word | bit : word & ~bit;
+}
+
+// Arrays carry their shape in the 64 bit words just before their
+// elements: the length at [-1], the rank at [-2] and the size of
+// dimension k at [-3-k]. Elements are laid out row-major.
+inline size_t shape_bytes(int rank) { return (2 + rank) * sizeof(int64_t); }
+inline int64_t array_length(const void *elements) { return static_cast<const int64_t*>(elements)[-1]; }
+inline int array_rank(const void *elements) { return static_cast<const int64_t*>(elements)[-2]; }
+inline int64_t array_dim(const void *elements, int k) { return static_cast<const int64_t*>(elements)[-3 - k]; }
+
+
+// Integers are 48 bits wide, the whole payload of a boxed value, and
+// arithmetic on them wraps at that width in every engine.
+const int INT_BITS = 48;
+inline int64_t wrap_int(int64_t v) { return (int64_t) ((uint64_t) v << (64 - INT_BITS)) >> (64 - INT_BITS); }
+
+// products are taken unsigned, so that they wrap rather than overflow
+inline int64_t mul_int(int64_t a, int64_t b) { return wrap_int((int64_t) ((uint64_t) a * (uint64_t) b)); }
+
+// powers are taken by squaring, so that they wrap as products do; a
+// negative exponent truncates the reciprocal toward zero
+inline int64_t pow_int(int64_t a, int64_t b)
+{
+    if(b < 0) return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;
+    int64_t result = 1;
+    for(; b; b >>= 1) {
+        if(b & 1) result = mul_int(result, a);
+        a = mul_int(a, a);
+    }
+    return result;
+}
+
+// parse an integer literal, false if it is out of range
+bool int_literal(const std::string &lexeme, int64_t &value);
+
+
+// A value of any type in 8 bytes. Doubles are stored as they are, and the
+// other types are boxed in the payload of a negative quiet NaN: the top 16
+// bits hold the tag and the low 48 an int, a bool or a pointer. Array
+// pointers are 8 byte aligned, which leaves their low bits for the
+// element type.
+class Result
+{
+public:
+    // results start out void
+    Result() : _bits(tag(VOID)) {}
+
+    // the zero of a type (null for classes, objects and arrays)
+    explicit Result(ResultType type) : _bits(type == REAL ? 0 : tag(type)) {}
+
+    // the type of the value
+    ResultType type() const
+    {
+        uint64_t top = _bits >> 48;
+        return top > NAN_TOP ? (ResultType) (top - NAN_TOP - 1) : REAL;
+    }
+
+    // integers, sign extended from the payload
+    int64_t i() const { return wrap_int((int64_t) _bits); }
+    void i(int64_t v) { _bits = tag(INTEGER) | ((uint64_t) v & INT_MASK); }
+
+    // reals, NaNs are stored in canonical form so they never look boxed
+    double r() const { double v; memcpy(&v, &_bits, sizeof v); return v; }
+    void r(double v)
+    {
+        memcpy(&_bits, &v, sizeof v);
+        if((_bits >> 48) > NAN_TOP) _bits = CANONICAL_NAN;
+    }
+
+    // booleans
+    bool b() const { return _bits & 1; }
+    void b(bool v) { _bits = tag(BOOLEAN) | v; }
+
+    // classes and objects
+    void *ptr() const { return (void*) (_bits & PTR_MASK); }
+    void ptr(ResultType type, void *p) { _bits = tag(type) | (uintptr_t) p; }
+
+    // arrays, and the type of their elements
+    void array(void *elements, ElementType element) { _bits = tag(ARRAY) | (uintptr_t) elements | element; }
+    ElementType element_type() const { return (ElementType) (_bits & 7); }
+
+    // the payload bits of a pointer and of an integer, for native code
+    static const uint64_t PTR_MASK = 0x0000FFFFFFFFFFF8ull;
+    static const uint64_t INT_MASK = 0x0000FFFFFFFFFFFFull;
+
+private:
+    static const uint64_t NAN_TOP = 0xFFF8;                 // the top of a negative quiet NaN
+    static const uint64_t CANONICAL_NAN = 0x7FF8000000000000ull;
+
+    static uint64_t tag(ResultType type) { return (NAN_TOP + 1 + type) << 48; }
+
+    uint64_t _bits;
+};
+static_assert(sizeof(Result) == 8, "Result must stay NaN-boxed");
+
 // convert result types to strings
 extern const char* RTSTR[];
 
@@ -51,10 +195,11 @@ extern const char* RTSTR[];
 std::ostream& operator<<(std::ostream& os, const Result &result);
 
 // A macro to extract the numeric result from Result
-#define NUM_RESULT(res) ((res).type == INTEGER ? (res).val.i : (res).val.r)
+#define NUM_RESULT(res) ((res).type() == INTEGER ? (res).i() : (res).r())
 
-// A macro to assign the correct numeric field
-#define NUM_ASSIGN(res, n) ((res).type == INTEGER ? (res).val.i=(n) : (res).val.r=(n))
+// A macro to assign the correct numeric field (other types are left alone)
+#define NUM_ASSIGN(res, n) ((res).type() == INTEGER ? (res).i(n) : \
+                            (res).type() == REAL ? (res).r(n) : (void) 0)
 
 
 //////////////////////////////////////////
@@ -74,15 +219,88 @@ public:
     // retrieve a variable associative array style
     virtual Result& operator[](const std::string &name);
 
-    // retrieve env of an object
-    virtual RefEnv getEnv(const std::string &objName);
+    // get stable storage for a name, whether or not it is declared yet
+    virtual Result* slot(const std::string &name);
 
-    // set new env for an object
-    virtual void setEnv(const std::string &objName);
+    // apply a function to every variable
+    virtual void visit(const std::function<void(Result&)> &fn);
 
 private:
-    std::map<std::string, Result> _symtab;
-    std::map<std::string, RefEnv> _objtab;
+    // map nodes come from the runtime allocator's slabs
+    std::map<std::string, Result, std::less<std::string>,
+             RuntimeAllocator<std::pair<const std::string, Result>>> _symtab;
+};
+
+// global reference environment for variables
+extern RefEnv env;
+
+
+// the default limit on active calls
+const int MAX_DEPTH = 10000;
+
+// The call stack, method frames of slot-indexed locals are carved off its top
+class Frames
+{
+public:
+    // constructor and destructor
+    Frames(int capacity);
+    virtual ~Frames();
+
+    // carve n undeclared slots off the top of the stack
+    virtual Result *alloc(int n);
+
+    // free a frame and everything above it
+    virtual void pop(Result *frame);
+
+    // apply a function to the named slots of every frame
+    virtual void visit(const std::function<void(Result&)> &fn);
+
+    // carve raw storage for the current frame off the top of the stack,
+    // it is freed with the frame (nullptr if it does not fit)
+    virtual void *carve(size_t bytes);
+
+    // is a pointer into the stack
+    virtual bool owns(const void *p) const;
+
+    // enter a frame, checking the depth limit, and leave it again
+    virtual void enter(Result *frame);
+    virtual void leave(Result *caller, Result *frame);
+
+    // leave a call in tail position to the caller, which makes it in
+    // the caller's frame once the current method returns
+    virtual void defer(class Method *callee, Result *frame);
+
+    // move a deferred call down into frame, returning its method
+    // (nullptr if there is none)
+    virtual class Method *tail_call(Result *frame);
+
+    Result *fp;     // the current frame (nullptr at the top level)
+    Result *sp;     // the first free slot
+    int depth;      // the number of active calls
+    int limit;      // the most active calls allowed
+private:
+    Result *_base;
+    Result *_limit;
+    std::vector<std::pair<Result*, int>> _named;    // the named slots of each frame
+    class Method *_tail;        // the deferred call
+    Result *_tailFrame;
+    char *_native;              // the native stack when we started
+    long _nativeSize;           // how much of it calls may use
+};
+
+// the call stack
+extern Frames frames;
+
+// Runs a call in a frame, which is freed by a single stack pointer reset
+// when the call returns (or throws)
+class CallScope
+{
+public:
+    CallScope(Result *frame) : _caller(frames.fp), _frame(frame) { frames.enter(frame); }
+    ~CallScope() { frames.leave(_caller, _frame); }
+private:
+    Result *_caller;
+    Result *_frame;
 };
 
 
@@ -102,15 +320,32 @@ public:
     // evaluate the parse tree
     virtual Result eval()=0;
 
+    // apply the peephole fusion pass, returning the node which replaces this one
+    virtual ParseTree *fuse();
+
     // print the tree (for debug purposes)
     virtual void print(int depth) const;
 
     // print the prefix for the tree
     virtual void print_prefix(int depth) const;
+
+    // the frame slot the name of this node refers to (-1 for the global env)
+    virtual int slot() const;
+    virtual void slot(int index);
+
+    // the storage the name of this node refers to
+    virtual Result &ref();
+
+    // declare the name of this node, in its frame or the global env
+    virtual Result &declare(ResultType type);
 private:
     LexerToken _token;
+    int _slot;
 };
 
+// apply a function to each child of a tree
+void for_children(ParseTree *tree, std::function<void(ParseTree*)> fn);
+
 
 // Base class for unary operations
 class UnaryOp : public ParseTree
@@ -126,6 +361,9 @@ public:
     virtual ParseTree *child() const;
     virtual void child(ParseTree *_child);
 
+    // fuse the child
+    virtual ParseTree *fuse();
+
     // print the tree with 1 child
     virtual void print(int depth) const;
 protected:
@@ -151,6 +389,9 @@ public:
     virtual ParseTree *right() const;
     virtual void right(ParseTree *child);
 
+    // fuse both children
+    virtual ParseTree *fuse();
+
     // print the tree with 2 children
     virtual void print(int depth) const;
 
@@ -175,6 +416,9 @@ public:
     virtual std::vector<ParseTree*>::const_iterator begin() const;
     virtual std::vector<ParseTree*>::const_iterator end() const;
 
+    // fuse all the children
+    virtual ParseTree *fuse();
+
     // print the tree
     virtual void print(int depth) const;
 protected:
@@ -182,20 +426,105 @@ protected:
 };
 
 
+//////////////////////////////////////////
+// Tiered Execution
+//////////////////////////////////////////
+
+// the optimized form of a unit of code
+typedef std::function<void()> Compiled;
+
+// The optimizing tier, which hot methods and loops are promoted to
+class Optimizer
+{
+public:
+    virtual ~Optimizer() {}
+    virtual Compiled optimize(ParseTree *unit) = 0;
+};
+
+// the optimizer in use (nullptr keeps everything in the tree-walker)
+extern Optimizer *optimizer;
+
+// method invocations and loop back-edges before a unit is promoted
+const int HOT_CALLS = 10;
+const int HOT_BACKEDGES = 1000;
+
+// Thrown by optimized code when an assumption it was compiled under no
+// longer holds, at a point where the tree-walker can take over
+class Deopt : public std::exception {};
+
+// A unit of code which counts its executions and promotes itself when hot
+class Tiered
+{
+public:
+    Tiered();
+
+    // how many units were promoted, and how many of those fell back
+    static void report(std::ostream &os);
+protected:
+    // count executions, and optimize the unit once they reach the threshold
+    virtual void promote(ParseTree *unit, int count, int threshold);
+
+    // run the optimized form, false if it fell back to the tree-walker
+    virtual bool run_optimized();
+
+    int _count;             // invocations or back-edges so far
+    bool _promoted;         // true once the optimizer has seen the unit
+    Compiled _compiled;     // the optimized form, if any
+
+    static int _promotions; // units compiled, in the whole program
+    static int _deopts;     // compiled units which fell back
+};
+
+
 //////////////////////////////////////////
 // CalcOperations
 //////////////////////////////////////////
 
-// A calc program
-class Program : public NaryOp
+// A calc program (also the body of a method)
+class Program : public NaryOp, public Tiered
 {
 public:
     Program(LexerToken _token);
     virtual Result eval();
+
+    // run the body, in the optimized tier once it is hot
+    virtual void invoke();
+    virtual ParseTree *fuse();
     virtual void print(int depth) const;
 };
 
 
+// A method, a program with parameters which runs in its own frame
+class Method : public Program
+{
+public:
+    Method(LexerToken _token);
+
+    // add a parameter declaration
+    virtual void param(ParseTree *decl);
+
+    // access iterators for the parameters
+    virtual std::vector<ParseTree*>::const_iterator params_begin() const;
+    virtual std::vector<ParseTree*>::const_iterator params_end() const;
+    virtual int arity() const;
+
+    // give every parameter and local a slot in the frame
+    virtual void resolve();
+
+    // the number of slots in a frame
+    virtual int frame_size() const;
+
+    // store an argument in its parameter's slot, checking its type
+    virtual void bind(Result *frame, int i, const Result &arg);
+
+    // run the body in a frame from Frames::alloc, which is freed on return
+    virtual void call(Result *frame);
+private:
+    std::vector<ParseTree*> _params;
+    int _size;
+};
+
+
 // An Add Operation
 class Add : public BinaryOp
 {
@@ -293,14 +622,42 @@ public:
     virtual Result eval();
 };
 
-// to declare an array
+// to declare an array (the children are its bounds, then its name)
 class ArrayInit: public NaryOp
 {
 public:
     ArrayInit(LexerToken _token);
     virtual Result eval();
+
+    // allocate a new array of the declared type and size, in the current
+    // frame if it may go there
+    virtual Result allocate(bool inFrame = false);
+
+    // the declared element type
+    virtual ElementType element_type() const;
+
+    // the declared name, and the bound of each dimension
+    virtual ParseTree *name() const;
+    virtual int rank() const;
+    virtual ParseTree *bound(int k) const;
+
+    // is the array declared without bounds, it starts out empty with one
+    // dimension and grows as it is appended to
+    virtual bool dynamic() const;
+
+    // does the array never outlive the frame which declares it
+    virtual bool in_frame() const;
+    virtual void in_frame(bool local);
+private:
+    bool _inFrame;
 };
 
+// the largest array which is placed in a frame
+const int FRAME_ARRAY_MAX = 4096;
+
+// the fewest elements an array grows to when it is appended to
+const int64_t MIN_CAPACITY = 8;
+
 // A SCANF operation
 class ScanF : public ParseTree
 {
@@ -309,12 +666,35 @@ public:
     virtual Result eval();
 };
 
+// a loop which runs as fused array kernels (fused.h)
+class FusedLoop;
+
 // An IF statement
-class IfStatement: public BinaryOp
+class IfStatement: public BinaryOp, public Tiered
 {
 public:
     IfStatement(LexerToken _token);
+    virtual ~IfStatement();
     virtual Result eval();
+    virtual ParseTree *fuse();
+
+    // true if the loop only assigns elements at its counter
+    virtual bool vectorizable() const;
+
+    // run such a loop to its end through the array kernels, false if
+    // its values do not allow it
+    virtual bool vectorize();
+protected:
+    FusedLoop *_fused;      // the kernels' plan of the loop, if it has one
+};
+
+// comparisons a conditional op is compiled into
+enum CompareOp
+{
+    CMP_LT=0,
+    CMP_GT,
+    CMP_EQ,
+    CMP_NE
 };
 
 // A conditional op
@@ -323,6 +703,15 @@ class ConditionalOp: public BinaryOp
 public:
     ConditionalOp(LexerToken _token);
     virtual Result eval();
+    virtual ParseTree *fuse();
+
+    // evaluate the condition once
+    virtual bool test();
+
+    // the compiled comparison
+    virtual CompareOp op() const;
+protected:
+    CompareOp _op;
 };
 
 // can have a bunch of statemetns - used for if/while blocks or for functiosn in future ?
@@ -331,6 +720,7 @@ class Statementblock: public NaryOp
 public:
     Statementblock(LexerToken _token);
     virtual Result eval();
+    virtual ParseTree *fuse();
 };
 
 // A variable declaration operation
@@ -348,6 +738,7 @@ class Assign : public BinaryOp
 public:
     Assign(LexerToken _token);
     virtual Result eval();
+    virtual ParseTree *fuse();
 };
 
 
@@ -376,12 +767,170 @@ public:
     virtual Result eval();
 };
 
-// An array index node
+// A field assignment, the left is the field's ObjectAccess
+class FieldAssign: public BinaryOp
+{
+public:
+    FieldAssign(LexerToken _token);
+    virtual Result eval();
+};
+
+// The indices of an element of a multi-dimensional array, which
+// evaluate to its row-major offset (token has the array, the children
+// are the indices)
 class ArrayIndex: public NaryOp
 {
 public:
     ArrayIndex(LexerToken _token);
     virtual Result eval();
+
+    // the number of indices
+    virtual int rank() const;
+};
+
+// An index outside an inner dimension would reach into another row, so
+// every engine stops there with this error; k counts from 0
+[[noreturn]] void dimension_error(ParseTree *named, int k, int64_t index);
+
+// Appends a value to a one-dimensional array, which grows geometrically
+// (left has the array, right the value)
+class ArrayAppend: public BinaryOp
+{
+public:
+    ArrayAppend(LexerToken _token);
+    virtual Result eval();
+
+    // append a value to the array, the handle is updated if it moves
+    virtual void append(Result &arr, const Result &value);
+};
+
+// Makes room for a number of elements in a one-dimensional array without
+// changing its length (left has the array, right the number)
+class ArrayReserve: public BinaryOp
+{
+public:
+    ArrayReserve(LexerToken _token);
+    virtual Result eval();
+};
+
+// The number of elements in an array (the child has the array)
+class ArrayLength: public UnaryOp
+{
+public:
+    ArrayLength(LexerToken _token);
+    virtual Result eval();
+};
+
+// The number of elements of an array which are not zero, or which equal
+// a number (left has the array, right the number or nullptr)
+class ArrayCount: public BinaryOp
+{
+public:
+    ArrayCount(LexerToken _token);
+    virtual Result eval();
+
+    // count an array's elements, which is known to hold numbers
+    virtual int64_t count(const Result &arr);
+    virtual int64_t count(const Result &arr, const Result &value);
+};
+
+// The sum, least or greatest element of an array, or the dot product of
+// two (the token names the reduction, left has the array, right the
+// second array of a dot product or nullptr)
+// reductions an array builtin is compiled into
+enum ReduceOp
+{
+    REDUCE_SUM=0,
+    REDUCE_MIN,
+    REDUCE_MAX,
+    REDUCE_DOT
+};
+
+class ArrayReduce: public BinaryOp
+{
+public:
+    ArrayReduce(LexerToken _token);
+    virtual Result eval();
+
+    // reduce arrays known to hold numbers, b is only read by dot
+    virtual Result reduce(const Result &a, const Result &b);
+
+    // the compiled reduction
+    virtual ReduceOp op() const;
+protected:
+    ReduceOp _op;
+};
+
+// to declare a hash map (token has the value type, the child is its name)
+class MapInit: public UnaryOp
+{
+public:
+    MapInit(LexerToken _token);
+    virtual Result eval();
+
+    // the declared types of the keys and values
+    virtual ResultType key_type() const;
+    virtual void key_type(ResultType type);
+    virtual ResultType value_type() const;
+private:
+    ResultType _key;
+};
+
+// The value of a key in a map (left has the map, right the key)
+class MapGet: public BinaryOp
+{
+public:
+    MapGet(LexerToken _token);
+    virtual Result eval();
+
+    // look a key up, a missing key reads as zero
+    virtual Result get(const Result &map, const Result &key);
+};
+
+// Sets the value of a key in a map, the left is the MapGet of the key
+class MapPut: public BinaryOp
+{
+public:
+    MapPut(LexerToken _token);
+    virtual Result eval();
+
+    // set a key's value, the handle is updated if the map moves
+    virtual void put(Result &map, const Result &key, const Result &value);
+};
+
+// Is a key in a map, 1 or 0 (left has the map, right the key)
+class MapContains: public BinaryOp
+{
+public:
+    MapContains(LexerToken _token);
+    virtual Result eval();
+    virtual bool contains(const Result &map, const Result &key);
+};
+
+// Removes a key from a map, if it is there (left has the map, right the key)
+class MapRemove: public BinaryOp
+{
+public:
+    MapRemove(LexerToken _token);
+    virtual Result eval();
+};
+
+// Fills a one-dimensional array with the keys of a map, which is how
+// scripts iterate over one (left has the map, right the array)
+class MapKeys: public BinaryOp
+{
+public:
+    MapKeys(LexerToken _token);
+    virtual Result eval();
+};
+
+// An instance of a class, its fields are laid out right after it
+struct Instance
+{
+    class ClassDefinition *cls;
+
+    // the start of the field block
+    Result *fields() { return reinterpret_cast<Result*>(this + 1); }
 };
 
 // A class defintion operation
@@ -390,8 +939,30 @@ class ClassDefinition: public BinaryOp
 public:
     ClassDefinition(LexerToken _token);
     virtual Result eval();
+
+    // the method a selector dispatches to (nullptr if there is none)
+    virtual ParseTree *lookup(int selector) const;
+
+    // every method name gets a selector, its index in every vtable
+    static int selector(const std::string &methodName);
+
+    // the offset of a field in every instance (-1 if there is none)
+    virtual int field(const std::string &name) const;
+
+    // create an instance, in the current frame if it may go there (it is
+    // freed with the frame) or else in the collected heap
+    virtual Instance *instantiate(bool inFrame = false);
+    virtual int field_count() const;
+
+    // reset an instance in place, for an object created again
+    virtual void reset(Instance *obj);
+
     bool isDerived;
     std::string parentName;
+protected:
+    std::vector<ParseTree*> _vtable;        // methods by selector, built by eval
+    std::vector<ParseTree*> _layout;        // field declarations by offset, inherited first
+    std::map<std::string, int> _offsets;    // field offsets by name
 };
 
 // variable declarations in a class
@@ -415,6 +986,12 @@ class ObjectCreation: public UnaryOp
 public:
     ObjectCreation(LexerToken _token);
     virtual Result eval();
+
+    // does the instance never outlive the frame which creates it
+    virtual bool in_frame() const;
+    virtual void in_frame(bool local);
+private:
+    bool _inFrame;
 };
 
 // An object access operation
@@ -423,22 +1000,97 @@ class ObjectAccess: public NaryOp
 public:
     ObjectAccess(LexerToken _token);
     virtual Result eval();
+
+    // find the method a call dispatches to
+    virtual ParseTree *method();
+
+    // find the storage of an accessed field
+    virtual Result *field();
+
+    // the number of arguments of a call
+    virtual int argc() const;
+
+    // allocate a method's frame and bind the arguments, which are
+    // evaluated in the caller's frame
+    virtual Result *arguments(Method *callee);
+
+    // is this call the last thing its method does
+    virtual bool tail() const;
+    virtual void tail(bool isTail);
+private:
+    // the instance the access goes to
+    Instance *receiver();
+
+    Result *_receiver;                  // the object's slot in the env
+    int _selector;                      // the method's selector
+    ClassDefinition *_cachedClass;      // inline cache of the last dispatch
+    ParseTree *_cachedMethod;
+    int _cachedOffset;
+    bool _tail;                         // a call in tail position
 };
 
-// A record definition operation
+// A record definition, a value type. The parser lays a record out as one
+// variable per field named var.field, and an array of records as one
+// array per field, so the definition itself holds nothing at run time.
 class RecordDef: public NaryOp 
 {
 public:
     RecordDef(LexerToken _token);
     virtual Result eval();
+
+    // add a field, given its type's token (false if it is already there)
+    virtual bool field(const std::string &name, LexerToken type);
+
+    // is there a field of a name
+    virtual bool has(const std::string &name) const;
+
+    // the fields and their types, in declaration order
+    virtual const std::vector<std::pair<std::string, LexerToken>> &fields() const;
+private:
+    std::vector<std::pair<std::string, LexerToken>> _fields;
+};
+
+
+//////////////////////////////////////////
+// Fused Superinstructions
+//////////////////////////////////////////
+
+// x = x + c and x = x - c, for a literal c
+class IncrementVar: public UnaryOp
+{
+public:
+    IncrementVar(LexerToken _token, Result step);
+    virtual Result eval();
+    virtual void print(int depth) const;
+    virtual Result step() const;
+protected:
+    Result _step;
+};
+
+// x = a[i] (token has x, left has a, right has the index)
+class ArrayLoad: public BinaryOp
+{
+public:
+    ArrayLoad(LexerToken _token);
+    virtual Result eval();
 };
 
+// a[i] < b[j] (left and right are the ArrayAccess operands)
+class ArrayCompare: public ConditionalOp
+{
+public:
+    ArrayCompare(LexerToken _token);
+    virtual bool test();
+    virtual ParseTree *fuse();
+};
 
-// A record access operation
-class RecordAccess: public BinaryOp
+// t = a[i]; a[i] = a[j]; a[j] = t
+// (token has a, the children are t, i and j)
+class ArraySwap: public NaryOp
 {
 public:
-    RecordAccess(LexerToken _token);
+    ArraySwap(LexerToken _token);
     virtual Result eval();
+    virtual void print(int depth) const;
 };
 #endif
@@ -4,6 +4,89 @@
 #include "parser.h"
 #include "op.h"
 
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// the names of the builtin operations, which are only builtins when
+// they are called so they remain free for variables
+static bool builtin(const std::string &name)
+{
+    return name == "append" or name == "reserve" or name == "length" or
+           name == "contains" or name == "remove" or name == "keys" or
+           name == "count" or name == "sum" or name == "min" or name == "max" or
+           name == "dot";
+}
+
+
+// the element types of compact arrays, which have no scalar form
+static bool compact(const LexerToken &tok)
+{
+    return tok == BYTE_DECL or tok == SHORT_DECL or tok == BOOL_DECL;
+}
+
+
+// a literal or variable, made again from its token
+static ParseTree *leaf(LexerToken tok)
+{
+    if(tok == INTLIT or tok == REALLIT) {
+        return new Number(tok);
+    }
+    return new Var(tok);
+}
+
+
+// the name a field of a record is stored under, var.field
+static LexerToken field_token(LexerToken var, const std::string &field)
+{
+    var.lexeme += "." + field;
+    return var;
+}
+
+
+// the index of an array element, several indices give an ArrayIndex
+static ParseTree *index_of(LexerToken arrayName, const std::vector<ParseTree*> &indices)
+{
+    if(indices.size() == 1) {
+        return indices[0];
+    }
+
+    ArrayIndex *index = new ArrayIndex(arrayName);
+    for(ParseTree *i : indices) {
+        index->push(i);
+    }
+    return index;
+}
+
+
+// the indices of a record element which is copied whole, they are made
+// again for every field so they must be literals or variables
+static std::vector<LexerToken> leaf_tokens(const std::vector<ParseTree*> &indices)
+{
+    std::vector<LexerToken> tokens;
+    for(ParseTree *index : indices) {
+        tokens.push_back(index->token());
+        bool isLeaf = dynamic_cast<Number*>(index) or dynamic_cast<Var*>(index);
+        delete index;
+        if(not isLeaf) {
+            throw ParseError{tokens.back()};
+        }
+    }
+    return tokens;
+}
+
+
+// an element of a field's array, for a record element copied whole
+static ParseTree *element(LexerToken arrayName, const std::vector<LexerToken> &indices)
+{
+    std::vector<ParseTree*> trees;
+    for(const LexerToken &tok : indices) {
+        trees.push_back(leaf(tok));
+    }
+    return index_of(arrayName, trees);
+}
+
+
 //////////////////////////////////////////
 // Parser Implementation
 //////////////////////////////////////////
@@ -87,16 +170,32 @@ ParseTree *Parser::parse_statement()
         LexerToken variableName = curtok();
         next();
 
-        if (has(ISA)) {
+        if (_records.count(variableName.lexeme)) {
+            result = parse_record_decl(variableName);
+        } else if (has(DOT) and _recordVars.count(variableName.lexeme)) {
+            RecordDef *def = _recordVars[variableName.lexeme];
+            result = parse_statement_prime(new Var(parse_field(variableName, def)));
+        } else if (has(EQUAL) and _recordVars.count(variableName.lexeme)) {
+            result = parse_record_assign(variableName);
+        } else if (has(LBRACKET) and _recordArrays.count(variableName.lexeme)) {
+            result = parse_record_element(variableName);
+        } else if (has(ISA)) {
             result = parse_obj_decl(variableName);
         } else if (has(DOT)) {
             result = parse_obj_access(variableName);
+            if (has(EQUAL)) {
+                result = parse_field_assign(result);
+            }
+        } else if (has(LBRACKET) and _maps.count(variableName.lexeme)) {
+            return parse_map_put(variableName);
         } else if (has(LBRACKET)) {
             return parse_array_assign(variableName);
+        } else if (has(LPAREN) and builtin(variableName.lexeme)) {
+            result = parse_builtin(variableName);
         } else {
             result = parse_statement_prime(new Var(variableName));
         }
-    } else if(has(INTEGER_DECL) or has(REAL_DECL)) {
+    } else if(has(INTEGER_DECL) or has(REAL_DECL) or compact(curtok())) {
         result = parse_var_decl();
     } else if(has(IF) || has(WHILE)) {
         result = parse_if();
@@ -106,6 +205,8 @@ ParseTree *Parser::parse_statement()
         result = parse_scanf();
     } else if (has(CLASS)) {
         result = parse_class();
+    } else if (has(RECORD)) {
+        result = parse_record_def();
     } else {
         result = parse_expression();
     }
@@ -131,8 +232,7 @@ ParseTree *Parser::parse_obj_access(LexerToken _token) {
 
         // add all arguments now
         while (not has(RPAREN)) {
-            objectAccess->push(new Var(curtok()));
-            next();
+            objectAccess->push(parse_expression());
             if (has(COMMA))
                 next();
             else
@@ -185,7 +285,13 @@ ParseTree *Parser::parse_var_decl_list() {
     while (has(PUBLIC) or has(PRIVATE)) {
         decList->push(new Var(curtok()));
         next();
-        decList->push(parse_var_decl());
+        // maps are only variables
+        LexerToken type = curtok();
+        ParseTree *decl = parse_var_decl();
+        if (dynamic_cast<MapInit*>(decl)) {
+            throw ParseError{type};
+        }
+        decList->push(decl);
         must_be(NEWLINE);
         next();
     }
@@ -206,14 +312,27 @@ ParseTree *Parser::parse_def_decl_list() {
 ParseTree *Parser::parse_def() {
     next();
 
-    //can re-use program node to store all statements in the function
-    Program *def = new Program(curtok());
+    //a method is a program with parameters and its own frame
+    Method *def = new Method(curtok());
     next();
 
+    // records and maps declared in the method are its locals
+    std::map<std::string, RecordDef*> recordVars = _recordVars;
+    std::map<std::string, RecordDef*> recordArrays = _recordArrays;
+    std::set<std::string> maps = _maps;
+
     must_be(LPAREN);
     next();
-    while (not has(RPAREN))
-        next();
+    while (not has(RPAREN)) {
+        if (not has(INTEGER_DECL) and not has(REAL_DECL) and not compact(curtok())) {
+            throw ParseError{_curtok};
+        }
+        def->param(parse_var_decl());
+        if (has(COMMA))
+            next();
+        else
+            must_be(RPAREN);
+    }
     next();
 
     must_be(ISTO);
@@ -226,6 +345,12 @@ ParseTree *Parser::parse_def() {
         def->push(parse_statement());
     }
     next();
+    _recordVars = recordVars;
+    _recordArrays = recordArrays;
+    _maps = maps;
+
+    // locals are bound to frame slots once the whole body is known
+    def->resolve();
     return def;
 }
 
@@ -238,6 +363,21 @@ ParseTree *Parser::parse_obj_decl(LexerToken _token) {
     return obj;
 }
 
+// obj.field = < Expression >
+ParseTree *Parser::parse_field_assign(ParseTree *access) {
+    // only fields can be assigned, not method calls
+    ObjectAccess *field = static_cast<ObjectAccess*>(access);
+    if (field->begin() + 1 != field->end()) {
+        throw ParseError{_curtok};
+    }
+
+    FieldAssign *result = new FieldAssign(curtok());
+    next();
+    result->left(access);
+    result->right(parse_expression());
+    return result;
+}
+
 /*
  * < Statement' >  ::= EQUAL < Expression > 
  *                     | < Expression' >
@@ -259,6 +399,8 @@ ParseTree *Parser::parse_statement_prime(ParseTree *left)
 
 /*
  * < Var-Decl >    ::= < Type > < Identifier >
+ *                     | < Type > LBRACKET < Bounds > RBRACKET < Identifier >
+ *                     | < Type > LBRACKET < Type > RBRACKET < Identifier >
  */
 ParseTree *Parser::parse_var_decl()
 {
@@ -267,24 +409,87 @@ ParseTree *Parser::parse_var_decl()
 
     if (has(LBRACKET)) {
         next();
-        return parse_array_init(integerOrReal);
+        if ((has(INTEGER_DECL) or has(REAL_DECL)) and not compact(integerOrReal)) {
+            return parse_map_init(integerOrReal);
+        }
+        ParseTree *result = parse_array_init(integerOrReal);
+        _maps.erase(static_cast<ArrayInit*>(result)->name()->token().lexeme);
+        return result;
+    }
+    // byte, short and bool only declare arrays
+    if (compact(integerOrReal)) {
+        throw ParseError{integerOrReal};
     }
     VarDecl *result = new VarDecl(integerOrReal);
     must_be(IDENTIFIER);
     result->child(new Var(curtok()));
+    _maps.erase(curtok().lexeme);
+    forget_record(curtok().lexeme);
     next();
 
     return result;
 }
 
 
+// the value type has been read, the key type is inside the brackets
+ParseTree *Parser::parse_map_init(LexerToken _token) {
+    MapInit *init = new MapInit(_token);
+    init->key_type(has(INTEGER_DECL) ? INTEGER : REAL);
+    next();
+    must_be(RBRACKET);
+    next();
+    must_be(IDENTIFIER);
+    init->child(new Var(curtok()));
+    _maps.insert(curtok().lexeme);
+    forget_record(curtok().lexeme);
+    next();
+    return init;
+}
+
+
+/*
+ * < Map-Put >     ::= IDENTIFIER LBRACKET < Expression > RBRACKET EQUAL < Expression >
+ */
+ParseTree *Parser::parse_map_put(LexerToken name) {
+    next();
+    MapPut *put = new MapPut(name);
+    put->left(parse_map_get(name));
+    must_be(EQUAL);
+    next();
+    put->right(parse_expression());
+    must_be(NEWLINE);
+    next();
+    return put;
+}
+
+
+// the key and closing bracket of a map lookup
+ParseTree *Parser::parse_map_get(LexerToken name) {
+    MapGet *get = new MapGet(name);
+    get->left(new Var(name));
+    get->right(parse_expression());
+    must_be(RBRACKET);
+    next();
+    return get;
+}
+
+
 ParseTree *Parser::parse_array_init(LexerToken _token) {
     ArrayInit *arrinit = new ArrayInit(_token);
-    arrinit->push(parse_number());
+
+    // one bound per dimension, none for an array which grows
+    if (not has(RBRACKET)) {
+        arrinit->push(parse_number());
+    }
+    while (has(COMMA)) {
+        next();
+        arrinit->push(parse_number());
+    }
     must_be(RBRACKET);
     next();
     must_be(IDENTIFIER);
     arrinit->push(new Var(curtok()));
+    forget_record(curtok().lexeme);
     next();
     return arrinit;
 }
@@ -292,7 +497,7 @@ ParseTree *Parser::parse_array_init(LexerToken _token) {
 ParseTree *Parser::parse_array_assign(LexerToken varname) {
     next();
     ArrayAssign *arrasgn = new ArrayAssign(varname);
-    arrasgn->left(parse_expression());
+    arrasgn->left(parse_index(varname));
     must_be(RBRACKET);
     next();
     must_be(EQUAL);
@@ -303,6 +508,297 @@ ParseTree *Parser::parse_array_assign(LexerToken varname) {
     return arrasgn;
 }
 
+ParseTree *Parser::parse_index(LexerToken arrayName) {
+    return index_of(arrayName, parse_indices());
+}
+
+/*
+ * < Index >       ::= < Index > COMMA < Expression >
+ *                     | < Expression >
+ */
+std::vector<ParseTree*> Parser::parse_indices() {
+    std::vector<ParseTree*> indices;
+    indices.push_back(parse_expression());
+    while (has(COMMA)) {
+        next();
+        indices.push_back(parse_expression());
+    }
+    return indices;
+}
+
+/*
+ * < Builtin >     ::= IDENTIFIER LPAREN < Identifier > < Args > RPAREN
+ * < Args >        ::= COMMA < Expression >
+ *                     | ""
+ */
+ParseTree *Parser::parse_builtin(LexerToken name) {
+    next();
+    must_be(IDENTIFIER);
+    Var *arr = new Var(curtok());
+    next();
+
+    ParseTree *result;
+    if (name.lexeme == "length") {
+        ArrayLength *length = new ArrayLength(name);
+        length->child(arr);
+        result = length;
+    } else if (name.lexeme == "count") {
+        // with a number, the elements equal to it are counted
+        ArrayCount *count = new ArrayCount(name);
+        count->left(arr);
+        if (has(COMMA)) {
+            next();
+            count->right(parse_expression());
+        }
+        result = count;
+    } else if (name.lexeme == "sum" or name.lexeme == "min" or name.lexeme == "max") {
+        ArrayReduce *reduce = new ArrayReduce(name);
+        reduce->left(arr);
+        result = reduce;
+    } else if (name.lexeme == "dot") {
+        must_be(COMMA);
+        next();
+        must_be(IDENTIFIER);
+        ArrayReduce *reduce = new ArrayReduce(name);
+        reduce->left(arr);
+        reduce->right(new Var(curtok()));
+        next();
+        result = reduce;
+    } else {
+        must_be(COMMA);
+        next();
+        BinaryOp *op;
+        if (name.lexeme == "append") {
+            op = new ArrayAppend(name);
+        } else if (name.lexeme == "reserve") {
+            op = new ArrayReserve(name);
+        } else if (name.lexeme == "contains") {
+            op = new MapContains(name);
+        } else if (name.lexeme == "remove") {
+            op = new MapRemove(name);
+        } else {
+            op = new MapKeys(name);
+        }
+        op->left(arr);
+
+        // the keys of a map are put in an array, named by the second argument
+        if (name.lexeme == "keys") {
+            must_be(IDENTIFIER);
+            op->right(new Var(curtok()));
+            next();
+        } else {
+            op->right(parse_expression());
+        }
+        result = op;
+    }
+
+    must_be(RPAREN);
+    next();
+    return result;
+}
+
+/*
+ * < Record-Def >  ::= RECORD < Identifier > NEWLINE < Fields > END
+ * < Fields >      ::= < Fields > < Type > < Identifier > NEWLINE
+ *                     | < Type > < Identifier > NEWLINE
+ */
+ParseTree *Parser::parse_record_def() {
+    next();
+    must_be(IDENTIFIER);
+    RecordDef *def = new RecordDef(curtok());
+    next();
+    must_be(NEWLINE);
+    next();
+
+    // the fields are numbers, each declared once
+    do {
+        if (not has(INTEGER_DECL) and not has(REAL_DECL)) {
+            throw ParseError{_curtok};
+        }
+        LexerToken type = curtok();
+        next();
+        must_be(IDENTIFIER);
+        if (not def->field(curtok().lexeme, type)) {
+            throw ParseError{_curtok};
+        }
+        next();
+        must_be(NEWLINE);
+        next();
+    } while (not has(END));
+    next();
+
+    _records[def->token().lexeme] = def;
+    return def;
+}
+
+/*
+ * < Record-Decl > ::= IDENTIFIER < Record-Decl' >
+ * < Record-Decl' >::= IDENTIFIER
+ *                     | LBRACKET < Bounds > RBRACKET IDENTIFIER
+ */
+ParseTree *Parser::parse_record_decl(LexerToken recordName) {
+    RecordDef *def = _records[recordName.lexeme];
+
+    // the bounds of an array of records are made again for each field
+    std::vector<LexerToken> bounds;
+    if (has(LBRACKET)) {
+        do {
+            next();
+            int64_t value;
+            if (not has(INTLIT) and not has(IDENTIFIER)) {
+                throw ParseError{_curtok};
+            } else if (has(INTLIT) and not int_literal(curtok().lexeme, value)) {
+                throw ParseError{_curtok, "Integer literal out of range: " + curtok().lexeme};
+            }
+            bounds.push_back(curtok());
+            next();
+        } while (has(COMMA));
+        must_be(RBRACKET);
+        next();
+    }
+    must_be(IDENTIFIER);
+    LexerToken var = curtok();
+    next();
+
+    // a record is a variable per field, and an array of records an
+    // array per field
+    Statementblock *decls = new Statementblock(recordName);
+    for (auto &field : def->fields()) {
+        LexerToken name = field_token(var, field.first);
+        if (bounds.empty()) {
+            VarDecl *decl = new VarDecl(field.second);
+            decl->child(new Var(name));
+            decls->push(decl);
+        } else {
+            ArrayInit *init = new ArrayInit(field.second);
+            for (const LexerToken &bound : bounds) {
+                init->push(leaf(bound));
+            }
+            init->push(new Var(name));
+            decls->push(init);
+        }
+    }
+
+    _recordVars.erase(var.lexeme);
+    _recordArrays.erase(var.lexeme);
+    if (bounds.empty()) {
+        _recordVars[var.lexeme] = def;
+    } else {
+        _recordArrays[var.lexeme] = def;
+    }
+    return decls;
+}
+
+// p = < Record >, which copies every field
+ParseTree *Parser::parse_record_assign(LexerToken var) {
+    RecordDef *def = _recordVars[var.lexeme];
+    LexerToken equal = curtok();
+    next();
+
+    auto source = parse_record_value(def);
+    Statementblock *copy = new Statementblock(var);
+    for (auto &field : def->fields()) {
+        Assign *assign = new Assign(equal);
+        assign->left(new Var(field_token(var, field.first)));
+        assign->right(source(field.first));
+        copy->push(assign);
+    }
+    return copy;
+}
+
+// ps[i].x = < Expression > and ps[i] = < Record >
+ParseTree *Parser::parse_record_element(LexerToken var) {
+    RecordDef *def = _recordArrays[var.lexeme];
+    next();
+    std::vector<ParseTree*> indices = parse_indices();
+    must_be(RBRACKET);
+    next();
+
+    // a field of an element is an element of the field's array
+    if (has(DOT)) {
+        LexerToken field = parse_field(var, def);
+        ArrayAssign *assign = new ArrayAssign(field);
+        assign->left(index_of(field, indices));
+        must_be(EQUAL);
+        next();
+        assign->right(parse_expression());
+        return assign;
+    }
+
+    std::vector<LexerToken> tokens = leaf_tokens(indices);
+    must_be(EQUAL);
+    next();
+    auto source = parse_record_value(def);
+    Statementblock *copy = new Statementblock(var);
+    for (auto &field : def->fields()) {
+        LexerToken name = field_token(var, field.first);
+        ArrayAssign *assign = new ArrayAssign(name);
+        assign->left(element(name, tokens));
+        assign->right(source(field.first));
+        copy->push(assign);
+    }
+    return copy;
+}
+
+/*
+ * < Record >      ::= IDENTIFIER
+ *                     | IDENTIFIER LBRACKET < Index > RBRACKET
+ *
+ * a record which is copied, of the same record type, given as the
+ * source of each of its fields
+ */
+std::function<ParseTree*(const std::string&)> Parser::parse_record_value(RecordDef *def) {
+    must_be(IDENTIFIER);
+    LexerToken var = curtok();
+    next();
+
+    // a record of another type is a type error, anything else is not a
+    // record at all
+    RecordDef *source = _recordVars.count(var.lexeme) ? _recordVars[var.lexeme] :
+                        _recordArrays.count(var.lexeme) ? _recordArrays[var.lexeme] : nullptr;
+    if (source and source != def) {
+        throw ParseError{var, "cannot assign record " + source->token().lexeme + " to " +
+                              def->token().lexeme};
+    } else if (_recordVars.count(var.lexeme)) {
+        return [var](const std::string &field) -> ParseTree* {
+            return new Var(field_token(var, field));
+        };
+    } else if (not source) {
+        throw ParseError{var};
+    }
+
+    must_be(LBRACKET);
+    next();
+    std::vector<LexerToken> tokens = leaf_tokens(parse_indices());
+    must_be(RBRACKET);
+    next();
+    return [var, tokens](const std::string &field) -> ParseTree* {
+        LexerToken name = field_token(var, field);
+        ArrayAccess *access = new ArrayAccess(name);
+        access->left(new Var(name));
+        access->right(element(name, tokens));
+        return access;
+    };
+}
+
+void Parser::forget_record(const std::string &name) {
+    _recordVars.erase(name);
+    _recordArrays.erase(name);
+}
+
+// DOT < Identifier >, a field of a record, named for where it is stored
+LexerToken Parser::parse_field(LexerToken var, RecordDef *def) {
+    must_be(DOT);
+    next();
+    must_be(IDENTIFIER);
+    if (not def->has(curtok().lexeme)) {
+        throw ParseError{_curtok};
+    }
+    LexerToken field = field_token(var, curtok().lexeme);
+    next();
+    return field;
+}
+
 /*
  * < Print >       ::= PRINT < Expression >
  */
@@ -370,11 +866,11 @@ ParseTree *Parser::parse_if() {
 }
 
 ParseTree *Parser::parse_condition_expression() {
-    ParseTree *result;
     must_be(LPAREN);
     next();
     // need to write logic for collecting <expression> operator <expression>
     auto it = parse_expression();
+    must_be(CONDITIONALOP);
     ConditionalOp *op = new ConditionalOp(curtok());
     next();
     op->left(it);
@@ -520,6 +1016,7 @@ ParseTree *Parser::parse_base()
  * < Number >      ::= INTLIT
  *                     | REALLIT
  *                     | IDENTIFIER
+ *                     | IDENTIFIER DOT IDENTIFIER
  */
 ParseTree *Parser::parse_number()
 {
@@ -528,7 +1025,27 @@ ParseTree *Parser::parse_number()
     if(has(IDENTIFIER)) {
         LexerToken variableName = curtok();
         next();
-        if (not has(LBRACKET)) {
+        if (has(DOT) and _recordVars.count(variableName.lexeme)) {
+            return new Var(parse_field(variableName, _recordVars[variableName.lexeme]));
+        } else if (has(LBRACKET) and _recordArrays.count(variableName.lexeme)) {
+            // a field of an element is an element of the field's array
+            next();
+            std::vector<ParseTree*> indices = parse_indices();
+            must_be(RBRACKET);
+            next();
+            LexerToken field = parse_field(variableName, _recordArrays[variableName.lexeme]);
+            ArrayAccess *res = new ArrayAccess(field);
+            res->left(new Var(field));
+            res->right(index_of(field, indices));
+            return res;
+        } else if (has(DOT)) {
+            return parse_obj_access(variableName);
+        } else if (has(LPAREN) and builtin(variableName.lexeme)) {
+            return parse_builtin(variableName);
+        } else if (has(LBRACKET) and _maps.count(variableName.lexeme)) {
+            next();
+            return parse_map_get(variableName);
+        } else if (not has(LBRACKET)) {
             result = new Var(variableName);
         } else {
 
@@ -536,12 +1053,17 @@ ParseTree *Parser::parse_number()
             next();
             ArrayAccess *res = new ArrayAccess(variableName);
             res->left(result);
-            res->right(parse_expression());
+            res->right(parse_index(variableName));
             must_be(RBRACKET);
             next();
             return res;
         }
     } else if(has(INTLIT)) {
+        // literals too wide for an integer are rejected before they wrap
+        int64_t value;
+        if (not int_literal(curtok().lexeme, value)) {
+            throw ParseError{_curtok, "Integer literal out of range: " + curtok().lexeme};
+        }
         result = new Number(curtok());
         next();
     } else {
@@ -571,6 +1093,19 @@ ParseError::ParseError(LexerToken &_tok)
 }
 
 
+ParseError::ParseError(LexerToken &_tok, const std::string &message)
+{
+    // capture the token
+    this->_tok = _tok;
+
+    // generate the message
+    std::ostringstream os;
+    os << message << " Line: " << _tok.line << " Column: " << _tok.col;
+
+    _msg = os.str();
+}
+
+
 const char* ParseError::what() const noexcept
 {
 
@@ -1,6 +1,10 @@
 #ifndef PARSER_H
 #define PARSER_H
+#include <functional>
 #include <iostream>
+#include <map>
+#include <set>
+#include <vector>
 #include "lexer.h"
 #include "op.h"
 
@@ -9,6 +13,10 @@ class ParseError : std::exception
 {
 public:
     ParseError(LexerToken &tok);
+
+    // an error which says what is wrong with the token, not only where
+    // it is
+    ParseError(LexerToken &tok, const std::string &message);
     virtual const char* what() const noexcept;
     virtual LexerToken token() const;
 
@@ -54,15 +62,42 @@ protected:
     virtual ParseTree *parse_alpha_numeric();
     virtual ParseTree *parse_array_init(LexerToken _token);
     virtual ParseTree *parse_array_assign(LexerToken _token);
+    virtual ParseTree *parse_index(LexerToken _token);
+    virtual std::vector<ParseTree*> parse_indices();
+    virtual ParseTree *parse_builtin(LexerToken _token);
+    virtual ParseTree *parse_map_init(LexerToken _token);
+    virtual ParseTree *parse_map_put(LexerToken _token);
+    virtual ParseTree *parse_map_get(LexerToken _token);
+    virtual ParseTree *parse_record_def();
+    virtual ParseTree *parse_record_decl(LexerToken _token);
+    virtual ParseTree *parse_record_assign(LexerToken _token);
+    virtual ParseTree *parse_record_element(LexerToken _token);
+    virtual std::function<ParseTree*(const std::string&)> parse_record_value(RecordDef *def);
+    virtual LexerToken parse_field(LexerToken var, RecordDef *def);
     virtual ParseTree *parse_class();
     virtual ParseTree *parse_var_decl_list();
     virtual ParseTree *parse_def_decl_list();
     virtual ParseTree *parse_def();
     virtual ParseTree *parse_obj_decl(LexerToken _token);
     virtual ParseTree *parse_obj_access(LexerToken _token);
+    virtual ParseTree *parse_field_assign(ParseTree *access);
 
 private:
+    // a name declared as anything but a record is no longer one
+    void forget_record(const std::string &name);
+
     Lexer &_lexer;
     LexerToken _curtok;
+
+    // records are laid out as they are parsed, so their names and those
+    // of the variables declared with them are kept; the variables a method
+    // declares are forgotten at its end
+    std::map<std::string, RecordDef*> _records;         // record definitions
+    std::map<std::string, RecordDef*> _recordVars;      // records, by name
+    std::map<std::string, RecordDef*> _recordArrays;    // arrays of records, by name
+
+    // a map's elements are looked up with the same brackets as an array's,
+    // and a method's maps are forgotten at its end too
+    std::set<std::string> _maps;
 };
 #endif
@@ -28,7 +28,7 @@ int main(int argc, char **argv) {
         file.close();
 
         tree->print(0);
-    } catch(ParseError e) {
+    } catch(ParseError &e) {
         std::cerr << e.what() << std::endl;
     }
 
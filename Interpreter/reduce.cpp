@@ -0,0 +1,560 @@
+#include <cmath>
+#include <immintrin.h>
+#include "reduce.h"
+
+//////////////////////////////////////////
+// Scalar Kernels
+//////////////////////////////////////////
+
+// Reals are summed in eight lanes, lane k taking the elements at k mod 8
+// until fewer than eight are left. The lanes are added pairwise, k with
+// k + 4 and then across, and the rest one by one, which is the order the
+// AVX2 kernels add them in.
+static const int64_t LANES = 8;
+
+static double combine(const double *lane)
+{
+    double t[4];
+    for(int k = 0; k < 4; k++) {
+        t[k] = lane[k] + lane[k + 4];
+    }
+    return (t[0] + t[2]) + (t[1] + t[3]);
+}
+
+
+static int64_t sum_int64(const int64_t *p, int64_t n)
+{
+    uint64_t result = 0;
+    for(int64_t i = 0; i < n; i++) {
+        result += (uint64_t) p[i];
+    }
+    return (int64_t) result;
+}
+
+
+static double sum_real(const double *p, int64_t n)
+{
+    double lane[LANES] = { 0 };
+    int64_t i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        for(int k = 0; k < LANES; k++) {
+            lane[k] += p[i + k];
+        }
+    }
+
+    double result = combine(lane);
+    for(; i < n; i++) {
+        result += p[i];
+    }
+    return result;
+}
+
+
+// the least or greatest of n > 0 elements; the first NaN among reals is
+// the result, as it is of any arithmetic on it
+template<typename T, bool MAX>
+static T extreme(const T *p, int64_t n)
+{
+    T result = p[0];
+    for(int64_t i = 0; i < n; i++) {
+        if(p[i] != p[i]) return p[i];
+        if(MAX ? p[i] > result : p[i] < result) result = p[i];
+    }
+    return result;
+}
+
+
+static int64_t dot_int64(const int64_t *a, const int64_t *b, int64_t n)
+{
+    uint64_t result = 0;
+    for(int64_t i = 0; i < n; i++) {
+        result += (uint64_t) a[i] * (uint64_t) b[i];
+    }
+    return (int64_t) result;
+}
+
+
+static double dot_real(const double *a, const double *b, int64_t n)
+{
+    double lane[LANES] = { 0 };
+    int64_t i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        for(int k = 0; k < LANES; k++) {
+            lane[k] += a[i + k] * b[i + k];
+        }
+    }
+
+    double result = combine(lane);
+    for(; i < n; i++) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+
+template<typename T>
+static int64_t count(const T *p, int64_t n, T x)
+{
+    int64_t result = 0;
+    for(int64_t i = 0; i < n; i++) {
+        result += p[i] == x;
+    }
+    return result;
+}
+
+
+//////////////////////////////////////////
+// AVX2 Kernels
+//////////////////////////////////////////
+
+// the four 64 bit lanes of a vector added together
+__attribute__((target("avx2")))
+static inline int64_t lanes(__m256i v)
+{
+    alignas(32) int64_t lane[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane), v);
+    return (int64_t) ((uint64_t) lane[0] + lane[1] + lane[2] + lane[3]);
+}
+
+
+// lanes 0-3 and 4-7 of a real sum, combined as the scalar kernels do
+__attribute__((target("avx2")))
+static inline double lanes(__m256d low, __m256d high)
+{
+    __m256d t = _mm256_add_pd(low, high);
+    __m128d u = _mm_add_pd(_mm256_castpd256_pd128(t), _mm256_extractf128_pd(t, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(u, _mm_unpackhi_pd(u, u)));
+}
+
+
+// the low 64 bits of the products of the lanes of two vectors, from
+// products of their 32 bit halves, as AVX2 has no 64 bit multiply
+__attribute__((target("avx2")))
+static inline __m256i mul_epi64(__m256i a, __m256i b)
+{
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+
+__attribute__((target("avx2")))
+static int64_t sum_int64_avx2(const int64_t *p, int64_t n)
+{
+    // the lanes wrap as the scalar sum does, so the order does not matter
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        low = _mm256_add_epi64(low, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+        high = _mm256_add_epi64(high, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 4)));
+    }
+    return (int64_t) ((uint64_t) lanes(_mm256_add_epi64(low, high)) + sum_int64(p + i, n - i));
+}
+
+
+__attribute__((target("avx2")))
+static double sum_real_avx2(const double *p, int64_t n)
+{
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    int64_t i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        low = _mm256_add_pd(low, _mm256_loadu_pd(p + i));
+        high = _mm256_add_pd(high, _mm256_loadu_pd(p + i + 4));
+    }
+
+    double result = lanes(low, high);
+    for(; i < n; i++) {
+        result += p[i];
+    }
+    return result;
+}
+
+
+template<bool MAX>
+__attribute__((target("avx2")))
+static int64_t extreme_int64_avx2(const int64_t *p, int64_t n)
+{
+    if(n < 4) return extreme<int64_t, MAX>(p, n);
+
+    // AVX2 has no 64 bit min or max, so lanes are compared and blended
+    __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    int64_t i = 4;
+    for(; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i take = MAX ? _mm256_cmpgt_epi64(v, acc) : _mm256_cmpgt_epi64(acc, v);
+        acc = _mm256_blendv_epi8(acc, v, take);
+    }
+
+    alignas(32) int64_t lane[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane), acc);
+    int64_t result = extreme<int64_t, MAX>(lane, 4);
+    for(; i < n; i++) {
+        if(MAX ? p[i] > result : p[i] < result) result = p[i];
+    }
+    return result;
+}
+
+
+template<bool MAX>
+__attribute__((target("avx2")))
+static double extreme_real_avx2(const double *p, int64_t n)
+{
+    if(n < 4) return extreme<double, MAX>(p, n);
+
+    // min and max pass over NaNs, so they are looked for apart, and an
+    // array with one is left to the scalar kernel to find the first
+    __m256d acc = _mm256_loadu_pd(p);
+    __m256d nan = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+    int64_t i = 4;
+    for(; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(p + i);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+        acc = MAX ? _mm256_max_pd(acc, v) : _mm256_min_pd(acc, v);
+    }
+    if(_mm256_movemask_pd(nan)) return extreme<double, MAX>(p, n);
+
+    alignas(32) double lane[4];
+    _mm256_store_pd(lane, acc);
+    double result = extreme<double, MAX>(lane, 4);
+    for(; i < n; i++) {
+        if(p[i] != p[i]) return p[i];
+        if(MAX ? p[i] > result : p[i] < result) result = p[i];
+    }
+    return result;
+}
+
+
+__attribute__((target("avx2")))
+static int64_t dot_int64_avx2(const int64_t *a, const int64_t *b, int64_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int64_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        acc = _mm256_add_epi64(acc, mul_epi64(va, vb));
+    }
+    return (int64_t) ((uint64_t) lanes(acc) + dot_int64(a + i, b + i, n - i));
+}
+
+
+__attribute__((target("avx2")))
+static double dot_real_avx2(const double *a, const double *b, int64_t n)
+{
+    // a multiply and an add, not a fused one, as the scalar kernel does
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    int64_t i = 0;
+    for(; i + LANES <= n; i += LANES) {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                                 _mm256_loadu_pd(b + i + 4)));
+    }
+
+    double result = lanes(low, high);
+    for(; i < n; i++) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static int64_t count_int64_avx2(const int64_t *p, int64_t n, int64_t x)
+{
+    __m256i v = _mm256_set1_epi64x(x);
+    int64_t result = 0;
+    int64_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), v);
+        result += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(eq)));
+    }
+    return result + count<int64_t>(p + i, n - i, x);
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static int64_t count_real_avx2(const double *p, int64_t n, double x)
+{
+    __m256d v = _mm256_set1_pd(x);
+    int64_t result = 0;
+    int64_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d eq = _mm256_cmp_pd(_mm256_loadu_pd(p + i), v, _CMP_EQ_OQ);
+        result += __builtin_popcount(_mm256_movemask_pd(eq));
+    }
+    return result + count<double>(p + i, n - i, x);
+}
+
+
+//////////////////////////////////////////
+// Kernel Selection
+//////////////////////////////////////////
+
+// the kernels for integer and real arrays
+struct Kernels
+{
+    int64_t (*sum_int64)(const int64_t *p, int64_t n);
+    double (*sum_real)(const double *p, int64_t n);
+    int64_t (*min_int64)(const int64_t *p, int64_t n);
+    int64_t (*max_int64)(const int64_t *p, int64_t n);
+    double (*min_real)(const double *p, int64_t n);
+    double (*max_real)(const double *p, int64_t n);
+    int64_t (*dot_int64)(const int64_t *a, const int64_t *b, int64_t n);
+    double (*dot_real)(const double *a, const double *b, int64_t n);
+    int64_t (*count_int64)(const int64_t *p, int64_t n, int64_t x);
+    int64_t (*count_real)(const double *p, int64_t n, double x);
+};
+
+static const Kernels SCALAR = {
+    sum_int64, sum_real,
+    extreme<int64_t, false>, extreme<int64_t, true>,
+    extreme<double, false>, extreme<double, true>,
+    dot_int64, dot_real,
+    count<int64_t>, count<double>
+};
+
+static const Kernels AVX2 = {
+    sum_int64_avx2, sum_real_avx2,
+    extreme_int64_avx2<false>, extreme_int64_avx2<true>,
+    extreme_real_avx2<false>, extreme_real_avx2<true>,
+    dot_int64_avx2, dot_real_avx2,
+    count_int64_avx2, count_real_avx2
+};
+
+
+// the kernels this processor runs, its CPUID is read the first time
+static const Kernels &kernels()
+{
+    static const Kernels &chosen = __builtin_cpu_supports("avx2") ? AVX2 : SCALAR;
+    return chosen;
+}
+
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// the set bits of whole words, with the popcnt instruction where the
+// processor has one
+static int64_t popcount(const uint64_t *words, int64_t n)
+{
+    int64_t result = 0;
+    for(int64_t w = 0; w < n; w++) {
+        result += __builtin_popcountll(words[w]);
+    }
+    return result;
+}
+
+
+__attribute__((target("popcnt")))
+static int64_t popcount_native(const uint64_t *words, int64_t n)
+{
+    int64_t result = 0;
+    for(int64_t w = 0; w < n; w++) {
+        result += __builtin_popcountll(words[w]);
+    }
+    return result;
+}
+
+
+// the set bits of a bit array; the bits past its end in the last word
+// may be left over from earlier appends
+static int64_t set_bits(const Result &arr)
+{
+    const uint64_t *words = static_cast<const uint64_t*>(arr.ptr());
+    int64_t n = array_length(arr.ptr());
+    static const bool popcnt = __builtin_cpu_supports("popcnt");
+    int64_t result = popcnt ? popcount_native(words, n / 64) : popcount(words, n / 64);
+    if(n % 64) {
+        result += __builtin_popcountll(words[n / 64] & (((uint64_t) 1 << n % 64) - 1));
+    }
+    return result;
+}
+
+
+// element i of an integer array of any element type
+static int64_t int_at(const Result &arr, int64_t i)
+{
+    switch(arr.element_type()) {
+        case ELEMENT_INT8:
+            return read_element<int8_t>(arr.ptr(), i);
+        case ELEMENT_INT16:
+            return read_element<int16_t>(arr.ptr(), i);
+        case ELEMENT_BIT:
+            return read_element<Bit>(arr.ptr(), i);
+        default:
+            return read_element<int64_t>(arr.ptr(), i);
+    }
+}
+
+
+// element i of an array, as a real
+static double real_at(const Result &arr, int64_t i)
+{
+    if(arr.element_type() == ELEMENT_REAL) return static_cast<const double*>(arr.ptr())[i];
+    return (double) int_at(arr, i);
+}
+
+
+// the sum of a byte or short array
+template<typename T>
+static int64_t sum_small(const T *p, int64_t n)
+{
+    int64_t result = 0;
+    for(int64_t i = 0; i < n; i++) {
+        result += p[i];
+    }
+    return result;
+}
+
+
+// the least or greatest element of an integer array which is not empty
+template<bool MAX>
+static int64_t extreme_int(const Result &arr)
+{
+    int64_t n = array_length(arr.ptr());
+    switch(arr.element_type()) {
+        case ELEMENT_INT8:
+            return extreme<int8_t, MAX>(static_cast<const int8_t*>(arr.ptr()), n);
+        case ELEMENT_INT16:
+            return extreme<int16_t, MAX>(static_cast<const int16_t*>(arr.ptr()), n);
+        case ELEMENT_BIT:
+            // the greatest bit is 1 if any is set, the least if all are
+            return MAX ? set_bits(arr) > 0 : set_bits(arr) == n;
+        default:
+            break;
+    }
+    const int64_t *p = static_cast<const int64_t*>(arr.ptr());
+    return MAX ? kernels().max_int64(p, n) : kernels().min_int64(p, n);
+}
+
+
+//////////////////////////////////////////
+// Reductions
+//////////////////////////////////////////
+
+// the sum of the elements, integers wrap as integer arithmetic does
+Result array_sum(const Result &arr)
+{
+    int64_t n = array_length(arr.ptr());
+    Result result;
+    switch(arr.element_type()) {
+        case ELEMENT_REAL:
+            result.r(kernels().sum_real(static_cast<const double*>(arr.ptr()), n));
+            break;
+        case ELEMENT_INT8:
+            result.i(wrap_int(sum_small(static_cast<const int8_t*>(arr.ptr()), n)));
+            break;
+        case ELEMENT_INT16:
+            result.i(wrap_int(sum_small(static_cast<const int16_t*>(arr.ptr()), n)));
+            break;
+        case ELEMENT_BIT:
+            result.i(set_bits(arr));
+            break;
+        default:
+            result.i(wrap_int(kernels().sum_int64(static_cast<const int64_t*>(arr.ptr()), n)));
+            break;
+    }
+    return result;
+}
+
+
+// the least and greatest elements of an array which is not empty
+Result array_min(const Result &arr)
+{
+    Result result;
+    if(arr.element_type() == ELEMENT_REAL) {
+        result.r(kernels().min_real(static_cast<const double*>(arr.ptr()), array_length(arr.ptr())));
+    } else {
+        result.i(extreme_int<false>(arr));
+    }
+    return result;
+}
+
+
+Result array_max(const Result &arr)
+{
+    Result result;
+    if(arr.element_type() == ELEMENT_REAL) {
+        result.r(kernels().max_real(static_cast<const double*>(arr.ptr()), array_length(arr.ptr())));
+    } else {
+        result.i(extreme_int<true>(arr));
+    }
+    return result;
+}
+
+
+// the sum of the products of the elements of two arrays of one length,
+// an integer if both hold integers
+Result array_dot(const Result &a, const Result &b)
+{
+    int64_t n = array_length(a.ptr());
+    ElementType ea = a.element_type();
+    ElementType eb = b.element_type();
+    Result result;
+    if(ea == ELEMENT_INT64 and eb == ELEMENT_INT64) {
+        result.i(wrap_int(kernels().dot_int64(static_cast<const int64_t*>(a.ptr()),
+                                              static_cast<const int64_t*>(b.ptr()), n)));
+    } else if(ea == ELEMENT_REAL and eb == ELEMENT_REAL) {
+        result.r(kernels().dot_real(static_cast<const double*>(a.ptr()),
+                                    static_cast<const double*>(b.ptr()), n));
+    } else if(ea != ELEMENT_REAL and eb != ELEMENT_REAL) {
+        // other integer arrays are multiplied an element at a time
+        uint64_t sum = 0;
+        for(int64_t i = 0; i < n; i++) {
+            sum += (uint64_t) int_at(a, i) * (uint64_t) int_at(b, i);
+        }
+        result.i(wrap_int((int64_t) sum));
+    } else {
+        // and integers are widened to multiply reals
+        double sum = 0;
+        for(int64_t i = 0; i < n; i++) {
+            sum += real_at(a, i) * real_at(b, i);
+        }
+        result.r(sum);
+    }
+    return result;
+}
+
+
+// the elements equal to a number
+int64_t array_count(const Result &arr, const Result &value)
+{
+    int64_t n = array_length(arr.ptr());
+    double x = NUM_RESULT(value);
+    if(arr.element_type() == ELEMENT_REAL) {
+        return kernels().count_real(static_cast<const double*>(arr.ptr()), n, x);
+    }
+
+    // integer elements only equal whole numbers of their width, which a
+    // real is checked to be before it is converted
+    if(value.type() != INTEGER and not (x >= -0x1p63 and x < 0x1p63 and x == std::trunc(x))) {
+        return 0;
+    }
+    int64_t v = value.type() == INTEGER ? value.i() : (int64_t) x;
+    switch(arr.element_type()) {
+        case ELEMENT_INT8:
+            if(v != (int8_t) v) return 0;
+            return count<int8_t>(static_cast<const int8_t*>(arr.ptr()), n, v);
+        case ELEMENT_INT16:
+            if(v != (int16_t) v) return 0;
+            return count<int16_t>(static_cast<const int16_t*>(arr.ptr()), n, v);
+        case ELEMENT_BIT:
+            return v == 1 ? set_bits(arr) : v == 0 ? n - set_bits(arr) : 0;
+        default:
+            return kernels().count_int64(static_cast<const int64_t*>(arr.ptr()), n, v);
+    }
+}
+
+
+// the elements which are not zero
+int64_t array_nonzero(const Result &arr)
+{
+    if(arr.element_type() == ELEMENT_BIT) return set_bits(arr);
+    Result zero;
+    zero.i(0);
+    return array_length(arr.ptr()) - array_count(arr, zero);
+}
@@ -0,0 +1,26 @@
+// This file contains the reductions over whole arrays which the sum, min,
+// max, dot and count builtins run. Integer and real arrays are reduced by
+// AVX2 kernels when the processor has them, which is asked once through
+// CPUID, and by scalar loops otherwise. Both add reals in the same order,
+// so a script gets the same sums on either. Byte, short and bool arrays
+// are reduced by the scalar loops.
+#ifndef REDUCE_H
+#define REDUCE_H
+#include <cstdint>
+#include "op.h"
+
+// the sum of the elements, integers wrap as integer arithmetic does
+Result array_sum(const Result &arr);
+
+// the least and greatest elements of an array which is not empty
+Result array_min(const Result &arr);
+Result array_max(const Result &arr);
+
+// the sum of the products of the elements of two arrays of one length,
+// an integer if both hold integers
+Result array_dot(const Result &a, const Result &b);
+
+// the elements equal to a number, and those which are not zero
+int64_t array_count(const Result &arr, const Result &value);
+int64_t array_nonzero(const Result &arr);
+#endif
@@ -0,0 +1,298 @@
+#include "types.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// record a declared type, a name declared with two types has no static
+// type (VOID, or a rank of 0)
+template<typename K, typename T>
+static void record(std::map<K, T> &types, const K &name, T type)
+{
+    auto itr = types.find(name);
+    if(itr == types.end()) {
+        types[name] = type;
+    } else if(itr->second != type) {
+        itr->second = T();
+    }
+}
+
+
+// look up a static type
+template<typename K, typename T>
+static T lookup(const std::map<K, T> &types, const K &name)
+{
+    auto itr = types.find(name);
+    return itr == types.end() ? T() : itr->second;
+}
+
+
+//////////////////////////////////////////
+// StaticTypes Implementation
+//////////////////////////////////////////
+
+// constructor
+StaticTypes::StaticTypes()
+{
+    _method = nullptr;
+}
+
+
+// collect the declared types of every variable in the tree
+void StaticTypes::declare(ParseTree *tree)
+{
+    // nodes naming locals are found in their method's scope
+    if(_method and tree->slot() >= 0) _scopes[tree] = _method;
+
+    if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        ResultType type = decl->token() == INTEGER_DECL ? INTEGER : REAL;
+        record(_types, declared(decl->child()), type);
+    } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(tree)) {
+        Name name = declared(init->name());
+        record(_types, name, ARRAY);
+        record(_elements, name, value_of(init->element_type()));
+        record_storage(name, init->element_type());
+        record(_ranks, name, init->dynamic() ? 1 : init->rank());
+        record_key(name, VOID);
+    } else if(MapInit *init = dynamic_cast<MapInit*>(tree)) {
+        // maps are arrays with a key type
+        Name name = declared(init->child());
+        record(_types, name, ARRAY);
+        record(_elements, name, init->value_type());
+        record_storage(name, ELEMENT_MAP);
+        record(_ranks, name, 0);
+        record_key(name, init->key_type());
+    } else if(ObjectCreation *obj = dynamic_cast<ObjectCreation*>(tree)) {
+        // objects and classes share the env with variables
+        Name name = declared(obj);
+        std::string className = obj->child()->token().lexeme;
+        record(_types, name, OBJECT);
+
+        // an object created from two classes has no static class
+        auto itr = _classes.find(name);
+        if(itr == _classes.end()) {
+            _classes[name] = className;
+        } else if(itr->second != className) {
+            itr->second = "";
+        }
+    } else if(ClassDefinition *def = dynamic_cast<ClassDefinition*>(tree)) {
+        std::string name = def->token().lexeme;
+        record(_types, Name(nullptr, name), CLASSDECLARATION);
+        if(def->isDerived) _parents[name] = def->parentName;
+
+        // fields belong to instances, not the env
+        VarDeclList *fields = static_cast<VarDeclList*>(def->left());
+        for(auto itr = fields->begin(); itr != fields->end(); itr++) {
+            if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+                ResultType type = decl->token() == INTEGER_DECL ? INTEGER : REAL;
+                record(_fields, name + "." + decl->child()->token().lexeme, type);
+            } else if(ArrayInit *init = dynamic_cast<ArrayInit*>(*itr)) {
+                record(_fields, name + "." + init->name()->token().lexeme, ARRAY);
+            }
+        }
+        declare(def->right());
+        return;
+    } else if(Method *method = dynamic_cast<Method*>(tree)) {
+        // parameters are declared like locals, in the method's scope
+        ParseTree *outer = _method;
+        _method = method;
+        for(auto itr = method->params_begin(); itr != method->params_end(); itr++) {
+            declare(*itr);
+        }
+        for_children(tree, [this](ParseTree *child) { declare(child); });
+        _method = outer;
+        return;
+    }
+
+    for_children(tree, [this](ParseTree *child) { declare(child); });
+}
+
+
+// the variable a node names; a local found in no method declared here
+// is in a scope of its own, where nothing has a type
+StaticTypes::Name StaticTypes::name(ParseTree *named) const
+{
+    if(named->slot() < 0) return Name(nullptr, named->token().lexeme);
+    auto itr = _scopes.find(named);
+    return Name(itr == _scopes.end() ? named : itr->second, named->token().lexeme);
+}
+
+
+// the variable a declaration declares
+StaticTypes::Name StaticTypes::declared(ParseTree *named)
+{
+    if(_method and named->slot() >= 0) _scopes[named] = _method;
+    return name(named);
+}
+
+
+// the declared type of a variable (VOID if undeclared or declared twice)
+ResultType StaticTypes::var_type(ParseTree *named) const
+{
+    return var_type(name(named));
+}
+
+
+ResultType StaticTypes::var_type(const std::string &name) const
+{
+    return var_type(Name(nullptr, name));
+}
+
+
+ResultType StaticTypes::var_type(const Name &name) const
+{
+    return lookup(_types, name);
+}
+
+
+// the declared element type of an array
+ResultType StaticTypes::element_type(ParseTree *named) const
+{
+    return element_type(name(named));
+}
+
+
+ResultType StaticTypes::element_type(const Name &name) const
+{
+    return var_type(name) == ARRAY ? lookup(_elements, name) : VOID;
+}
+
+
+// how the elements of an array or map are stored, valid when its
+// element type is not VOID
+ElementType StaticTypes::storage(ParseTree *named) const
+{
+    return lookup(_storage, name(named));
+}
+
+
+ElementType StaticTypes::storage(const std::string &name) const
+{
+    return lookup(_storage, Name(nullptr, name));
+}
+
+
+// the declared key type of a map (VOID if it is an array)
+ResultType StaticTypes::key_type(ParseTree *named) const
+{
+    return key_type(name(named));
+}
+
+
+ResultType StaticTypes::key_type(const Name &name) const
+{
+    return var_type(name) == ARRAY ? lookup(_keys, name) : VOID;
+}
+
+
+// the declared number of dimensions of an array (0 if it is not known)
+int StaticTypes::rank(ParseTree *named) const
+{
+    Name var = name(named);
+    return var_type(var) == ARRAY ? lookup(_ranks, var) : 0;
+}
+
+
+// the declared type of an object's field, found through its class chain
+ResultType StaticTypes::field_type(ParseTree *obj, const std::string &field) const
+{
+    Name var = name(obj);
+    auto itr = _classes.find(var);
+    if(var_type(var) != OBJECT or itr == _classes.end()) return VOID;
+
+    // a class which is its own ancestor is not followed forever
+    std::string name = itr->second;
+    for(int depth = 0; not name.empty() and depth <= (int) _parents.size(); depth++) {
+        ResultType type = lookup(_fields, name + "." + field);
+        if(type != VOID) return type;
+
+        auto parent = _parents.find(name);
+        name = parent == _parents.end() ? "" : parent->second;
+    }
+    return VOID;
+}
+
+
+// record the key type of an array or map; as an array's is VOID, a
+// name declared as both has no static type
+void StaticTypes::record_key(const Name &name, ResultType key)
+{
+    auto itr = _keys.find(name);
+    if(itr == _keys.end()) {
+        _keys[name] = key;
+    } else if(itr->second != key) {
+        _types[name] = VOID;
+    }
+}
+
+
+// record how an array's elements are stored; a name declared with two
+// element types of the same value type has no static type either
+void StaticTypes::record_storage(const Name &name, ElementType element)
+{
+    auto itr = _storage.find(name);
+    if(itr == _storage.end()) {
+        _storage[name] = element;
+    } else if(itr->second != element) {
+        _elements[name] = VOID;
+    }
+}
+
+
+// the element type of an array of numbers (VOID for a map)
+ResultType StaticTypes::numbers(ParseTree *named) const
+{
+    Name var = name(named);
+    return key_type(var) == VOID ? element_type(var) : VOID;
+}
+
+
+// the type of an expression (VOID if it cannot be known)
+ResultType StaticTypes::type_of(ParseTree *tree) const
+{
+    if(dynamic_cast<Number*>(tree)) {
+        return tree->token() == INTLIT ? INTEGER : REAL;
+    } else if(dynamic_cast<Var*>(tree)) {
+        ResultType type = var_type(tree);
+        return type == INTEGER or type == REAL ? type : VOID;
+    } else if(ArrayAccess *access = dynamic_cast<ArrayAccess*>(tree)) {
+        // a map used before its declaration is read by the evaluator
+        return numbers(access->left());
+    } else if(ArrayIndex *index = dynamic_cast<ArrayIndex*>(tree)) {
+        // an offset, if the indices match the array's dimensions
+        return rank(index) == index->rank() ? INTEGER : VOID;
+    } else if(MapGet *get = dynamic_cast<MapGet*>(tree)) {
+        return key_type(get->left()) != VOID ? element_type(get->left()) : VOID;
+    } else if(MapContains *contains = dynamic_cast<MapContains*>(tree)) {
+        return key_type(contains->left()) != VOID ? INTEGER : VOID;
+    } else if(ArrayLength *length = dynamic_cast<ArrayLength*>(tree)) {
+        return var_type(length->child()) == ARRAY ? INTEGER : VOID;
+    } else if(ArrayCount *count = dynamic_cast<ArrayCount*>(tree)) {
+        if(numbers(count->left()) == VOID) return VOID;
+        return not count->right() or type_of(count->right()) != VOID ? INTEGER : VOID;
+    } else if(ArrayReduce *reduce = dynamic_cast<ArrayReduce*>(tree)) {
+        // a dot product is real if either array is
+        ResultType type = numbers(reduce->left());
+        if(not reduce->right() or type == VOID) return type;
+        ResultType other = numbers(reduce->right());
+        if(other == VOID) return VOID;
+        return type == REAL or other == REAL ? REAL : INTEGER;
+    } else if(ObjectAccess *access = dynamic_cast<ObjectAccess*>(tree)) {
+        // only field accesses have a value
+        if(access->begin() + 1 != access->end()) return VOID;
+        ResultType type = field_type(access, (*access->begin())->token().lexeme);
+        return type == INTEGER or type == REAL ? type : VOID;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return type_of(neg->child());
+    } else if(dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or
+              dynamic_cast<Mul*>(tree) or dynamic_cast<Div*>(tree) or
+              dynamic_cast<Pow*>(tree)) {
+        // same widening as the evaluator
+        BinaryOp *op = static_cast<BinaryOp*>(tree);
+        ResultType l = type_of(op->left());
+        ResultType r = type_of(op->right());
+        if(l == VOID or r == VOID) return VOID;
+        return l == r ? l : REAL;
+    }
+    return VOID;
+}
@@ -0,0 +1,81 @@
+// This file contains static type inference over parse trees. Every
+// variable has exactly one declaration in its scope, so the type of each
+// name can be collected up front and propagated through expressions. The
+// locals of a method are a scope of their own, so a local keeps its type
+// when a global of the same name has another.
+#ifndef TYPES_H
+#define TYPES_H
+#include <functional>
+#include <map>
+#include <string>
+#include "op.h"
+
+
+class StaticTypes
+{
+public:
+    // constructor
+    StaticTypes();
+
+    // collect the declared types of every variable in the tree
+    virtual void declare(ParseTree *tree);
+
+    // the declared type of the variable a node names, a local of its
+    // method or a global (VOID if undeclared or declared twice)
+    virtual ResultType var_type(ParseTree *named) const;
+
+    // the declared element type of an array
+    virtual ResultType element_type(ParseTree *named) const;
+
+    // how the elements of an array or map are stored, valid when its
+    // element type is not VOID
+    virtual ElementType storage(ParseTree *named) const;
+
+    // the declared key type of a map (VOID if it is an array)
+    virtual ResultType key_type(ParseTree *named) const;
+
+    // the declared number of dimensions of an array (0 if it is not known)
+    virtual int rank(ParseTree *named) const;
+
+    // the element type of an array of numbers (VOID for a map)
+    virtual ResultType numbers(ParseTree *named) const;
+
+    // the declared type of an object's field, found through its class chain
+    virtual ResultType field_type(ParseTree *obj, const std::string &field) const;
+
+    // the declared type and storage of a global, by name
+    virtual ResultType var_type(const std::string &name) const;
+    virtual ElementType storage(const std::string &name) const;
+
+    // the type of an expression (VOID if it cannot be known)
+    virtual ResultType type_of(ParseTree *tree) const;
+
+private:
+    // a variable: the method it is local to (nullptr for a global) and
+    // its name
+    typedef std::pair<ParseTree*, std::string> Name;
+
+    // the variable a node names, and the one a declaration declares
+    Name name(ParseTree *named) const;
+    Name declared(ParseTree *named);
+
+    ResultType var_type(const Name &name) const;
+    ResultType element_type(const Name &name) const;
+    ResultType key_type(const Name &name) const;
+
+    void record_key(const Name &name, ResultType key);
+    void record_storage(const Name &name, ElementType element);
+
+
+    std::map<Name, ResultType> _types;              // declared variable types
+    std::map<Name, ResultType> _elements;           // declared array element types
+    std::map<Name, ElementType> _storage;           // how their elements are stored
+    std::map<Name, int> _ranks;                     // declared array dimensions
+    std::map<Name, ResultType> _keys;               // declared map key types
+    std::map<Name, std::string> _classes;           // the class of each object
+    std::map<std::string, std::string> _parents;    // the parent of each class
+    std::map<std::string, ResultType> _fields;      // field types, by class.field
+    std::map<ParseTree*, ParseTree*> _scopes;       // the method of each node naming a local
+    ParseTree *_method;                             // the method being declared
+};
+#endif